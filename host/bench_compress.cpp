@@ -0,0 +1,90 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+// Host counterpart of the `bench_compress` console command: runs the same benchmark matrix over
+// files on local disk, so codec settings can be judged against real log corpora before flashing.
+//
+// Build (from the repo root):
+//
+//     g++ -std=gnu++2a -O2 -I main -o bench_compress host/bench_compress.cpp
+//         main/bench/compress_bench.cpp main/io/compressed_file.cpp main/io/lz_codec.cpp -lpthread
+//
+// Usage:
+//
+//     ./bench_compress [-w <window_log>]... [-b <block_size>]... -o <out.csv> <file>...
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "bench/compress_bench.hpp"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Instrumented allocator: every allocation carries a header recording its size, so that frees can
+// be accounted for without relying on `malloc_usable_size`.
+
+namespace {
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+}  // namespace
+
+void* operator new(size_t size) {
+  void* const p = malloc(kHeaderSize + size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  *static_cast<size_t*>(p) = size;
+  bench::HostHeapOnAlloc(size);
+  return static_cast<char*>(p) + kHeaderSize;
+}
+
+void operator delete(void* p) noexcept {
+  if (!p) {
+    return;
+  }
+  void* const base = static_cast<char*>(p) - kHeaderSize;
+  bench::HostHeapOnFree(*static_cast<size_t*>(base));
+  free(base);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  bench::CompressBenchMatrix matrix;
+  std::vector<int> window_logs;
+  std::vector<int> block_sizes;
+  std::string csv_path;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      window_logs.push_back(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      block_sizes.push_back(atoi(argv[++i]));
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+  if (csv_path.empty() || inputs.empty()) {
+    fprintf(
+        stderr,
+        "usage: %s [-w <window_log>]... [-b <block_size>]... -o <out.csv> <file>...\n",
+        argv[0]);
+    return 1;
+  }
+  if (!window_logs.empty()) {
+    matrix.window_logs = window_logs;
+  }
+  if (!block_sizes.empty()) {
+    matrix.block_sizes = block_sizes;
+  }
+  return bench::RunCompressBench(inputs, matrix, csv_path, stdout) == ESP_OK ? 0 : 2;
+}
@@ -0,0 +1,144 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+// Host microbenchmark for `ConsoleOutput`: prints `ls -t`-style lines for a synthetic directory
+// of N entries, once the way `ls` used to (`printf` per field into a line-buffered stream, like
+// the console's stdout) and once through `ConsoleOutput`, and reports the time and the number of
+// `write` calls each takes.
+//
+// The host's writes are far cheaper than the console's (a VFS/UART driver round trip each), so
+// the number of writes matters more than the time here.
+//
+// Build (from the repo root):
+//
+//     g++ -std=gnu++2a -O2 -I main -I components/fmtlib/fmt/include -DFMT_HEADER_ONLY
+//         -o bench_console_output host/bench_console_output.cpp main/common/console_output.cpp
+//
+// Usage:
+//
+//     ./bench_console_output [-n <entries>] [<out>]     (default: 5000 entries to /dev/null)
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/console_output.hpp"
+
+namespace {
+
+struct Entry {
+  std::string name;
+  bool is_dir;
+  uint64_t size;
+  int year, mon, mday, hour, min, sec;
+};
+
+std::vector<Entry> MakeEntries(int n) {
+  std::vector<Entry> entries;
+  for (int i = 0; i < n; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "LOG%05d.TXT", i);
+    entries.push_back({name, i % 50 == 0, uint64_t{37} * i * i, 2022, 1 + i % 12, 1 + i % 28,
+                       i % 24, i % 60, (i * 7) % 60});
+  }
+  return entries;
+}
+
+void LegacyPrint(FILE* f, const Entry& e) {
+  fprintf(
+      f,
+      "name='%.*s' type=%s size=%llu",
+      static_cast<int>(e.name.size()),
+      e.name.data(),
+      e.is_dir ? "DIR" : "REG",
+      static_cast<unsigned long long>(e.size));
+  fprintf(f, " mtim=%04d-%02d-%02d_%02d:%02d:%02d", e.year, e.mon, e.mday, e.hour, e.min, e.sec);
+  fprintf(f, "\n");
+}
+
+void BufferedPrint(ConsoleOutput* out, const Entry& e) {
+  out->Print("name='{}' type={} size={}", e.name, e.is_dir ? "DIR" : "REG", e.size);
+  out->Print(
+      " mtim={:04d}-{:02d}-{:02d}_{:02d}:{:02d}:{:02d}", e.year, e.mon, e.mday, e.hour, e.min,
+      e.sec);
+  out->Print("\n");
+}
+
+/// Counts the `write` calls made on a file through `fopencookie`, forwarding to the real file.
+struct CountingFile {
+  FILE* target;
+  int num_writes = 0;
+
+  static ssize_t Write(void* cookie, const char* data, size_t size) {
+    auto* self = static_cast<CountingFile*>(cookie);
+    ++self->num_writes;
+    return fwrite(data, 1, size, self->target);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int n = 5000;
+  const char* out_path = "/dev/null";
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      n = atoi(argv[++i]);
+    } else {
+      out_path = argv[i];
+    }
+  }
+  FILE* const target = fopen(out_path, "w");
+  if (!target || n <= 0) {
+    fprintf(stderr, "usage: %s [-n <entries>] [<out>]\n", argv[0]);
+    return 2;
+  }
+  const std::vector<Entry> entries = MakeEntries(n);
+
+  // legacy: line-buffered like the console, every flushed line is one `write`
+  CountingFile legacy_file{target};
+  FILE* const legacy =
+      fopencookie(&legacy_file, "w", {nullptr, &CountingFile::Write, nullptr, nullptr});
+  setvbuf(legacy, nullptr, _IOLBF, BUFSIZ);
+  auto t0 = std::chrono::steady_clock::now();
+  for (const Entry& e : entries) {
+    LegacyPrint(legacy, e);
+  }
+  fflush(legacy);
+  const double legacy_s =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  // `ConsoleOutput` writes to the file descriptor directly; every write but the last one is at
+  // least `kBufferSize` bytes, which bounds their number
+  fflush(target);
+  uint64_t buffered_bytes;
+  t0 = std::chrono::steady_clock::now();
+  {
+    ConsoleOutput out(target);
+    for (const Entry& e : entries) {
+      BufferedPrint(&out, e);
+    }
+    out.Flush();
+    buffered_bytes = out.size();
+  }
+  const double buffered_s =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  const int buffered_writes =
+      static_cast<int>((buffered_bytes + ConsoleOutput::kBufferSize - 1) /
+                       ConsoleOutput::kBufferSize);
+  printf("%d entries, %llu bytes\n", n, static_cast<unsigned long long>(buffered_bytes));
+  printf("  legacy   %8.3f ms %7d writes\n", legacy_s * 1e3, legacy_file.num_writes);
+  printf("  buffered %8.3f ms %7d writes (at most)\n", buffered_s * 1e3, buffered_writes);
+  printf(
+      "  speedup  %.2fx, %.0fx fewer writes\n",
+      legacy_s / buffered_s,
+      static_cast<double>(legacy_file.num_writes) / buffered_writes);
+  fclose(legacy);
+  fclose(target);
+  return 0;
+}
@@ -0,0 +1,177 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+// Host microbenchmark for `io::FileLineReaderImpl`: lines/s over log files, compared against the
+// previous implementation (byte-wise `std::find`, `memmove` on every refill, recursive `Next`),
+// which is kept below verbatim as `LegacyLineReader`.
+//
+// The input is read from memory, so only the line splitting itself is measured.
+//
+// Build (from the repo root):
+//
+//     g++ -std=gnu++2a -O2 -I main -o bench_line_reader host/bench_line_reader.cpp
+//         main/io/file_line_reader.cpp
+//
+// Usage:
+//
+//     ./bench_line_reader [-m <max_line_size>] [-n <repeat>] <file>...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "io/file_line_reader.hpp"
+
+namespace {
+
+using ByteSource = io::FileLineReaderImpl::ByteSource;
+
+class LegacyLineReader {
+ public:
+  LegacyLineReader(ByteSource source, int max_line_size, char sep = '\n')
+      : source_(std::move(source)),
+        buf_{std::make_unique<char[]>(max_line_size)},
+        size_(max_line_size),
+        begin_(0),
+        end_(0),
+        sep_(sep),
+        eof_(false) {
+    FillBuffer();
+  }
+
+  std::optional<std::string_view> Next() {
+    if (begin_ == end_ && eof_) {
+      return {};
+    }
+    const int next =
+        std::min<int>(end_, std::find(&buf_[begin_], &buf_[end_], sep_) - &buf_[0] + 1);
+    if (next < end_ || begin_ == 0) {
+      const std::string_view result(&buf_[begin_], next - begin_);
+      begin_ = next;
+      return result;
+    }
+    FillBuffer();
+    return Next();
+  }
+
+ private:
+  ByteSource source_;
+  std::unique_ptr<char[]> buf_;
+  int size_;
+  int begin_;
+  int end_;
+  char sep_;
+  bool eof_;
+
+  bool FillBuffer() {
+    if (begin_) {
+      memmove(&buf_[0], &buf_[begin_], end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    if (end_ < size_ && !eof_) {
+      const int want_size = size_ - end_;
+      const int read_size = source_(&buf_[end_], want_size);
+      end_ += read_size;
+      eof_ = read_size < want_size;
+    }
+    return eof_;
+  }
+};
+
+ByteSource MemorySource(const std::string& data) {
+  return [&data, offset = size_t{0}](char* out, size_t size) mutable {
+    const size_t n = std::min(size, data.size() - offset);
+    memcpy(out, data.data() + offset, n);
+    offset += n;
+    return n;
+  };
+}
+
+struct Result {
+  size_t lines = 0;
+  size_t bytes = 0;
+  double seconds = 0;
+};
+
+template <typename Reader>
+Result Run(const std::string& data, int max_line_size, int repeat) {
+  Result result;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; i++) {
+    Reader reader(MemorySource(data), max_line_size);
+    while (const std::optional<std::string_view> line = reader.Next()) {
+      ++result.lines;
+      result.bytes += line->size();
+    }
+  }
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return result;
+}
+
+void Print(const char* name, const Result& r) {
+  printf(
+      "  %-8s %10zu lines %8.3fs %8.2f Mlines/s %8.1f MB/s\n",
+      name,
+      r.lines,
+      r.seconds,
+      r.lines / r.seconds / 1e6,
+      r.bytes / r.seconds / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int max_line_size = 256;
+  int repeat = 5;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      max_line_size = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || max_line_size <= 0 || repeat <= 0) {
+    fprintf(stderr, "usage: %s [-m <max_line_size>] [-n <repeat>] <file>...\n", argv[0]);
+    return 2;
+  }
+
+  for (const char* path : paths) {
+    std::string data;
+    FILE* const f = fopen(path, "rb");
+    if (!f) {
+      fprintf(stderr, "cannot open %s\n", path);
+      return 1;
+    }
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+      data.append(chunk, n);
+    }
+    fclose(f);
+
+    printf("%s (%zu bytes, max_line_size=%d, x%d)\n", path, data.size(), max_line_size, repeat);
+    const Result legacy = Run<LegacyLineReader>(data, max_line_size, repeat);
+    const Result current = Run<io::FileLineReaderImpl>(data, max_line_size, repeat);
+    Print("legacy", legacy);
+    Print("current", current);
+    if (legacy.lines != current.lines || legacy.bytes != current.bytes) {
+      fprintf(stderr, "MISMATCH: legacy and current readers disagree\n");
+      return 1;
+    }
+    printf("  speedup  %.2fx\n", legacy.seconds / current.seconds);
+  }
+  return 0;
+}
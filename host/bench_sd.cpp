@@ -0,0 +1,70 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+// Host counterpart of the `sdbench` console command: runs the same matrix against a scratch file
+// (the "vfs" path) and optionally a file-backed block device (the "raw" path), e.g. an SD card in
+// a USB reader or an image file.
+//
+// NOTE: Reads are served from the page cache unless the OS is told otherwise (e.g. drop caches
+// between runs), so host read numbers are only an upper bound.
+//
+// Build (from the repo root):
+//
+//     g++ -std=gnu++2a -O2 -I main -o bench_sd host/bench_sd.cpp main/bench/sd_bench.cpp
+//         main/io/block_device.cpp
+//
+// Usage:
+//
+//     ./bench_sd [-b <block_size>]... [-s <file_MiB>] [-r <device_or_image>] -o <out.csv> <file>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/sd_bench.hpp"
+#include "io/block_device.hpp"
+
+int main(int argc, char** argv) {
+  bench::SdBenchMatrix matrix;
+  bench::SdBenchTarget target;
+  std::vector<int> block_sizes;
+  std::string csv_path;
+  std::string raw_path;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      block_sizes.push_back(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      target.file_size = uint64_t(atoi(argv[++i])) << 20;
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      raw_path = argv[++i];
+    } else {
+      target.file_path = argv[i];
+    }
+  }
+  if (csv_path.empty() || target.file_path.empty()) {
+    fprintf(
+        stderr,
+        "usage: %s [-b <block_size>]... [-s <file_MiB>] [-r <device_or_image>] -o <out.csv> "
+        "<file>\n",
+        argv[0]);
+    return 1;
+  }
+  if (!block_sizes.empty()) {
+    matrix.block_sizes = block_sizes;
+  }
+  std::unique_ptr<io::FileBlockDevice> raw;
+  if (!raw_path.empty()) {
+    raw = io::FileBlockDevice::Create(raw_path, /*writable*/ true);
+    if (!raw) {
+      return 1;
+    }
+    target.raw_device = raw.get();
+  } else {
+    matrix.paths = {bench::SdBenchPath::kVfs};
+  }
+  return bench::RunSdBench(target, matrix, csv_path, stdout) == ESP_OK ? 0 : 2;
+}
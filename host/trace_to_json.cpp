@@ -0,0 +1,245 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+// Host tool converting a trace dump (the `trace -o` console command, i.e. `DumpTrace`) into Chrome
+// trace JSON, to be opened in chrome://tracing or https://ui.perfetto.dev.
+//
+// Every task becomes a thread (named from the task list in the dump where known); the core each
+// event ran on is kept in its args. Timestamps are unwrapped from 32 bits and made relative to
+// the first event.
+//
+// Build (from the repo root):
+//
+//     g++ -std=gnu++2a -O2 -I main -o trace_to_json host/trace_to_json.cpp main/common/trace.cpp
+//
+// Usage:
+//
+//     ./trace_to_json <dump> [<out.json>]
+//
+// `selftest` records a few events through the `TRACE_*` macros, dumps and converts them.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define CONFIG_TRACE_ENABLED 1  // for `selftest`
+#include "common/macros.hpp"
+#include "common/trace.hpp"
+
+namespace {
+
+struct Trace {
+  std::vector<std::string> event_names;
+  std::map<uint32_t, std::string> task_names;
+  std::vector<TraceRecord> records;
+};
+
+bool ReadName(FILE* f, std::string* name) {
+  uint8_t size;
+  if (fread(&size, 1, 1, f) != 1) {
+    return false;
+  }
+  name->resize(size);
+  return fread(name->data(), 1, size, f) == size;
+}
+
+bool ReadTrace(FILE* f, Trace* trace) {
+  TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      memcmp(header.magic, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+    fprintf(stderr, "not a trace dump\n");
+    return false;
+  }
+  if (header.version != kTraceVersion || header.record_size != sizeof(TraceRecord)) {
+    fprintf(
+        stderr,
+        "unsupported version %d (record size %d)\n",
+        header.version,
+        header.record_size);
+    return false;
+  }
+  trace->event_names.resize(header.num_event_names);
+  for (std::string& name : trace->event_names) {
+    if (!ReadName(f, &name)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < header.num_task_names; i++) {
+    uint32_t task;
+    std::string name;
+    if (fread(&task, sizeof(task), 1, f) != 1 || !ReadName(f, &name)) {
+      return false;
+    }
+    trace->task_names[task] = name;
+  }
+  trace->records.resize(header.num_records);
+  if (fread(trace->records.data(), sizeof(TraceRecord), header.num_records, f) !=
+      header.num_records) {
+    fprintf(stderr, "truncated\n");
+    return false;
+  }
+  return true;
+}
+
+struct Event {
+  int64_t t_us;
+  const TraceRecord* record;
+};
+
+/// Unwraps the 32-bit timestamps: each record is taken as the closest 64-bit time to the previous
+/// one on its core (records of one core are in order), and the first record of each core as the
+/// closest to the very first record.
+std::vector<Event> Unwrap(const std::vector<TraceRecord>& records) {
+  std::vector<Event> events;
+  std::map<int, int64_t> last_by_core;
+  int64_t reference = records.empty() ? 0 : records[0].t_us;
+  for (const TraceRecord& r : records) {
+    const auto it = last_by_core.find(r.core);
+    const int64_t prev = it == last_by_core.end() ? reference : it->second;
+    const int64_t t = prev + static_cast<int32_t>(r.t_us - static_cast<uint32_t>(prev));
+    last_by_core[r.core] = t;
+    events.push_back({t, &r});
+  }
+  std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+    return a.t_us < b.t_us;
+  });
+  return events;
+}
+
+void WriteJsonString(FILE* out, const std::string& s) {
+  fputc('"', out);
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+void WriteJson(const Trace& trace, FILE* out) {
+  const std::vector<Event> events = Unwrap(trace.records);
+  const int64_t t0 = events.empty() ? 0 : events[0].t_us;
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  const auto separator = [&first, out]() {
+    if (!first) {
+      fprintf(out, ",\n");
+    }
+    first = false;
+  };
+
+  std::map<uint32_t, bool> tasks;
+  for (const Event& e : events) {
+    tasks[e.record->task] = true;
+  }
+  for (const auto& [task, unused] : tasks) {
+    const auto it = trace.task_names.find(task);
+    char fallback[16];
+    snprintf(fallback, sizeof(fallback), "task %08x", task);
+    separator();
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u", task);
+    fprintf(out, ",\"args\":{\"name\":");
+    WriteJsonString(out, it != trace.task_names.end() ? it->second : fallback);
+    fprintf(out, "}}");
+  }
+
+  for (const Event& e : events) {
+    const TraceRecord& r = *e.record;
+    const char* phase = r.phase == static_cast<uint8_t>(TracePhase::kBegin) ? "B"
+                        : r.phase == static_cast<uint8_t>(TracePhase::kEnd) ? "E"
+                                                                            : "i";
+    const std::string name = r.event < trace.event_names.size()
+                                 ? trace.event_names[r.event]
+                                 : "event " + std::to_string(r.event);
+    separator();
+    fprintf(out, "{\"ph\":\"%s\",\"name\":", phase);
+    WriteJsonString(out, name);
+    fprintf(out, ",\"ts\":%lld,\"pid\":0,\"tid\":%u", static_cast<long long>(e.t_us - t0), r.task);
+    if (phase[0] == 'i') {
+      fprintf(out, ",\"s\":\"t\"");
+    }
+    fprintf(out, ",\"args\":{\"core\":%u,\"arg\":%u}}", r.core, r.arg);
+  }
+  fprintf(out, "\n]}\n");
+}
+
+int Convert(const char* in_path, const char* out_path) {
+  FILE* const in = fopen(in_path, "rb");
+  if (!in) {
+    fprintf(stderr, "cannot open %s\n", in_path);
+    return 1;
+  }
+  Trace trace;
+  const bool ok = ReadTrace(in, &trace);
+  fclose(in);
+  if (!ok) {
+    return 1;
+  }
+  FILE* const out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "cannot open %s\n", out_path);
+    return 1;
+  }
+  WriteJson(trace, out);
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "%zu records\n", trace.records.size());
+  return 0;
+}
+
+int SelfTest() {
+  TraceRing& ring = TraceRing::Get();
+  ring.Clear();
+  for (int i = 0; i < 3; i++) {
+    TRACE_SCOPE(kCompressBlock, 1000 * i);
+    TRACE_INSTANT(kMark, i);
+  }
+  TRACE_BEGIN(kIoWrite, 0);
+  TRACE_END(kIoWrite);
+
+  FILE* const f = tmpfile();
+  if (!f || DumpTrace(f) != ESP_OK) {
+    fprintf(stderr, "FAIL: dump\n");
+    return 1;
+  }
+  rewind(f);
+  Trace trace;
+  if (!ReadTrace(f, &trace)) {
+    fprintf(stderr, "FAIL: read back\n");
+    return 1;
+  }
+  fclose(f);
+  if (trace.records.size() != 11 || trace.event_names.size() != kNumTraceEvents ||
+      trace.event_names[static_cast<int>(TraceEvent::kCompressBlock)] != "compress" ||
+      trace.records[3].arg != 1000 ||
+      trace.records[2].phase != static_cast<int>(TracePhase::kEnd)) {
+    fprintf(stderr, "FAIL: unexpected contents\n");
+    return 1;
+  }
+  WriteJson(trace, stdout);
+  fprintf(stderr, "selftest OK\n");
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 2 && !strcmp(argv[1], "selftest")) {
+    return SelfTest();
+  }
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s <dump> [<out.json>] | selftest\n", argv[0]);
+    return 2;
+  }
+  return Convert(argv[1], argc == 3 ? argv[2] : nullptr);
+}
@@ -1,24 +1,51 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "argtable3/argtable3.h"
 #include "cmd_system.h"
 #include "driver/gpio.h"
+#include "driver/uart.h"
 #include "esp_console.h"
 #include "esp_err.h"
 #include "scope_guard/scope_guard.hpp"
 
+#include "bench/compress_bench.hpp"
+#include "bench/sd_bench.hpp"
+#include "common/boot_profiler.hpp"
+#include "common/command_memory.hpp"
 #include "common/console_command.hpp"
 #include "common/console_command_registry.hpp"
+#include "common/console_output.hpp"
+#include "common/csv.hpp"
 #include "common/macros.hpp"
+#include "common/memory_pool.hpp"
+#include "common/scoped_timer.hpp"
+#include "common/task_stats.hpp"
+#include "io/async_file_writer.hpp"
+#include "io/block_device.hpp"
+#include "io/compress_pipeline.hpp"
+#include "io/compressed_file.hpp"
+#include "io/dir_walker.hpp"
+#include "io/dma_buffer.hpp"
 #include "io/file_line_reader.hpp"
 #include "io/fs_utils.hpp"
+#include "io/io_stats.hpp"
+#include "io/preallocated_file.hpp"
+#include "io/raw_ring_log.hpp"
 #include "io/sd_card_daemon.hpp"
+#include "io/sector_reader.hpp"
+#include "io/seekable_compressed_file.hpp"
 
 namespace {
 constexpr char TAG[] = "main";
 
 constexpr gpio_num_t kCardDetectPin = GPIO_NUM_34;
+constexpr int kMountWaitLogMs = 5000;
 }  // namespace
 
 std::unique_ptr<io::SdCardDaemon> g_sd_card;
@@ -37,11 +64,46 @@ esp_err_t SetupSdCard() {
   return g_sd_card ? ESP_OK : ESP_FAIL;
 }
 
-const std::map<uint8_t, std::string> kDirentTypeName{
-    {DT_REG, "DT_REG"},
-    {DT_DIR, "DT_DIR"},
-    {DT_UNKNOWN, "DT_UNKNOWN"},
-};
+/// Opens the file given with a command's `-o` option, if any, for `ConsoleOutput`.
+///
+/// \return false if the option is given but the file cannot be opened
+bool OpenOutputFile(const arg_file* out, io::OwnedFile* file) {
+  if (!out->count) {
+    return true;
+  }
+  *file = io::OpenFile(out->filename[0], "w");
+  if (!*file) {
+    ESP_LOGE(TAG, "cannot open %s", out->filename[0]);
+    return false;
+  }
+  return true;
+}
+
+/// Summarizes how long a command took to produce its output, to tell output-bound from I/O-bound.
+void PrintOutputRate(const ConsoleOutput& out, int64_t t0_us) {
+  const int64_t elapsed_us = std::max<int64_t>(NowMonotonicUs() - t0_us, 1);
+  printf(
+      "%llu bytes of output in %.1f ms (%.1f KiB/s)\n",
+      static_cast<unsigned long long>(out.size()),
+      elapsed_us / 1e3,
+      out.size() * 1e6 / 1024 / elapsed_us);
+}
+
+void PrintFatDirEntry(ConsoleOutput* out, const io::FatDirEntry& e, bool show_time) {
+  out->Print("name='{}' type={} size={}", e.name, e.is_dir() ? "DIR" : "REG", e.size);
+  if (show_time) {
+    const TimeParts mt = e.mtime();
+    out->Print(
+        " mtim={:04d}-{:02d}-{:02d}_{:02d}:{:02d}:{:02d}",
+        mt.tm_year + 1900,
+        mt.tm_mon + 1,
+        mt.tm_mday,
+        mt.tm_hour,
+        mt.tm_min,
+        mt.tm_sec);
+  }
+  out->Print("\n");
+}
 
 DEFINE_CONSOLE_COMMAND(
     ls,
@@ -49,9 +111,15 @@ DEFINE_CONSOLE_COMMAND(
     /*hint*/ nullptr,
     {
       arg_lit* time = arg_lit0("t", "time", "show time");
+      arg_str* sort = arg_str0("s", "sort", "<name|size|time>", "sort entries (default: unsorted)");
+      arg_lit* reverse = arg_lit0("r", "reverse", "reverse the sort order");
+      arg_int* limit = arg_int0("n", "limit", "<N>", "with -s, only the first N (default 100)");
+      arg_str* pattern = arg_str0("p", "pattern", "<glob>", "only list names matching the glob");
+      arg_file* out = arg_file0("o", "out", "<file>", "write the listing to this file instead");
       arg_str* path = arg_str1(nullptr, nullptr, "<path>", "path to list");
     },
-    /*num_end*/ 1) {
+    /*num_end*/ 7) {
+  constexpr int kDefaultSortedLimit = 100;
   CHECK(path->count == 1);
 
   if (!g_sd_card->CheckIsCardWorking()) {
@@ -59,32 +127,188 @@ DEFINE_CONSOLE_COMMAND(
     return 2;
   }
 
-  std::string dir = "/s";
-  dir += path->sval[0];
+  Arena& arena = CommandArena();
+  const char* const fatfs_dir = io::ToFatfsPath(arena.Concat({"/s", path->sval[0]}), &arena);
+  if (!fatfs_dir) {
+    ESP_LOGE(TAG, "invalid path: %s", path->sval[0]);
+    return 1;
+  }
+
+  io::FatDirFilter filter;
+  if (pattern->count) {
+    const std::string_view glob = pattern->sval[0];
+    filter = [glob](const io::FatDirEntry& e) {
+      return GlobMatch(glob, e.name, /*ignore_case*/ true);
+    };
+  }
+  const bool show_time = time->count;
+  io::OwnedFile out_file(nullptr, fclose);
+  if (!OpenOutputFile(out, &out_file)) {
+    return 1;
+  }
+  const int64_t t0_us = NowMonotonicUs();
+  ConsoleOutput output(out_file ? out_file.get() : stdout);
 
-  for (dirent* p : io::DirIter(dir.c_str())) {
-    printf("name='%s' type=%d (%s)", p->d_name, p->d_type, kDirentTypeName.at(p->d_type).c_str());
-    if (p->d_type == DT_REG) {
-      struct stat s {};
-      stat((dir + "/" + p->d_name).c_str(), &s);
-      TimeParts mt = ToParts(s.st_mtim);
-      printf(" size=%d", (int)s.st_size);
-      if (time->count) {
-        // st_ctim is not populated, and we don't have st_birthtim / st_birthtimespec
-        printf(
-            " mtim=%04d-%02d-%02d_%02d:%02d:%02d",
-            mt.tm_year + 1900,
-            mt.tm_mon + 1,
-            mt.tm_mday,
-            mt.tm_hour,
-            mt.tm_min,
-            mt.tm_sec);
+  if (!sort->count) {
+    // directory order: printed as it is read, nothing is kept
+    io::FatDirIterImpl iter(fatfs_dir, std::move(filter));
+    int num_entries = 0;
+    while (const std::optional<const io::FatDirEntry*> e = iter.Next()) {
+      PrintFatDirEntry(&output, **e, show_time);
+      ++num_entries;
+    }
+    output.Print("{} entries\n", num_entries);
+    const esp_err_t output_err = output.Flush();
+    PrintOutputRate(output, t0_us);
+    return iter.error() == ESP_OK && output_err == ESP_OK ? 0 : 1;
+  }
+
+  const std::string_view key = sort->sval[0];
+  io::FatDirLess less;
+  if (key == "name") {
+    less = io::fat_dir_order::ByName;
+  } else if (key == "size") {
+    less = io::fat_dir_order::BySize;
+  } else if (key == "time") {
+    less = io::fat_dir_order::ByTime;
+  } else {
+    ESP_LOGE(TAG, "unknown sort key: %s", sort->sval[0]);
+    return 1;
+  }
+  if (reverse->count) {
+    less = [less](const io::FatDirEntry& a, const io::FatDirEntry& b) { return less(b, a); };
+  }
+  const int num_limit = limit->count ? limit->ival[0] : kDefaultSortedLimit;
+  if (num_limit <= 0) {
+    ESP_LOGE(TAG, "invalid limit: %d", num_limit);
+    return 1;
+  }
+  std::vector<io::FatDirRecord> entries;
+  const esp_err_t err = io::ListFatDirSorted(fatfs_dir, filter, less, num_limit, &entries);
+  for (const io::FatDirRecord& record : entries) {
+    PrintFatDirEntry(&output, record.entry(), show_time);
+  }
+  output.Print("{} entries\n", entries.size());
+  const esp_err_t output_err = output.Flush();
+  PrintOutputRate(output, t0_us);
+  return err == ESP_OK && output_err == ESP_OK ? 0 : 1;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    du,
+    "sum up file sizes per directory subtree",
+    /*hint*/ nullptr,
+    {
+      arg_int* depth = arg_int0("d", "depth", "<N>", "print subtrees down to depth N (default 1)");
+      arg_file* path = arg_file1(nullptr, nullptr, "<dir>", nullptr);
+    },
+    /*num_end*/ 2) {
+  struct Totals {
+    uint64_t bytes = 0;
+    int files = 0;
+  };
+
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const char* const fatfs_dir = io::ToFatfsPath(path->filename[0], &CommandArena());
+  if (!fatfs_dir) {
+    ESP_LOGE(TAG, "not on the SD card: %s", path->filename[0]);
+    return 1;
+  }
+  const int print_depth = depth->count ? depth->ival[0] : 1;
+
+  // one running total per open directory, plus the root
+  std::vector<Totals> totals(1);
+  io::DirWalkerImpl walker(fatfs_dir);
+  while (const std::optional<const io::DirWalkEntry*> e = walker.Next()) {
+    switch ((*e)->kind) {
+      case io::DirWalkEntry::Kind::kFile:
+        totals.back().bytes += (*e)->entry.size;
+        ++totals.back().files;
+        break;
+      case io::DirWalkEntry::Kind::kEnterDir:
+        totals.emplace_back();
+        break;
+      case io::DirWalkEntry::Kind::kLeaveDir: {
+        const Totals subtree = totals.back();
+        totals.pop_back();
+        totals.back().bytes += subtree.bytes;
+        totals.back().files += subtree.files;
+        if ((*e)->depth < print_depth) {
+          printf(
+              "%12llu %8d %s/%.*s\n",
+              static_cast<unsigned long long>(subtree.bytes),
+              subtree.files,
+              path->filename[0],
+              static_cast<int>((*e)->path.size()),
+              (*e)->path.data());
+        }
+        break;
       }
     }
-    printf("\n");
   }
+  printf(
+      "%12llu %8d %s\n",
+      static_cast<unsigned long long>(totals[0].bytes),
+      totals[0].files,
+      path->filename[0]);
+  if (walker.num_depth_limited()) {
+    ESP_LOGW(TAG, "%d directories too deep to enter", walker.num_depth_limited());
+  }
+  return walker.error() == ESP_OK ? 0 : 1;
+}
 
-  return 0;
+DEFINE_CONSOLE_COMMAND(
+    find,
+    "print files and directories whose name matches a glob (`*` and `?`, case-insensitive)",
+    /*hint*/ nullptr,
+    {
+      arg_str* type = arg_str0("t", "type", "<f|d>", "only files (f) or directories (d)");
+      arg_int* max_depth = arg_int0("d", "max-depth", "<N>", "descend at most N levels");
+      arg_file* out = arg_file0("o", "out", "<file>", "write the matches to this file instead");
+      arg_file* path = arg_file1(nullptr, nullptr, "<dir>", nullptr);
+      arg_str* pattern = arg_str1(nullptr, nullptr, "<glob>", nullptr);
+    },
+    /*num_end*/ 5) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const char* const fatfs_dir = io::ToFatfsPath(path->filename[0], &CommandArena());
+  if (!fatfs_dir) {
+    ESP_LOGE(TAG, "not on the SD card: %s", path->filename[0]);
+    return 1;
+  }
+  const bool want_files = !type->count || type->sval[0][0] == 'f';
+  const bool want_dirs = !type->count || type->sval[0][0] == 'd';
+  const std::string_view glob = pattern->sval[0];
+  io::OwnedFile out_file(nullptr, fclose);
+  if (!OpenOutputFile(out, &out_file)) {
+    return 1;
+  }
+  ConsoleOutput output(out_file ? out_file.get() : stdout);
+
+  // matches are printed as they are found; nothing is collected
+  io::DirWalkerImpl walker(
+      fatfs_dir, max_depth->count ? max_depth->ival[0] : io::DirWalkerImpl::kDefaultMaxDepth);
+  int num_matches = 0;
+  uint64_t total_bytes = 0;
+  while (const std::optional<const io::DirWalkEntry*> e = walker.Next()) {
+    const io::DirWalkEntry& walk = **e;
+    const bool is_file = walk.kind == io::DirWalkEntry::Kind::kFile;
+    if (walk.kind == io::DirWalkEntry::Kind::kLeaveDir || !(is_file ? want_files : want_dirs) ||
+        !GlobMatch(glob, walk.entry.name, /*ignore_case*/ true)) {
+      continue;
+    }
+    output.Print("{}/{}\n", path->filename[0], walk.path);
+    ++num_matches;
+    total_bytes += walk.entry.size;
+  }
+  output.Print("{} matches, {} bytes in files\n", num_matches, total_bytes);
+  const esp_err_t output_err = output.Flush();
+  return walker.error() == ESP_OK && output_err == ESP_OK ? 0 : 1;
 }
 
 DEFINE_CONSOLE_COMMAND(
@@ -97,15 +321,978 @@ DEFINE_CONSOLE_COMMAND(
     ESP_LOGE(TAG, "SD card not ready");
     return 2;
   }
+  auto reader = io::SectorReader::Create(path->filename[0]);
+  if (!reader) {
+    return 1;
+  }
+  printf("\n------------------\n");
+  // lines are printed as-is, so whole chunks can go straight from the DMA buffer to stdout
+  for (std::string_view chunk; !(chunk = reader->NextChunk()).empty();) {
+    fwrite(chunk.data(), 1, chunk.size(), stdout);
+  }
+  printf("====================\n\n");
+  return reader->error() == ESP_OK ? 0 : 1;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    tail,
+    "print the last lines of a file; with -f, keep printing appended data until a key is pressed",
+    /*hint*/ nullptr,
+    {
+      arg_int* num_lines = arg_int0("n", "lines", "<N>", "number of lines (default 10)");
+      arg_lit* follow = arg_lit0("f", "follow", "follow appended data");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", nullptr);
+    },
+    /*num_end*/ 3) {
+  constexpr int kMaxLineSize = 1024;
+  constexpr int kFollowPollMs = 250;
+
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const char* const file_path = path->filename[0];
+  const int n = num_lines->count ? num_lines->ival[0] : 10;
+
+  // scan backwards for the start of the last `n` lines; only those blocks are read
+  uint64_t offset;
+  {
+    io::OwnedFile file = io::OpenFile(file_path, "rb");
+    if (!file) {
+      ESP_LOGE(TAG, "cannot open %s", file_path);
+      return 1;
+    }
+    io::ReverseLineReaderImpl lines(file.get(), kMaxLineSize, '\n', io::kSdSectorSize);
+    for (int i = 0; i < n && lines.Next(); i++) {
+    }
+    if (lines.error() != ESP_OK) {
+      ESP_LOGE(TAG, "read error: %s", esp_err_to_name(lines.error()));
+      return 1;
+    }
+    offset = lines.line_offset();
+  }
+
+  auto reader = io::SectorReader::Create(file_path);
+  if (!reader) {
+    return 1;
+  }
+  reader->Seek(offset);
+  const auto print_to_end = [&reader]() {
+    for (std::string_view chunk; !(chunk = reader->NextChunk()).empty();) {
+      fwrite(chunk.data(), 1, chunk.size(), stdout);
+    }
+    fflush(stdout);
+  };
+  print_to_end();
+
+  // NOTE: data appended through another handle only becomes visible once the writer has flushed
+  // it to FATFS (e.g. `AsyncFileWriter` barrier or `max_age_ms`).
+  while (follow->count && reader->error() == ESP_OK) {
+    uint8_t key;
+    if (uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &key, 1, pdMS_TO_TICKS(kFollowPollMs)) > 0) {
+      break;
+    }
+    struct stat s {};
+    if (stat(file_path, &s) != 0) {
+      continue;
+    }
+    const uint64_t size = s.st_size;
+    if (size < reader->Tell()) {
+      printf("\n--- %s: file truncated ---\n", file_path);
+      reader->Seek(0);
+    }
+    if (size != reader->Tell()) {
+      print_to_end();
+    }
+  }
+  return reader->error() == ESP_OK ? 0 : 1;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    zcat,
+    "print a compressed file, line by line",
+    /*hint*/ nullptr,
+    {
+      arg_int* last = arg_int0("l", "last", "<sec>", "only blocks written in the last <sec> s");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", nullptr);
+    },
+    /*num_end*/ 2) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  if (last->count) {
+    // random access through the block index
+    auto file = io::SeekableCompressedFile::Create(io::OpenFile(path->filename[0], "rb"));
+    if (!file) {
+      ESP_LOGE(TAG, "not an indexed compressed file (see zpipe -i): %s", path->filename[0]);
+      return 1;
+    }
+    const int64_t since_us = NowUnixUs() - int64_t{last->ival[0]} * 1'000'000;
+    uint64_t offset = 0;
+    if (const esp_err_t err = file->FindTime(since_us, &offset); err != ESP_OK) {
+      ESP_LOGE(TAG, "index lookup failed: %s", esp_err_to_name(err));
+      return 1;
+    }
+    file->Seek(offset);
+    printf("\n------------------\n");
+    for (const std::string_view line : io::FileLineReader(file->AsByteSource(), 25)) {
+      fwrite(line.data(), 1, line.size(), stdout);
+    }
+    printf("====================\n\n");
+    if (const esp_err_t err = file->error(); err != ESP_OK) {
+      ESP_LOGE(TAG, "stream error: %s", esp_err_to_name(err));
+      return 1;
+    }
+    return 0;
+  }
+
+  auto reader = io::CompressedFileReader::Create(io::OpenFile(path->filename[0], "rb"));
+  if (!reader) {
+    ESP_LOGE(TAG, "not a compressed file: %s", path->filename[0]);
+    return 1;
+  }
   printf("\n------------------\n");
-  io::OwnedFile file = io::OpenFile(path->filename[0], "r");
-  for (const std::string_view line : io::FileLineReader(file.get(), 25)) {
+  for (const std::string_view line : io::FileLineReader(reader->AsByteSource(), 25)) {
     fwrite(line.data(), 1, line.size(), stdout);
   }
   printf("====================\n\n");
+  if (const esp_err_t err = reader->error(); err != ESP_OK) {
+    ESP_LOGE(TAG, "stream error: %s", esp_err_to_name(err));
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    bench_compress,
+    "benchmark codecs x window sizes x block sizes over files; results saved as CSV",
+    /*hint*/ nullptr,
+    {
+      arg_str* out = arg_str1("o", "out", "<csv>", "path of the result CSV");
+      arg_int* window_log = arg_intn("w", "window", "<log2>", 0, 4, "window sizes to try (log2)");
+      arg_int* block_size = arg_intn("b", "block", "<bytes>", 0, 4, "block sizes to try");
+      arg_file* inputs = arg_filen(nullptr, nullptr, "<file>", 1, 8, "input files");
+    },
+    /*num_end*/ 1) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  bench::CompressBenchMatrix matrix;
+  if (window_log->count > 0) {
+    matrix.window_logs.assign(window_log->ival, window_log->ival + window_log->count);
+  }
+  if (block_size->count > 0) {
+    matrix.block_sizes.assign(block_size->ival, block_size->ival + block_size->count);
+  }
+  const std::vector<std::string> input_paths(inputs->filename, inputs->filename + inputs->count);
+  const esp_err_t err = bench::RunCompressBench(input_paths, matrix, out->sval[0], stdout);
+  return err == ESP_OK ? 0 : 1;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    sdbench,
+    "measure SD card read/write throughput and latency (VFS and raw sdmmc); results saved as CSV",
+    /*hint*/ nullptr,
+    {
+      arg_str* out = arg_str1("o", "out", "<csv>", "path of the result CSV");
+      arg_int* block_size = arg_intn("b", "block", "<bytes>", 0, 8, "block sizes to try");
+      arg_int* size_mib = arg_int0("s", "size", "<MiB>", "size of each scratch area (default 16)");
+      arg_lit* vfs_only = arg_lit0(nullptr, "vfs-only", "skip the raw sdmmc cases");
+    },
+    /*num_end*/ 4) {
+  // scratch areas; the raw one is a contiguous file, so raw writes never touch anything else
+  constexpr char kVfsScratchPath[] = CONFIG_MOUNT_ROOT "/sdbench.dat";
+  constexpr char kRawScratchPath[] = CONFIG_MOUNT_ROOT "/sdbench.raw";
+
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  bench::SdBenchMatrix matrix;
+  if (block_size->count > 0) {
+    matrix.block_sizes.assign(block_size->ival, block_size->ival + block_size->count);
+  }
+  bench::SdBenchTarget target{.file_path = kVfsScratchPath};
+  if (size_mib->count) {
+    target.file_size = uint64_t(size_mib->ival[0]) << 20;
+  }
+  std::unique_ptr<io::SdmmcBlockDevice> raw;
+  if (vfs_only->count) {
+    matrix.paths = {bench::SdBenchPath::kVfs};
+  } else {
+    uint32_t first_sector;
+    uint32_t num_sectors;
+    if (const esp_err_t err = io::ReserveContiguousFile(
+            kRawScratchPath, target.file_size, &first_sector, &num_sectors);
+        err != ESP_OK) {
+      ESP_LOGE(TAG, "cannot reserve %s: %s", kRawScratchPath, esp_err_to_name(err));
+      return 1;
+    }
+    raw = std::make_unique<io::SdmmcBlockDevice>(
+        g_sd_card->sd_card(), g_sd_card->fatfs(), first_sector, num_sectors);
+    target.raw_device = raw.get();
+  }
+  const esp_err_t err = bench::RunSdBench(target, matrix, out->sval[0], stdout);
+  return err == ESP_OK ? 0 : 1;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    zpipe,
+    "compress a file through the dual-core compress-then-write pipeline and report stage stats",
+    /*hint*/ nullptr,
+    {
+      arg_file* out = arg_file1("o", "out", "<file>", "path of the compressed output");
+      arg_int* block_size = arg_int0("b", "block", "<bytes>", "block size (default 16384)");
+      arg_lit* index = arg_lit0("i", "index", "append a block index (needed by zcat -l)");
+      arg_file* src = arg_file1(nullptr, nullptr, "<file>", "file to compress");
+    },
+    /*num_end*/ 4) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  io::OwnedFile in = io::OpenFile(src->filename[0], "rb");
+  if (!in) {
+    ESP_LOGE(TAG, "cannot open %s", src->filename[0]);
+    return 1;
+  }
+  io::CompressPipeline::Option option{};
+  if (block_size->count) {
+    option.block_size = block_size->ival[0];
+  }
+  if (index->count) {
+    option.index_spool_path = std::string(out->filename[0]) + ".ix";
+  }
+  auto pipeline = io::CompressPipeline::Create(io::OpenFile(out->filename[0], "wb"), option);
+  if (!pipeline) {
+    ESP_LOGE(TAG, "cannot create pipeline writing to %s", out->filename[0]);
+    return 1;
+  }
+
+  constexpr size_t kChunkSize = 4096;
+  auto chunk = std::make_unique<char[]>(kChunkSize);
+  const int64_t t_begin = NowMonotonicUs();
+  esp_err_t err = ESP_OK;
+  size_t n;
+  while (err == ESP_OK && (n = fread(chunk.get(), 1, kChunkSize, in.get())) > 0) {
+    err = pipeline->Write(chunk.get(), n);
+  }
+  const esp_err_t close_err = pipeline->Close();
+  const int64_t elapsed_us = NowMonotonicUs() - t_begin;
+  if (err == ESP_OK) {
+    err = close_err;
+  }
+
+  const io::CompressPipeline::Stats stats = pipeline->GetStats();
+  const auto print_stage = [](const char* name, const io::CompressPipeline::StageStats& s) {
+    printf(
+        "%-10s blocks=%6llu in=%10llu out=%10llu busy=%9lldus wait=%9lldus %7.2fMB/s\n",
+        name,
+        static_cast<unsigned long long>(s.blocks),
+        static_cast<unsigned long long>(s.bytes_in),
+        static_cast<unsigned long long>(s.bytes_out),
+        static_cast<long long>(s.busy_us),
+        static_cast<long long>(s.wait_us),
+        s.mbps());
+  };
+  print_stage("producer", stats.producer);
+  print_stage("compressor", stats.compressor);
+  print_stage("writer", stats.writer);
+  printf(
+      "raw queue max depth=%d, out queue max depth=%d\n",
+      stats.raw_queue_max_depth,
+      stats.out_queue_max_depth);
+  printf(
+      "total: %llu -> %llu bytes in %lldus (%.2fMB/s)\n",
+      static_cast<unsigned long long>(stats.producer.bytes_in),
+      static_cast<unsigned long long>(stats.writer.bytes_out),
+      static_cast<long long>(elapsed_us),
+      elapsed_us ? double(stats.producer.bytes_in) / elapsed_us : 0.0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "zpipe failed: %s", esp_err_to_name(err));
+    g_sd_card->ReportIoError();
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    csvstat,
+    "count/min/max/mean of a numeric column in a delimited text file",
+    /*hint*/ nullptr,
+    {
+      arg_int* col = arg_int1("c", "col", "<index>", "0-based column index");
+      arg_int* frac_digits = arg_int0("f", "frac", "<digits>", "fixed-point digits (default 0)");
+      arg_str* delim = arg_str0("d", "delim", "<char>", "field delimiter (default ',')");
+      arg_lit* header = arg_lit0(nullptr, "header", "skip the first line");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", nullptr);
+    },
+    /*num_end*/ 5) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const int index = col->ival[0];
+  const int digits = frac_digits->count ? frac_digits->ival[0] : 0;
+  const char sep = delim->count && delim->sval[0][0] ? delim->sval[0][0] : ',';
+  if (index < 0 || digits < 0 || digits > 9) {
+    ESP_LOGE(TAG, "invalid column or digits");
+    return 1;
+  }
+  auto reader = io::SectorReader::Create(path->filename[0]);
+  if (!reader) {
+    return 1;
+  }
+
+  constexpr int kMaxLineSize = 256;
+  int64_t lines = 0;
+  int64_t too_long = 0;
+  int64_t count = 0;
+  int64_t min = INT64_MAX;
+  int64_t max = INT64_MIN;
+  double sum = 0;
+  bool skipping = false;  // in the rest of a line longer than `kMaxLineSize`
+  const int64_t t_begin = NowMonotonicUs();
+  for (const std::string_view line : io::FileLineReader(reader->AsByteSource(), kMaxLineSize)) {
+    if (skipping) {
+      skipping = line.back() != '\n';
+      continue;
+    }
+    // the reader returns longer lines in pieces; only the first one is looked at
+    skipping = line.size() == kMaxLineSize && line.back() != '\n';
+    if (lines++ == 0 && header->count) {
+      continue;
+    }
+    if (skipping) {
+      ++too_long;
+      continue;
+    }
+    int field_index = 0;
+    for (const std::string_view field : FieldIter(line, sep)) {
+      if (field_index++ != index) {
+        continue;
+      }
+      int64_t value;
+      if (ParseFixedPoint(field, digits, &value)) {
+        ++count;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        sum += value;
+      }
+      break;
+    }
+  }
+  const int64_t elapsed_us = NowMonotonicUs() - t_begin;
+
+  double scale = 1;
+  for (int i = 0; i < digits; i++) {
+    scale *= 10;
+  }
+  printf(
+      "%lld lines, %lld values in column %d\n",
+      static_cast<long long>(lines),
+      static_cast<long long>(count),
+      index);
+  if (too_long) {
+    printf(
+        "%lld lines longer than %d bytes skipped\n",
+        static_cast<long long>(too_long),
+        kMaxLineSize);
+  }
+  if (count) {
+    printf(
+        "min=%.*f max=%.*f mean=%.*f\n",
+        digits,
+        min / scale,
+        digits,
+        max / scale,
+        digits,
+        sum / count / scale);
+  }
+  printf(
+      "%lldus (%.0f lines/s)\n",
+      static_cast<long long>(elapsed_us),
+      elapsed_us ? lines * 1e6 / elapsed_us : 0.0);
+  return reader->error() == ESP_OK ? 0 : 1;
+}
+
+void PrintLatency(const char* name, const LatencyHistogram& hist) {
+  printf(
+      "%-14s n=%6u p50=%7uus p90=%7uus p99=%7uus max=%7uus\n",
+      name,
+      static_cast<unsigned>(hist.count()),
+      static_cast<unsigned>(hist.Percentile(0.5)),
+      static_cast<unsigned>(hist.Percentile(0.9)),
+      static_cast<unsigned>(hist.Percentile(0.99)),
+      static_cast<unsigned>(hist.max()));
+}
+
+DEFINE_CONSOLE_COMMAND(
+    iostat,
+    "show write/sync latency of SD writes since the last reset, recent stalls, and DMA transfers",
+    /*hint*/ nullptr,
+    {
+      arg_lit* buckets = arg_lit0("b", "buckets", "also dump the non-empty histogram buckets");
+      arg_int* threshold = arg_int0("t", "threshold", "<us>", "set the stall threshold");
+      arg_lit* reset = arg_lit0("r", "reset", "reset after printing");
+    },
+    /*num_end*/ 3) {
+  io::IoStats& stats = io::IoStats::Get();
+  if (threshold->count) {
+    stats.set_stall_threshold_us(threshold->ival[0]);
+  }
+  for (int op_index = 0; op_index < io::kNumIoOps; op_index++) {
+    const io::IoOp op = static_cast<io::IoOp>(op_index);
+    LatencyHistogram merged;
+    stats.MergeHist(op, &merged);
+    PrintLatency(io::IoOpName(op), merged);
+    for (int core = 0; core < io::IoStats::kMaxCores; core++) {
+      char name[16];
+      snprintf(name, sizeof(name), "  core %d", core);
+      PrintLatency(name, stats.hist(core, op));
+    }
+    if (buckets->count) {
+      for (int i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+        if (const uint32_t n = merged.bucket_count(i)) {
+          printf(
+              "  <= %10uus %8u\n",
+              static_cast<unsigned>(LatencyHistogram::BucketUpperBound(i)),
+              static_cast<unsigned>(n));
+        }
+      }
+    }
+  }
+
+  printf(
+      "%u stalls (>= %uus)\n",
+      static_cast<unsigned>(stats.num_stalls()),
+      static_cast<unsigned>(stats.stall_threshold_us()));
+  const int64_t now_us = NowMonotonicUs();
+  stats.ForEachStall([now_us](const io::IoStats::Stall& stall) {
+    printf(
+        "  core %d %-5s %8uus, %lldms ago\n",
+        stall.core,
+        io::IoOpName(stall.op),
+        static_cast<unsigned>(stall.latency_us),
+        static_cast<long long>((now_us - stall.start_us) / 1000));
+  });
+
+  const io::DmaStats::Counters dma = io::DmaStats::Get().counters();
+  printf(
+      "transfers: %u direct, %u bounced, %u partial (%llu bytes); %u DMA buffers (%u failed)\n",
+      unsigned(dma.num_direct),
+      unsigned(dma.num_bounced),
+      unsigned(dma.num_partial),
+      static_cast<unsigned long long>(dma.bytes),
+      unsigned(dma.num_buffers),
+      unsigned(dma.num_alloc_failures));
+
+  if (reset->count) {
+    stats.Reset();
+    io::DmaStats::Get().Reset();
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    stats,
+    "show the timing of every SCOPED_TIMER probe hit so far, e.g. sd.mount",
+    /*hint*/ nullptr,
+    {
+      arg_lit* all = arg_lit0("a", "all", "also list probes with no samples since the last reset");
+      arg_lit* reset = arg_lit0("r", "reset", "reset after printing");
+    },
+    /*num_end*/ 2) {
+  printf(
+      "%-24s %8s %9s %9s %9s %9s\n",
+      "probe",
+      "count",
+      "mean(us)",
+      "p50(us)",
+      "p99(us)",
+      "max(us)");
+  TimerProbe::ForEach([show_all = all->count > 0](TimerProbe& probe) {
+    const LatencyHistogram& hist = probe.hist();
+    if (!hist.count() && !show_all) {
+      return;
+    }
+    printf(
+        "%-24s %8u %9u %9u %9u %9u\n",
+        probe.name(),
+        static_cast<unsigned>(hist.count()),
+        static_cast<unsigned>(hist.mean()),
+        static_cast<unsigned>(hist.Percentile(0.5)),
+        static_cast<unsigned>(hist.Percentile(0.99)),
+        static_cast<unsigned>(hist.max()));
+  });
+  if (reset->count) {
+    TimerProbe::ForEach([](TimerProbe& probe) { probe.Reset(); });
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    awrite,
+    "append synthetic log lines through AsyncFileWriter and report producer/writer latency",
+    /*hint*/ nullptr,
+    {
+      arg_int* size_kib = arg_int1("n", "size", "<KiB>", "amount of data to write");
+      arg_str* durability = arg_str0("d", "durability", "<none|barrier|interval|every>", nullptr);
+      arg_int* buffer_size = arg_int0("b", "buffer", "<bytes>", "buffer size (default 8192)");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", "file to append to");
+    },
+    /*num_end*/ 4) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const std::map<std::string, io::AsyncFileWriter::Durability> kDurabilityByName{
+      {"none", io::AsyncFileWriter::Durability::kNone},
+      {"barrier", io::AsyncFileWriter::Durability::kOnBarrier},
+      {"interval", io::AsyncFileWriter::Durability::kInterval},
+      {"every", io::AsyncFileWriter::Durability::kEveryWrite},
+  };
+  io::AsyncFileWriter::Option option{};
+  if (durability->count) {
+    const auto it = kDurabilityByName.find(durability->sval[0]);
+    if (it == kDurabilityByName.end()) {
+      ESP_LOGE(TAG, "unknown durability: %s", durability->sval[0]);
+      return 1;
+    }
+    option.durability = it->second;
+  }
+  if (buffer_size->count) {
+    option.buffer_size = buffer_size->ival[0];
+  }
+  auto writer = io::AsyncFileWriter::Create(io::OpenFile(path->filename[0], "a"), option);
+  if (!writer) {
+    ESP_LOGE(TAG, "cannot open %s", path->filename[0]);
+    return 1;
+  }
+
+  const int64_t total = int64_t{size_kib->ival[0]} * 1024;
+  LatencyHistogram append_hist;
+  int64_t written = 0;
+  esp_err_t err = ESP_OK;
+  const int64_t t_begin = NowMonotonicUs();
+  for (int i = 0; written < total && err == ESP_OK; i++) {
+    char line[64];
+    const int n = snprintf(
+        line, sizeof(line), "%08d,%lld,awrite\n", i, static_cast<long long>(NowUnixUs()));
+    const int64_t t0 = NowMonotonicUs();
+    err = writer->Write(line, n);
+    append_hist.Record(NowMonotonicUs() - t0);
+    written += n;
+  }
+  if (err == ESP_OK) {
+    err = writer->Close();
+  }
+  const int64_t elapsed_us = NowMonotonicUs() - t_begin;
+
+  const io::AsyncFileWriter::Stats stats = writer->GetStats();
+  printf(
+      "%lld bytes in %lldus (%.2fMB/s): %u buffers (%u by age), %u syncs\n",
+      static_cast<long long>(stats.bytes_written),
+      static_cast<long long>(elapsed_us),
+      elapsed_us ? double(stats.bytes_written) / elapsed_us : 0.0,
+      static_cast<unsigned>(stats.buffers_written),
+      static_cast<unsigned>(stats.age_flushes),
+      static_cast<unsigned>(stats.syncs));
+  PrintLatency("append", append_hist);
+  PrintLatency("producer block", writer->producer_block_hist());
+  PrintLatency("fwrite", writer->write_latency_hist());
+  PrintLatency("fsync", writer->sync_latency_hist());
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "awrite failed: %s", esp_err_to_name(err));
+    g_sd_card->ReportIoError();
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    bench_prealloc,
+    "write a file in fixed-size blocks, with or without preallocation, and report write latency",
+    /*hint*/ nullptr,
+    {
+      arg_int* size_kib = arg_int1("n", "size", "<KiB>", "amount of data to write");
+      arg_int* block_size = arg_int0("b", "block", "<bytes>", "bytes per write (default 4096)");
+      arg_lit* prealloc = arg_lit0("p", "prealloc", "preallocate the whole file up front");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", "file to create");
+    },
+    /*num_end*/ 4) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const int64_t total = int64_t{size_kib->ival[0]} * 1024;
+  const int block = block_size->count ? block_size->ival[0] : 4096;
+  if (total <= 0 || block <= 0) {
+    ESP_LOGE(TAG, "invalid size");
+    return 1;
+  }
+  io::PreallocatedFile::Option option{};
+  if (prealloc->count) {
+    option.reserve_size = total;
+  }
+  const int64_t t_open = NowMonotonicUs();
+  auto file = io::PreallocatedFile::Create(path->filename[0], option);
+  if (!file) {
+    ESP_LOGE(TAG, "cannot create %s", path->filename[0]);
+    return 1;
+  }
+  const int64_t open_us = NowMonotonicUs() - t_open;
+
+  std::vector<uint8_t> data(block);
+  for (int i = 0; i < block; i++) {
+    data[i] = static_cast<uint8_t>(i);
+  }
+  LatencyHistogram write_hist;
+  esp_err_t err = ESP_OK;
+  const int64_t t_begin = NowMonotonicUs();
+  for (int64_t written = 0; written < total && err == ESP_OK; written += block) {
+    const int64_t t0 = NowMonotonicUs();
+    err = file->Write(data.data(), std::min<int64_t>(block, total - written));
+    write_hist.Record(NowMonotonicUs() - t0);
+  }
+  if (const esp_err_t close_err = file->Close(); err == ESP_OK) {
+    err = close_err;
+  }
+  const int64_t elapsed_us = NowMonotonicUs() - t_begin;
+
+  printf(
+      "%lld bytes in %lldus (%.2fMB/s), reserved %llu in %lldus, %llu past the extent\n",
+      static_cast<long long>(file->size()),
+      static_cast<long long>(elapsed_us),
+      elapsed_us ? double(file->size()) / elapsed_us : 0.0,
+      static_cast<unsigned long long>(file->reserved_size()),
+      static_cast<long long>(open_us),
+      static_cast<unsigned long long>(file->overflow_size()));
+  PrintLatency("write", write_hist);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "bench_prealloc failed: %s", esp_err_to_name(err));
+    g_sd_card->ReportIoError();
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    rawlog_write,
+    "append synthetic data to a raw ring log in a contiguous file, bypassing FATFS",
+    /*hint*/ nullptr,
+    {
+      arg_int* size_kib = arg_int1("n", "size", "<KiB>", "amount of data to append");
+      arg_int* reserve_mib = arg_int0("r", "reserve", "<MiB>", "ring size if new (default 64)");
+      arg_int* segment = arg_int0("s", "segment", "<sectors>", "sectors per segment (default 64)");
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", "file holding the ring");
+    },
+    /*num_end*/ 4) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  const uint64_t reserve_size = uint64_t(reserve_mib->count ? reserve_mib->ival[0] : 64) << 20;
+  uint32_t first_sector;
+  uint32_t num_sectors;
+  if (const esp_err_t err =
+          io::ReserveContiguousFile(path->filename[0], reserve_size, &first_sector, &num_sectors);
+      err != ESP_OK) {
+    ESP_LOGE(TAG, "cannot reserve %s: %s", path->filename[0], esp_err_to_name(err));
+    return 1;
+  }
+  io::SdmmcBlockDevice device(
+      g_sd_card->sd_card(), g_sd_card->fatfs(), first_sector, num_sectors);
+  io::RawRingLog::Option option{};
+  if (segment->count) {
+    option.segment_sectors = segment->ival[0];
+  }
+  auto log = io::RawRingLog::Create(&device, option);
+  if (!log) {
+    return 1;
+  }
+
+  const int64_t total = int64_t{size_kib->ival[0]} * 1024;
+  esp_err_t err = ESP_OK;
+  const int64_t t_begin = NowMonotonicUs();
+  for (int i = 0; log->stats().bytes_appended < uint64_t(total) && err == ESP_OK; i++) {
+    char line[64];
+    const int n = snprintf(
+        line, sizeof(line), "%08d,%lld,rawlog\n", i, static_cast<long long>(NowUnixUs()));
+    err = log->Append(line, n);
+  }
+  if (err == ESP_OK) {
+    err = log->Flush();
+  }
+  const int64_t elapsed_us = NowMonotonicUs() - t_begin;
+
+  const io::RawRingLog::Stats stats = log->stats();
+  printf(
+      "log %08x: %llu bytes in %lldus (%.2fMB/s), %u segments + %u flushes, next seq %llu\n",
+      unsigned(log->log_id()),
+      static_cast<unsigned long long>(stats.bytes_appended),
+      static_cast<long long>(elapsed_us),
+      elapsed_us ? double(stats.bytes_appended) / elapsed_us : 0.0,
+      unsigned(stats.segments_written),
+      unsigned(stats.flushes),
+      static_cast<unsigned long long>(log->seq()));
+  PrintLatency("segment write", log->write_latency_hist());
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "rawlog_write failed: %s", esp_err_to_name(err));
+    g_sd_card->ReportIoError();
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    rawlog_export,
+    "copy the intact segments of a raw ring log, oldest first, into a regular file",
+    /*hint*/ nullptr,
+    {
+      arg_file* path = arg_file1(nullptr, nullptr, "<file>", "file holding the ring");
+      arg_file* out = arg_file1(nullptr, nullptr, "<out>", "file to write");
+    },
+    /*num_end*/ 2) {
+  if (!g_sd_card->CheckIsCardWorking()) {
+    ESP_LOGE(TAG, "SD card not ready");
+    return 2;
+  }
+  // not on the hot path, so the ring is simply read back through the file system
+  auto device = io::FileBlockDevice::Create(path->filename[0], /*writable*/ false);
+  io::OwnedFile out_file = io::OpenFile(out->filename[0], "wb");
+  if (!device || !out_file) {
+    ESP_LOGE(TAG, "cannot open %s or %s", path->filename[0], out->filename[0]);
+    return 1;
+  }
+  io::RawLogExportStats stats;
+  const esp_err_t err = io::ExportRawRingLog(device.get(), out_file.get(), &stats);
+  printf(
+      "%u segments (%u missing, %u corrupt), %llu bytes\n",
+      unsigned(stats.segments),
+      unsigned(stats.missing),
+      unsigned(stats.corrupt),
+      static_cast<unsigned long long>(stats.bytes));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "rawlog_export failed: %s", esp_err_to_name(err));
+    return 1;
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    boottime,
+    "show how long each stage of cold boot took, up to the card being ready",
+    /*hint*/ nullptr,
+    {},
+    /*num_end*/ 1) {
+  if (!BootProfiler::Get().finished()) {
+    printf("still booting\n");
+  }
+  BootProfiler::Get().Print(stdout);
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    sdstat,
+    "show SD card state, and mount/unmount/recovery counts and downtime since boot",
+    /*hint*/ nullptr,
+    {},
+    /*num_end*/ 1) {
+  const io::SdCardDaemon::Stats stats = g_sd_card->stats();
+  printf(
+      "detected=%d working=%d\n",
+      g_sd_card->GetCardDetected(),
+      g_sd_card->CheckIsCardWorking());
+  printf(
+      "mounts=%u (failed %u, last took %.1f ms) unmounts=%u fast_recoveries=%u bounces=%u\n",
+      unsigned(stats.num_mounts),
+      unsigned(stats.num_mount_failures),
+      stats.last_mount_us / 1e3,
+      unsigned(stats.num_unmounts),
+      unsigned(stats.num_fast_recoveries),
+      unsigned(stats.num_bounces));
+  printf("downtime=%.3f s\n", stats.downtime_us / 1e6);
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    mem,
+    "show heap fragmentation, block pool/command arena usage, and what recent commands allocated",
+    /*hint*/ nullptr,
+    {},
+    /*num_end*/ 1) {
+  const HeapSnapshot heap = HeapSnapshot::Take();
+  printf(
+      "heap: free=%u largest=%u (fragmentation %d%%) min_free=%u blocks: %u used %u free\n",
+      unsigned(heap.free_bytes),
+      unsigned(heap.largest_free_block),
+      heap.fragmentation_pct(),
+      unsigned(heap.min_free_bytes),
+      unsigned(heap.allocated_blocks),
+      unsigned(heap.free_blocks));
+  const BlockPool::Stats pool = BlockPool::Get().stats();
+  printf(
+      "pool: %d x %u bytes, %d in use (max %d), %u acquired, %u fell back to the heap\n",
+      BlockPool::kNumBlocks,
+      unsigned(BlockPool::kBlockSize),
+      pool.num_in_use,
+      pool.max_in_use,
+      unsigned(pool.num_acquires),
+      unsigned(pool.num_fallbacks));
+  printf(
+      "command arena: %u byte chunk, at most %u bytes used\n",
+      unsigned(CommandArena().chunk_size()),
+      unsigned(CommandArena().stats().max_bytes));
+
+  const bool counts_allocs = HeapSnapshot::CountsAllocs();
+  if (!counts_allocs) {
+    printf("heap_allocs: not counted (needs CONFIG_HEAP_USE_HOOKS); heap_blks is net only\n");
+  }
+
+  printf(
+      "%-10s %7s %9s %9s %6s %9s %11s %9s %10s %9s\n",
+      "command",
+      "allocs",
+      "arena(B)",
+      "overflows",
+      "pool",
+      "fallbacks",
+      "heap_allocs",
+      "heap_blks",
+      "heap_free",
+      "frag(%)");
+  CommandMemoryLog::Get().ForEach([counts_allocs](const CommandMemoryRecord& r) {
+    char heap_allocs[12] = "-";
+    if (counts_allocs) {
+      snprintf(heap_allocs, sizeof(heap_allocs), "%u", unsigned(r.heap_allocs));
+    }
+    printf(
+        "%-10s %7u %9u %9u %6u %9u %11s %+9d %+10d %4u->%-3u\n",
+        r.command,
+        unsigned(r.arena_allocs),
+        unsigned(r.arena_bytes),
+        unsigned(r.arena_overflow_chunks),
+        unsigned(r.pool_acquires),
+        unsigned(r.pool_fallbacks),
+        heap_allocs,
+        int(r.heap_blocks_delta),
+        int(r.heap_free_delta),
+        unsigned(r.fragmentation_before_pct),
+        unsigned(r.fragmentation_after_pct));
+  });
   return 0;
 }
 
+DEFINE_CONSOLE_COMMAND(
+    top,
+    "sample per-task CPU usage (% of one core) and stack, plus loop rate of instrumented tasks",
+    /*hint*/ nullptr,
+    {
+      arg_int* interval = arg_int0("i", "interval", "<ms>", "sampling interval (default: 1000)");
+      arg_int* count = arg_int0("n", "count", "<n>", "number of samples (default: 1)");
+    },
+    /*num_end*/ 2) {
+  const int interval_ms = interval->count ? std::max(interval->ival[0], 10) : 1000;
+  const int num_samples = count->count ? count->ival[0] : 1;
+  std::vector<TaskSample> samples;
+  for (int i = 0; i < num_samples; i++) {
+    if (const esp_err_t err = SampleTasks(interval_ms, &samples); err != ESP_OK) {
+      ESP_LOGE(TAG, "SampleTasks => %s", esp_err_to_name(err));
+      return 1;
+    }
+    float busy_percent[portNUM_PROCESSORS];
+    std::fill(std::begin(busy_percent), std::end(busy_percent), 100.0f);
+    printf(
+        "%-16s %4s %4s %6s %6s %8s %9s\n",
+        "task",
+        "core",
+        "prio",
+        "cpu%",
+        "stack",
+        "loops/s",
+        "idle(ms)");
+    for (const TaskSample& t : samples) {
+      if (t.core >= 0 && t.core < portNUM_PROCESSORS && !strncmp(t.name, "IDLE", 4)) {
+        busy_percent[t.core] -= t.cpu_percent;
+      }
+      printf(
+          "%-16s %4c %4d %6.1f %6u",
+          t.name,
+          t.core < 0 ? '*' : '0' + t.core,
+          t.priority,
+          t.cpu_percent,
+          unsigned(t.stack_free));
+      if (t.instrumented) {
+        printf(
+            " %8.1f %9u\n",
+            t.loops * 1000.0f / interval_ms,
+            unsigned(t.since_last_loop_ms));
+      } else {
+        printf(" %8s %9s\n", "-", "-");
+      }
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      printf("core %d: %.1f%% busy\n", core, busy_percent[core]);
+    }
+  }
+  return 0;
+}
+
+DEFINE_CONSOLE_COMMAND(
+    trace,
+    "show, dump (for host/trace_to_json), clear, pause or resume the event trace rings",
+    /*hint*/ nullptr,
+    {
+      arg_file* out = arg_file0("o", "out", "<file>", "dump the rings to this file");
+      arg_lit* clear = arg_lit0("c", "clear", "clear the rings (after dumping)");
+      arg_lit* off = arg_lit0(nullptr, "off", "pause recording");
+      arg_lit* on = arg_lit0(nullptr, "on", "resume recording");
+    },
+    /*num_end*/ 4) {
+#if CONFIG_TRACE_ENABLED
+  TraceRing& ring = TraceRing::Get();
+  if (out->count) {
+    if (!g_sd_card->CheckIsCardWorking()) {
+      ESP_LOGE(TAG, "card not working");
+      return 1;
+    }
+    io::OwnedFile file = io::OpenFile(out->filename[0], "wb");
+    if (!file) {
+      ESP_LOGE(TAG, "cannot open %s", out->filename[0]);
+      return 1;
+    }
+    const uint32_t num_records = ring.size();
+    if (const esp_err_t err = DumpTrace(file.get()); err != ESP_OK) {
+      ESP_LOGE(TAG, "DumpTrace => %s", esp_err_to_name(err));
+      g_sd_card->ReportIoError();
+      return 1;
+    }
+    printf("dumped %u records to %s\n", unsigned(num_records), out->filename[0]);
+  }
+  if (clear->count) {
+    ring.Clear();
+  }
+  if (off->count) {
+    ring.set_enabled(false);
+  }
+  if (on->count) {
+    ring.set_enabled(true);
+  }
+  printf(
+      "recording=%d records=%u (capacity %u per core)\n",
+      ring.enabled(),
+      unsigned(ring.size()),
+      unsigned(TraceRing::kRecordsPerCore));
+  return 0;
+#else
+  printf("tracing is compiled out (CONFIG_TRACE_ENABLED=0)\n");
+  return 1;
+#endif  // CONFIG_TRACE_ENABLED
+}
+
 esp_console_repl_t* InitializeConsole() {
   esp_console_repl_t* repl = nullptr;
   esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
@@ -118,7 +1305,10 @@ esp_console_repl_t* InitializeConsole() {
 }
 
 extern "C" void app_main(void) {
+  BootProfiler& boot = BootProfiler::Get();
+  boot.Mark("app_main");
   esp_console_repl_t* repl = InitializeConsole();
+  boot.Mark("console");
   printf(
       "\n\n\n\n"
       "FS playground\n\n\n\n"
@@ -126,10 +1316,13 @@ extern "C" void app_main(void) {
 
   CHECK_OK(SetupSdCard());
   CHECK_OK(g_sd_card->Start(nullptr));
-  while (!g_sd_card->CheckIsCardWorking()) {
-    vTaskDelay(pdMS_TO_TICKS(1));
+  boot.Mark("sd: daemon start");
+  while (!g_sd_card->WaitUntilReady(kMountWaitLogMs)) {
+    ESP_LOGW(TAG, "still waiting for SD card");
   }
+  boot.Finish();
   printf("done.\n");
+  boot.Print(stdout);
   esp_console_start_repl(repl);
 
   while (1) {
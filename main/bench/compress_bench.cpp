@@ -0,0 +1,345 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "bench/compress_bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#else
+#include <pthread.h>
+#include <cstdlib>
+#endif  // ESP_PLATFORM
+
+#include "common/macros.hpp"
+#include "common/times.hpp"
+#include "io/compressed_file.hpp"
+#include "io/file.hpp"
+#include "io/lz_codec.hpp"
+
+namespace bench {
+
+namespace {
+
+constexpr char TAG[] = "bench";
+
+#ifdef ESP_PLATFORM
+constexpr int kCaseStackSize = 8 * 1024;
+#else
+// glibc places the thread control block at the top of a user-supplied stack; leave plenty of room
+constexpr int kCaseStackSize = 256 * 1024;
+#endif  // ESP_PLATFORM
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Heap accounting
+
+#ifdef ESP_PLATFORM
+
+// Only relative values matter, so "in use" is simply the negated free size.
+int64_t HeapInUse() { return -static_cast<int64_t>(heap_caps_get_free_size(MALLOC_CAP_8BIT)); }
+
+#else
+
+std::atomic<int64_t> g_heap_in_use{0};
+std::atomic<int64_t> g_heap_peak{0};
+
+int64_t HeapInUse() { return g_heap_in_use.load(); }
+
+#endif  // ESP_PLATFORM
+
+/// Tracks the peak heap use relative to `Reset()`. On device the heap can only be sampled, so
+/// `Sample()` must be called where the working set is at its largest; on host every allocation is
+/// observed by the instrumented allocator.
+class HeapTracker {
+ public:
+  void Reset() {
+    base_ = peak_ = HeapInUse();
+#ifndef ESP_PLATFORM
+    g_heap_peak.store(base_);
+#endif  // ESP_PLATFORM
+  }
+  void Sample() {
+#ifdef ESP_PLATFORM
+    peak_ = std::max(peak_, HeapInUse());
+#else
+    peak_ = std::max(peak_, g_heap_peak.load());
+#endif  // ESP_PLATFORM
+  }
+  int64_t peak() const { return peak_ - base_; }
+
+ private:
+  int64_t base_ = 0;
+  int64_t peak_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stack accounting
+
+/// Runs `fn` to completion on a fresh thread with a `stack_size`-byte stack.
+///
+/// \param out_max_stack_bytes  deepest stack use observed
+esp_err_t RunWithStackProbe(
+    const std::function<void()>& fn,
+    int stack_size,
+    int* out_max_stack_bytes) {
+#ifdef ESP_PLATFORM
+  struct Context {
+    const std::function<void()>* fn;
+    SemaphoreHandle_t done;
+    int stack_free;
+  } context{&fn, xSemaphoreCreateBinary(), 0};
+  if (!context.done) {
+    return ESP_ERR_NO_MEM;
+  }
+  const auto entry = [](void* arg) {
+    Context* const context = static_cast<Context*>(arg);
+    (*context->fn)();
+    // NOTE(summivox): ESP-IDF reports stack sizes in bytes, not words
+    context->stack_free = uxTaskGetStackHighWaterMark(nullptr);
+    xSemaphoreGive(context->done);
+    vTaskDelete(nullptr);
+  };
+  // same priority and core as the caller, so results are comparable with inline execution
+  if (xTaskCreatePinnedToCore(
+          entry,
+          TAG,
+          stack_size,
+          &context,
+          uxTaskPriorityGet(nullptr),
+          nullptr,
+          xPortGetCoreID()) != pdPASS) {
+    vSemaphoreDelete(context.done);
+    return ESP_ERR_NO_MEM;
+  }
+  xSemaphoreTake(context.done, portMAX_DELAY);
+  vSemaphoreDelete(context.done);
+  *out_max_stack_bytes = stack_size - context.stack_free;
+  return ESP_OK;
+#else
+  // Paint the stack, run, then find the lowest address that was overwritten.
+  constexpr uint8_t kPaint = 0xA5;
+  void* const stack = aligned_alloc(4096, stack_size);
+  if (!stack) {
+    return ESP_ERR_NO_MEM;
+  }
+  memset(stack, kPaint, stack_size);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, stack_size);
+  pthread_t thread;
+  const auto entry = [](void* arg) -> void* {
+    (*static_cast<const std::function<void()>*>(arg))();
+    return nullptr;
+  };
+  const int err = pthread_create(&thread, &attr, entry, const_cast<std::function<void()>*>(&fn));
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    free(stack);
+    return ESP_FAIL;
+  }
+  pthread_join(thread, nullptr);
+  const uint8_t* const bytes = static_cast<const uint8_t*>(stack);
+  const int untouched = std::find_if(bytes, bytes + stack_size, [](uint8_t b) {
+                          return b != kPaint;
+                        }) - bytes;
+  free(stack);
+  *out_max_stack_bytes = stack_size - untouched;
+  return ESP_OK;
+#endif  // ESP_PLATFORM
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t RunCaseBody(
+    const std::string& input_path,
+    const CompressBenchCase& c,
+    CompressBenchResult* out) {
+  io::OwnedFile f = io::OpenFile(input_path, "rb");
+  if (!f) {
+    ESP_LOGE(TAG, "cannot open %s", input_path.c_str());
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (c.block_size <= 0 || c.block_size > io::LzCodec::kMaxBlockSize) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (c.codec == Codec::kLz && !io::LzCodec::IsValidParams(c.window_log, c.hash_log)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  HeapTracker heap;
+  heap.Reset();
+  std::unique_ptr<io::LzCodec> codec;
+  if (c.codec == Codec::kLz) {
+    codec = std::make_unique<io::LzCodec>(c.window_log, c.hash_log);
+  }
+  const auto raw = std::make_unique<uint8_t[]>(c.block_size);
+  const auto compressed = std::make_unique<uint8_t[]>(c.block_size);
+  const auto roundtrip = std::make_unique<uint8_t[]>(c.block_size);
+  heap.Sample();
+
+  *out = {};
+  out->stored_bytes = io::kCompressedFileHeaderSize + io::kBlockHeaderSize;  // + end marker
+  while (true) {
+    const int n = fread(raw.get(), 1, c.block_size, f.get());
+    if (n <= 0) {
+      break;
+    }
+
+    const int64_t t0 = NowMonotonicUs();
+    int compressed_size = -1;
+    if (codec) {
+      // same acceptance rule as `CompressedFileWriter`: must strictly shrink
+      compressed_size = codec->Compress(raw.get(), n, compressed.get(), n - 1);
+    } else {
+      memcpy(compressed.get(), raw.get(), n);
+    }
+    const int64_t t1 = NowMonotonicUs();
+    if (compressed_size >= 0) {
+      if (io::LzCodec::Decompress(compressed.get(), compressed_size, roundtrip.get(), n) != n) {
+        ESP_LOGE(TAG, "round trip failed: %s", input_path.c_str());
+        return ESP_ERR_INVALID_RESPONSE;
+      }
+    } else {
+      memcpy(roundtrip.get(), codec ? raw.get() : compressed.get(), n);
+    }
+    const int64_t t2 = NowMonotonicUs();
+
+    if (memcmp(raw.get(), roundtrip.get(), n) != 0) {
+      ESP_LOGE(TAG, "round trip mismatch: %s", input_path.c_str());
+      return ESP_ERR_INVALID_CRC;
+    }
+    out->raw_bytes += n;
+    out->stored_bytes += io::kBlockHeaderSize + (compressed_size >= 0 ? compressed_size : n);
+    out->compress_us += t1 - t0;
+    out->decompress_us += t2 - t1;
+  }
+  heap.Sample();
+  out->peak_heap_bytes = heap.peak();
+  return ESP_OK;
+}
+
+}  // namespace
+
+#ifndef ESP_PLATFORM
+
+void HostHeapOnAlloc(size_t size) {
+  const int64_t now = g_heap_in_use.fetch_add(size) + size;
+  int64_t peak = g_heap_peak.load();
+  while (now > peak && !g_heap_peak.compare_exchange_weak(peak, now)) {
+  }
+}
+
+void HostHeapOnFree(size_t size) { g_heap_in_use.fetch_sub(size); }
+
+#endif  // ESP_PLATFORM
+
+const char* CodecName(Codec codec) {
+  switch (codec) {
+    case Codec::kStore:
+      return "store";
+    case Codec::kLz:
+      return "lz";
+  }
+  CHECKED_UNREACHABLE;
+}
+
+esp_err_t RunCompressBenchCase(
+    const std::string& input_path,
+    const CompressBenchCase& bench_case,
+    CompressBenchResult* out_result) {
+  CHECK(out_result != nullptr);
+  esp_err_t case_err = ESP_FAIL;
+  int max_stack_bytes = 0;
+  TRY(RunWithStackProbe(
+      [&]() { case_err = RunCaseBody(input_path, bench_case, out_result); },
+      kCaseStackSize,
+      &max_stack_bytes));
+  out_result->max_stack_bytes = max_stack_bytes;
+  return case_err;
+}
+
+esp_err_t RunCompressBench(
+    const std::vector<std::string>& input_paths,
+    const CompressBenchMatrix& matrix,
+    const std::string& csv_path,
+    FILE* echo) {
+  io::OwnedFile csv = io::OpenFile(csv_path, "w");
+  if (!csv) {
+    ESP_LOGE(TAG, "cannot open %s", csv_path.c_str());
+    return ESP_ERR_NOT_FOUND;
+  }
+  fprintf(
+      csv.get(),
+      "input,codec,window_log,hash_log,block_size,raw_bytes,stored_bytes,ratio,"
+      "compress_mbps,decompress_mbps,peak_heap_bytes,max_stack_bytes\n");
+
+  esp_err_t first_failure = ESP_OK;
+  for (const std::string& input_path : input_paths) {
+    for (const Codec codec : matrix.codecs) {
+      // window size is meaningless without a codec; don't repeat the same run
+      const std::vector<int> window_logs =
+          codec == Codec::kStore ? std::vector<int>{0} : matrix.window_logs;
+      for (const int window_log : window_logs) {
+        for (const int block_size : matrix.block_sizes) {
+          const CompressBenchCase bench_case{
+              .codec = codec,
+              .window_log = window_log,
+              .hash_log = matrix.hash_log,
+              .block_size = block_size,
+          };
+          CompressBenchResult r;
+          if (const esp_err_t err = RunCompressBenchCase(input_path, bench_case, &r);
+              err != ESP_OK) {
+            ESP_LOGE(TAG, "case failed => %s", esp_err_to_name(err));
+            // do not fail fast --- the rest of the matrix is still useful
+            if (first_failure == ESP_OK) {
+              first_failure = err;
+            }
+            continue;
+          }
+          fprintf(
+              csv.get(),
+              "%s,%s,%d,%d,%d,%llu,%llu,%.4f,%.3f,%.3f,%lld,%d\n",
+              input_path.c_str(),
+              CodecName(codec),
+              window_log,
+              matrix.hash_log,
+              block_size,
+              static_cast<unsigned long long>(r.raw_bytes),
+              static_cast<unsigned long long>(r.stored_bytes),
+              r.ratio(),
+              r.compress_mbps(),
+              r.decompress_mbps(),
+              static_cast<long long>(r.peak_heap_bytes),
+              r.max_stack_bytes);
+          fflush(csv.get());
+          if (echo) {
+            fprintf(
+                echo,
+                "%-5s w=%2d b=%5d | ratio %6.3f | comp %7.2f MB/s | decomp %7.2f MB/s | "
+                "heap %6lld | stack %5d | %s\n",
+                CodecName(codec),
+                window_log,
+                block_size,
+                r.ratio(),
+                r.compress_mbps(),
+                r.decompress_mbps(),
+                static_cast<long long>(r.peak_heap_bytes),
+                r.max_stack_bytes,
+                input_path.c_str());
+          }
+        }
+      }
+    }
+  }
+  return first_failure;
+}
+
+}  // namespace bench
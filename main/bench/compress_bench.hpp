@@ -0,0 +1,84 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common/platform.hpp"
+
+namespace bench {
+
+enum class Codec {
+  kStore,  ///< no compression; baseline for the block/header overhead and raw copy speed
+  kLz,     ///< `io::LzCodec`
+};
+
+const char* CodecName(Codec codec);
+
+/// One point in the benchmark matrix.
+struct CompressBenchCase {
+  Codec codec = Codec::kLz;
+  int window_log = 12;
+  int hash_log = 12;
+  int block_size = 16 * 1024;
+};
+
+struct CompressBenchResult {
+  uint64_t raw_bytes = 0;
+  /// bytes the same input would take as a `CompressedFileWriter` stream (incl. headers)
+  uint64_t stored_bytes = 0;
+  int64_t compress_us = 0;
+  int64_t decompress_us = 0;
+  /// heap in use at the peak, relative to before the case started
+  int64_t peak_heap_bytes = 0;
+  /// deepest stack use of the thread running the case
+  int max_stack_bytes = 0;
+
+  double ratio() const { return stored_bytes ? double(raw_bytes) / double(stored_bytes) : 0; }
+  double compress_mbps() const { return compress_us ? double(raw_bytes) / compress_us : 0; }
+  double decompress_mbps() const { return decompress_us ? double(raw_bytes) / decompress_us : 0; }
+};
+
+/// Axes of the benchmark matrix; every combination is run over every input.
+struct CompressBenchMatrix {
+  std::vector<Codec> codecs = {Codec::kStore, Codec::kLz};
+  std::vector<int> window_logs = {10, 12, 14};
+  std::vector<int> block_sizes = {4 * 1024, 16 * 1024, 64 * 1024};
+  int hash_log = 12;
+};
+
+/// Compresses then decompresses `input_path` block by block entirely in memory, so the numbers
+/// reflect the codec and not the storage. Input is read in `block_size` chunks; file I/O time is
+/// excluded. Every block is verified after the round trip.
+///
+/// Runs on a dedicated thread (FreeRTOS task on device, pthread on host) so that stack use can
+/// be measured.
+esp_err_t RunCompressBenchCase(
+    const std::string& input_path,
+    const CompressBenchCase& bench_case,
+    CompressBenchResult* out_result);
+
+/// Runs the whole matrix over all inputs, writing one CSV row per run to `csv_path` (through
+/// `io::OpenFile`) and a human-readable line per run to `echo` (if not null).
+esp_err_t RunCompressBench(
+    const std::vector<std::string>& input_paths,
+    const CompressBenchMatrix& matrix,
+    const std::string& csv_path,
+    FILE* echo);
+
+// Heap accounting hooks.
+//
+// On device these are implemented with `heap_caps`. On host there is no portable way to query the
+// allocator, so the host executable must provide an instrumented `operator new`/`delete` and
+// report through `HostHeapOnAlloc` / `HostHeapOnFree`.
+#ifndef ESP_PLATFORM
+void HostHeapOnAlloc(size_t size);
+void HostHeapOnFree(size_t size);
+#endif  // ESP_PLATFORM
+
+}  // namespace bench
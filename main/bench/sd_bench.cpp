@@ -0,0 +1,269 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "bench/sd_bench.hpp"
+
+#include <algorithm>
+
+#include "common/histogram.hpp"
+#include "common/macros.hpp"
+#include "common/times.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+
+namespace bench {
+
+namespace {
+
+constexpr char TAG[] = "sdbench";
+
+/// xorshift64: fixed seed, so every run visits the same offsets
+class OffsetGenerator {
+ public:
+  OffsetGenerator(SdBenchPattern pattern, uint64_t num_blocks)
+      : pattern_(pattern), num_blocks_(num_blocks) {}
+  uint64_t NextBlock() {
+    if (pattern_ == SdBenchPattern::kSequential) {
+      return next_++ % num_blocks_;
+    }
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_ % num_blocks_;
+  }
+
+ private:
+  SdBenchPattern pattern_;
+  uint64_t num_blocks_;
+  uint64_t next_ = 0;
+  uint64_t state_ = 0x9e3779b97f4a7c15ull;
+};
+
+/// Makes sure the scratch file exists and is at least `size` bytes, so that reads hit real data
+/// and writes do not allocate clusters (which would be measured as well).
+esp_err_t PrepareFile(const std::string& path, uint64_t size, uint8_t* buf, int buf_size) {
+  io::OwnedFile f = io::OpenFile(path, "ab");
+  if (!f || fseek(f.get(), 0, SEEK_END) != 0) {
+    ESP_LOGE(TAG, "cannot open %s", path.c_str());
+    return ESP_ERR_NOT_FOUND;
+  }
+  for (uint64_t at = ftell(f.get()); at < size; at += buf_size) {
+    if (fwrite(buf, 1, buf_size, f.get()) != static_cast<size_t>(buf_size)) {
+      return ESP_FAIL;
+    }
+  }
+  return io::FlushAndSync(f.get());
+}
+
+}  // namespace
+
+const char* SdBenchPathName(SdBenchPath path) {
+  switch (path) {
+    case SdBenchPath::kVfs:
+      return "vfs";
+    case SdBenchPath::kRaw:
+      return "raw";
+  }
+  return "?";
+}
+
+const char* SdBenchOpName(SdBenchOp op) {
+  switch (op) {
+    case SdBenchOp::kWrite:
+      return "write";
+    case SdBenchOp::kRead:
+      return "read";
+  }
+  return "?";
+}
+
+const char* SdBenchPatternName(SdBenchPattern pattern) {
+  switch (pattern) {
+    case SdBenchPattern::kSequential:
+      return "seq";
+    case SdBenchPattern::kRandom:
+      return "rand";
+  }
+  return "?";
+}
+
+esp_err_t RunSdBenchCase(
+    const SdBenchTarget& target, const SdBenchCase& bench_case, SdBenchResult* out_result) {
+  CHECK(out_result != nullptr);
+  *out_result = {};
+  const int block_size = bench_case.block_size;
+  if (block_size <= 0 || block_size % io::kSdSectorSize != 0 || bench_case.ops <= 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const bool raw = bench_case.path == SdBenchPath::kRaw;
+  if (raw && target.raw_device == nullptr) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  const uint64_t area_size =
+      raw ? uint64_t{target.raw_device->num_sectors()} * io::kSdSectorSize : target.file_size;
+  const uint64_t num_blocks = area_size / block_size;
+  if (num_blocks == 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  const io::DmaBuffer buf = io::DmaBuffer::Allocate(block_size);
+  if (!buf) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < block_size; i++) {
+    buf[i] = static_cast<uint8_t>(i * 31);
+  }
+
+  io::OwnedFile f(nullptr, fclose);
+  if (!raw) {
+    f = io::OpenFile(target.file_path, "r+b");
+    if (!f) {
+      ESP_LOGE(TAG, "cannot open %s", target.file_path.c_str());
+      return ESP_ERR_NOT_FOUND;
+    }
+    // every operation must reach FATFS as-is, not be merged or split by stdio
+    setvbuf(f.get(), nullptr, _IONBF, 0);
+  }
+
+  const int ops = bench_case.ops;
+  OffsetGenerator offsets(bench_case.pattern, num_blocks);
+  LatencyHistogram latency;
+  const bool write = bench_case.op == SdBenchOp::kWrite;
+  const uint32_t sectors_per_block = block_size / io::kSdSectorSize;
+
+  const int64_t t_begin = NowMonotonicUs();
+  uint64_t next_block = 0;  // where the file position is after the previous op
+  for (int i = 0; i < ops; i++) {
+    const uint64_t block = offsets.NextBlock();
+    const int64_t t0 = NowMonotonicUs();
+    esp_err_t err = ESP_OK;
+    if (raw) {
+      const uint32_t sector = static_cast<uint32_t>(block * sectors_per_block);
+      err = write ? target.raw_device->WriteSectors(buf.data(), sector, sectors_per_block)
+                  : target.raw_device->ReadSectors(buf.data(), sector, sectors_per_block);
+    } else {
+      // sequential access only seeks on the first block and when it wraps around to block 0, so
+      // that it never runs past the end of the scratch file
+      const bool seek = i == 0 || block != next_block;
+      next_block = block + 1;
+      if (seek && fseek(f.get(), static_cast<long>(block * block_size), SEEK_SET) != 0) {
+        err = ESP_FAIL;
+      } else {
+        const size_t n = write ? fwrite(buf.data(), 1, block_size, f.get())
+                               : fread(buf.data(), 1, block_size, f.get());
+        err = n == static_cast<size_t>(block_size) ? ESP_OK : ESP_FAIL;
+      }
+    }
+    latency.Record(NowMonotonicUs() - t0);
+    if (err != ESP_OK) {
+      ESP_LOGE(
+          TAG,
+          "%s failed at block %llu",
+          SdBenchOpName(bench_case.op),
+          static_cast<unsigned long long>(block));
+      return err;
+    }
+  }
+  if (write && !raw) {
+    TRY(io::FlushAndSync(f.get()));
+  }
+  out_result->elapsed_us = NowMonotonicUs() - t_begin;
+  out_result->ops = ops;
+  out_result->bytes = uint64_t{static_cast<uint32_t>(ops)} * block_size;
+  out_result->p50_us = latency.Percentile(0.5);
+  out_result->p99_us = latency.Percentile(0.99);
+  out_result->max_us = latency.max();
+  return ESP_OK;
+}
+
+esp_err_t RunSdBench(
+    const SdBenchTarget& target,
+    const SdBenchMatrix& matrix,
+    const std::string& csv_path,
+    FILE* echo) {
+  io::OwnedFile csv = io::OpenFile(csv_path, "w");
+  if (!csv) {
+    ESP_LOGE(TAG, "cannot open %s", csv_path.c_str());
+    return ESP_ERR_NOT_FOUND;
+  }
+  fprintf(
+      csv.get(),
+      "path,op,pattern,block_size,ops,bytes,elapsed_us,mbps,iops,p50_us,p99_us,max_us\n");
+
+  if (std::find(matrix.paths.begin(), matrix.paths.end(), SdBenchPath::kVfs) !=
+      matrix.paths.end()) {
+    constexpr int kPrepareBufferSize = 16 * 1024;
+    const io::DmaBuffer zeros = io::DmaBuffer::Allocate(kPrepareBufferSize);
+    if (!zeros) {
+      return ESP_ERR_NO_MEM;
+    }
+    std::fill_n(zeros.data(), kPrepareBufferSize, 0);
+    TRY(PrepareFile(target.file_path, target.file_size, zeros.data(), kPrepareBufferSize));
+  }
+
+  esp_err_t first_failure = ESP_OK;
+  for (const SdBenchPath path : matrix.paths) {
+    if (path == SdBenchPath::kRaw && target.raw_device == nullptr) {
+      continue;
+    }
+    for (const SdBenchPattern pattern : matrix.patterns) {
+      for (const SdBenchOp op : matrix.ops) {
+        for (const int block_size : matrix.block_sizes) {
+          // split the byte budget into operations, within bounds: small blocks would otherwise
+          // take forever, large ones would be too few to give meaningful percentiles
+          const SdBenchCase bench_case{
+              .path = path,
+              .op = op,
+              .pattern = pattern,
+              .block_size = block_size,
+              .ops = static_cast<int>(std::clamp<uint64_t>(
+                  matrix.bytes_per_case / block_size, matrix.min_ops, matrix.max_ops)),
+          };
+          SdBenchResult r;
+          if (const esp_err_t err = RunSdBenchCase(target, bench_case, &r); err != ESP_OK) {
+            ESP_LOGE(TAG, "case failed => %s", esp_err_to_name(err));
+            // do not fail fast --- the rest of the matrix is still useful
+            if (first_failure == ESP_OK) {
+              first_failure = err;
+            }
+            continue;
+          }
+          fprintf(
+              csv.get(),
+              "%s,%s,%s,%d,%d,%llu,%lld,%.3f,%.1f,%u,%u,%u\n",
+              SdBenchPathName(path),
+              SdBenchOpName(op),
+              SdBenchPatternName(pattern),
+              block_size,
+              r.ops,
+              static_cast<unsigned long long>(r.bytes),
+              static_cast<long long>(r.elapsed_us),
+              r.mbps(),
+              r.iops(),
+              unsigned(r.p50_us),
+              unsigned(r.p99_us),
+              unsigned(r.max_us));
+          fflush(csv.get());
+          if (echo) {
+            fprintf(
+                echo,
+                "%-3s %-5s %-4s b=%5d | %7.3f MB/s | %8.1f IOPS | p50 %6u us | p99 %6u us | "
+                "max %6u us\n",
+                SdBenchPathName(path),
+                SdBenchOpName(op),
+                SdBenchPatternName(pattern),
+                block_size,
+                r.mbps(),
+                r.iops(),
+                unsigned(r.p50_us),
+                unsigned(r.p99_us),
+                unsigned(r.max_us));
+          }
+        }
+      }
+    }
+  }
+  return first_failure;
+}
+
+}  // namespace bench
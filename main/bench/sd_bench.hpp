@@ -0,0 +1,84 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common/platform.hpp"
+#include "io/block_device.hpp"
+
+namespace bench {
+
+enum class SdBenchPath {
+  kVfs,  ///< `io::OpenFile` + `fread`/`fwrite` (unbuffered) on a file, through VFS and FATFS
+  kRaw,  ///< whole sectors straight to an `io::BlockDevice` (on device: `sdmmc` on a file extent)
+};
+enum class SdBenchOp { kWrite, kRead };
+enum class SdBenchPattern { kSequential, kRandom };
+
+const char* SdBenchPathName(SdBenchPath path);
+const char* SdBenchOpName(SdBenchOp op);
+const char* SdBenchPatternName(SdBenchPattern pattern);
+
+/// One point in the benchmark matrix.
+struct SdBenchCase {
+  SdBenchPath path = SdBenchPath::kVfs;
+  SdBenchOp op = SdBenchOp::kWrite;
+  SdBenchPattern pattern = SdBenchPattern::kSequential;
+  int block_size = 4096;
+  int ops = 256;
+};
+
+struct SdBenchResult {
+  int ops = 0;
+  uint64_t bytes = 0;
+  /// whole case, including the final sync after writes
+  int64_t elapsed_us = 0;
+  uint32_t p50_us = 0;
+  uint32_t p99_us = 0;
+  uint32_t max_us = 0;
+
+  double mbps() const { return elapsed_us ? double(bytes) / elapsed_us : 0; }
+  double iops() const { return elapsed_us ? ops * 1e6 / elapsed_us : 0; }
+};
+
+/// Axes of the benchmark matrix; every combination is run, writes before reads (so that reads see
+/// data just written).
+struct SdBenchMatrix {
+  std::vector<SdBenchPath> paths = {SdBenchPath::kVfs, SdBenchPath::kRaw};
+  std::vector<SdBenchPattern> patterns = {SdBenchPattern::kSequential, SdBenchPattern::kRandom};
+  std::vector<SdBenchOp> ops = {SdBenchOp::kWrite, SdBenchOp::kRead};
+  std::vector<int> block_sizes = {512, 4 * 1024, 16 * 1024, 64 * 1024};
+  /// bytes transferred per case, within the bounds on the number of operations below
+  uint64_t bytes_per_case = 4 << 20;
+  int min_ops = 64;
+  int max_ops = 2048;
+};
+
+/// Where the benchmark reads and writes. Both areas are overwritten.
+struct SdBenchTarget {
+  /// scratch file for `SdBenchPath::kVfs`; created (or extended) to `file_size` bytes
+  std::string file_path;
+  uint64_t file_size = 16 << 20;
+  /// device for `SdBenchPath::kRaw`; null to skip those cases
+  io::BlockDevice* raw_device = nullptr;
+};
+
+/// Runs one case. Offsets are multiples of `block_size`; random ones come from a fixed-seed
+/// generator, so runs are repeatable.
+esp_err_t RunSdBenchCase(
+    const SdBenchTarget& target, const SdBenchCase& bench_case, SdBenchResult* out_result);
+
+/// Runs the whole matrix, writing one CSV row per case to `csv_path` (through `io::OpenFile`) and a
+/// human-readable line per case to `echo` (if not null).
+esp_err_t RunSdBench(
+    const SdBenchTarget& target,
+    const SdBenchMatrix& matrix,
+    const std::string& csv_path,
+    FILE* echo);
+
+}  // namespace bench
@@ -0,0 +1,98 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include "common/times.hpp"
+
+/// Timestamps the stages of cold boot (console, card detect ISR, card mount, ...) so that
+/// boot-to-ready time can be tracked and the slow stage found.
+///
+/// Stages are marked from whichever task performs them, in the order they finish; each is shown as
+/// the time since the previous mark. Marks after `Finish` are ignored, so code that also runs
+/// later (e.g. remount) can mark unconditionally.
+///
+/// \example
+/// \code{.cpp}
+/// BootProfiler::Get().Mark("console");
+/// // ...
+/// BootProfiler::Get().Finish();
+/// BootProfiler::Get().Print(stdout);
+/// \endcode
+class BootProfiler {
+ public:
+  static constexpr int kMaxStages = 16;
+
+  static BootProfiler& Get() {
+    static BootProfiler instance;
+    return instance;
+  }
+
+  /// Records that `stage` (a string literal) has just completed.
+  void Mark(const char* stage) {
+    if (finished_.load(std::memory_order_acquire)) {
+      return;
+    }
+    const int64_t t_us = NowMonotonicUs();
+    const int i = num_stages_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= kMaxStages) {
+      return;
+    }
+    stages_[i].name = stage;
+    stages_[i].t_us = t_us;
+    stages_[i].ready.store(true, std::memory_order_release);
+  }
+
+  /// Marks the final "ready" stage and stops recording.
+  void Finish() {
+    Mark("ready");
+    finished_.store(true, std::memory_order_release);
+  }
+
+  bool finished() const { return finished_.load(std::memory_order_acquire); }
+
+  /// \return time from boot (`NowMonotonicUs` origin) to `Finish`; -1 if not finished yet
+  int64_t ready_us() const {
+    if (!finished()) {
+      return -1;
+    }
+    const int n = std::min(num_stages_.load(std::memory_order_relaxed), kMaxStages);
+    return n ? stages_[n - 1].t_us : -1;
+  }
+
+  /// Prints one line per stage: time since boot, time since the previous stage, name.
+  void Print(FILE* f) const {
+    const int n = std::min(num_stages_.load(std::memory_order_relaxed), kMaxStages);
+    fprintf(f, "%10s %10s  stage\n", "t (ms)", "+dt (ms)");
+    int64_t prev_us = 0;
+    for (int i = 0; i < n; i++) {
+      const Stage& s = stages_[i];
+      if (!s.ready.load(std::memory_order_acquire)) {
+        continue;
+      }
+      fprintf(f, "%10.3f %10.3f  %s\n", s.t_us / 1e3, (s.t_us - prev_us) / 1e3, s.name);
+      prev_us = s.t_us;
+    }
+    if (num_stages_.load(std::memory_order_relaxed) > kMaxStages) {
+      fprintf(f, "(%d stages dropped)\n", num_stages_.load() - kMaxStages);
+    }
+  }
+
+ private:
+  struct Stage {
+    const char* name;
+    int64_t t_us;
+    std::atomic<bool> ready{false};  // set once `name` and `t_us` are written
+  };
+
+  Stage stages_[kMaxStages];
+  std::atomic<int> num_stages_{0};
+  std::atomic<bool> finished_{false};
+
+  BootProfiler() = default;
+};
@@ -0,0 +1,129 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <type_traits>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#else
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#endif  // ESP_PLATFORM
+
+#include "common/macros.hpp"
+
+/// Fixed-capacity, thread-safe FIFO of small trivially copyable items (typically pointers to
+/// pre-allocated buffers). All storage is allocated at construction; `Push`/`Pop` never allocate.
+///
+/// Backed by a FreeRTOS queue on device, and by a mutex + condition variables on host so that code
+/// built on top of it can be exercised with pthreads.
+template <typename T>
+class BoundedQueue {
+  static_assert(std::is_trivially_copyable_v<T>, "items are copied bytewise");
+
+ public:
+  static constexpr int kForever = -1;
+
+  explicit BoundedQueue(int capacity) : capacity_(capacity) {
+#ifdef ESP_PLATFORM
+    queue_ = CHECK_NOTNULL(xQueueCreate(capacity, sizeof(T)));
+#else
+    items_ = std::make_unique<T[]>(capacity);
+#endif  // ESP_PLATFORM
+  }
+
+  ~BoundedQueue() {
+#ifdef ESP_PLATFORM
+    vQueueDelete(queue_);
+#endif  // ESP_PLATFORM
+  }
+
+  /// Appends an item, waiting for space if the queue is full.
+  ///
+  /// \param timeout_ms   `kForever` to wait indefinitely
+  /// \return false on timeout
+  bool Push(const T& item, int timeout_ms = kForever) {
+#ifdef ESP_PLATFORM
+    return xQueueSendToBack(queue_, &item, ToTicks(timeout_ms)) == pdTRUE;
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!Wait(lock, not_full_, timeout_ms, [this] { return size_ < capacity_; })) {
+      return false;
+    }
+    items_[(head_ + size_) % capacity_] = item;
+    ++size_;
+    not_empty_.notify_one();
+    return true;
+#endif  // ESP_PLATFORM
+  }
+
+  /// Removes the oldest item, waiting for one if the queue is empty.
+  ///
+  /// \param timeout_ms   `kForever` to wait indefinitely
+  /// \return false on timeout
+  bool Pop(T* out_item, int timeout_ms = kForever) {
+#ifdef ESP_PLATFORM
+    return xQueueReceive(queue_, out_item, ToTicks(timeout_ms)) == pdTRUE;
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!Wait(lock, not_empty_, timeout_ms, [this] { return size_ > 0; })) {
+      return false;
+    }
+    *out_item = items_[head_];
+    head_ = (head_ + 1) % capacity_;
+    --size_;
+    not_full_.notify_one();
+    return true;
+#endif  // ESP_PLATFORM
+  }
+
+  /// \return number of items currently queued (a snapshot; may be stale by the time it is used)
+  int size() const {
+#ifdef ESP_PLATFORM
+    return uxQueueMessagesWaiting(queue_);
+#else
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+#endif  // ESP_PLATFORM
+  }
+
+  int capacity() const { return capacity_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(BoundedQueue)
+
+ private:
+  const int capacity_;
+
+#ifdef ESP_PLATFORM
+  QueueHandle_t queue_;
+
+  static TickType_t ToTicks(int timeout_ms) {
+    return timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+  }
+#else
+  std::unique_ptr<T[]> items_;
+  int head_ = 0;
+  int size_ = 0;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+
+  template <typename Pred>
+  static bool Wait(
+      std::unique_lock<std::mutex>& lock,
+      std::condition_variable& cv,
+      int timeout_ms,
+      Pred pred) {
+    if (timeout_ms < 0) {
+      cv.wait(lock, pred);
+      return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), pred);
+  }
+#endif  // ESP_PLATFORM
+};
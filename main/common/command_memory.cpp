@@ -0,0 +1,71 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "common/command_memory.hpp"
+
+#include <atomic>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+namespace {
+
+std::atomic<uint32_t> g_num_heap_allocs{0};
+
+}  // namespace
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+// Called by the heap on every successful allocation, from any task or ISR, possibly with the flash
+// cache disabled: keep it in IRAM and lock-free.
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(
+    [[maybe_unused]] void* ptr, [[maybe_unused]] size_t size, [[maybe_unused]] uint32_t caps) {
+  g_num_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+#endif  // CONFIG_HEAP_USE_HOOKS
+
+bool HeapSnapshot::CountsAllocs() {
+#ifdef CONFIG_HEAP_USE_HOOKS
+  return true;
+#else
+  return false;
+#endif  // CONFIG_HEAP_USE_HOOKS
+}
+
+HeapSnapshot HeapSnapshot::Take() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  return {
+      .free_bytes = info.total_free_bytes,
+      .largest_free_block = info.largest_free_block,
+      .min_free_bytes = info.minimum_free_bytes,
+      .allocated_blocks = info.allocated_blocks,
+      .free_blocks = info.free_blocks,
+      .num_allocs = g_num_heap_allocs.load(std::memory_order_relaxed),
+  };
+}
+
+CommandMemoryScope::CommandMemoryScope(const char* command)
+    : command_(command), heap_(HeapSnapshot::Take()), pool_(BlockPool::Get().stats()) {}
+
+CommandMemoryScope::~CommandMemoryScope() {
+  Arena& arena = CommandArena();
+  const Arena::Stats arena_stats = arena.stats();
+  // the arena's overflow chunks are freed before the heap is compared
+  arena.Reset();
+  const HeapSnapshot heap = HeapSnapshot::Take();
+  const BlockPool::Stats pool = BlockPool::Get().stats();
+  CommandMemoryLog::Get().Add({
+      .command = command_,
+      .arena_allocs = arena_stats.num_allocs,
+      .arena_bytes = static_cast<uint32_t>(arena_stats.bytes),
+      .arena_overflow_chunks = arena_stats.num_overflow_chunks,
+      .pool_acquires = pool.num_acquires - pool_.num_acquires,
+      .pool_fallbacks = pool.num_fallbacks - pool_.num_fallbacks,
+      .heap_allocs = heap.num_allocs - heap_.num_allocs,
+      .heap_blocks_delta = static_cast<int32_t>(heap.allocated_blocks - heap_.allocated_blocks),
+      .heap_free_delta = static_cast<int32_t>(heap.free_bytes - heap_.free_bytes),
+      .fragmentation_before_pct = static_cast<uint8_t>(heap_.fragmentation_pct()),
+      .fragmentation_after_pct = static_cast<uint8_t>(heap.fragmentation_pct()),
+  });
+}
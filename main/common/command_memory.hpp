@@ -0,0 +1,96 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common/macros.hpp"
+#include "common/memory_pool.hpp"
+
+/// State of the heap `malloc` allocates from (8-bit capable memory).
+struct HeapSnapshot {
+  size_t free_bytes;
+  size_t largest_free_block;
+  size_t min_free_bytes;  ///< low-water mark since boot
+  size_t allocated_blocks;
+  size_t free_blocks;
+  uint32_t num_allocs;  ///< allocations since boot, by any task (see `CountsAllocs`)
+
+  static HeapSnapshot Take();
+
+  /// \return false if `num_allocs` is not counted, i.e. without `CONFIG_HEAP_USE_HOOKS`
+  static bool CountsAllocs();
+
+  /// \return 0 when all free memory is one block, approaching 100 as it is split into small pieces
+  int fragmentation_pct() const {
+    return free_bytes ? 100 - static_cast<int>(largest_free_block * 100 / free_bytes) : 0;
+  }
+};
+
+/// What one console command did to memory.
+struct CommandMemoryRecord {
+  const char* command;
+  uint32_t arena_allocs;
+  uint32_t arena_bytes;
+  uint32_t arena_overflow_chunks;
+  uint32_t pool_acquires;
+  uint32_t pool_fallbacks;
+  uint32_t heap_allocs;       ///< heap allocations made meanwhile, incl. those already freed
+  int32_t heap_blocks_delta;  ///< heap blocks still allocated after the command (caches or leaks)
+  int32_t heap_free_delta;
+  uint8_t fragmentation_before_pct;
+  uint8_t fragmentation_after_pct;
+};
+
+/// The last few `CommandMemoryRecord`s. Only to be used from the console task.
+class CommandMemoryLog {
+ public:
+  static constexpr int kMaxRecords = 16;
+
+  static CommandMemoryLog& Get() {
+    static CommandMemoryLog instance;
+    return instance;
+  }
+
+  void Add(const CommandMemoryRecord& record) { records_[num_records_++ % kMaxRecords] = record; }
+
+  /// Calls `f(const CommandMemoryRecord&)` for the kept records, oldest first.
+  template <typename F>
+  void ForEach(F&& f) const {
+    const uint32_t begin = num_records_ > kMaxRecords ? num_records_ - kMaxRecords : 0;
+    for (uint32_t i = begin; i < num_records_; i++) {
+      f(records_[i % kMaxRecords]);
+    }
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(CommandMemoryLog)
+
+ private:
+  CommandMemoryRecord records_[kMaxRecords];
+  uint32_t num_records_ = 0;
+
+  CommandMemoryLog() = default;
+};
+
+/// Wraps the run of one console command (see `DEFINE_CONSOLE_COMMAND`): on destruction, resets
+/// `CommandArena` and adds what the command allocated to `CommandMemoryLog`.
+///
+/// The heap block/free deltas only show what is still allocated afterwards; allocations made and
+/// freed within the command are only counted in `heap_allocs`, which needs `CONFIG_HEAP_USE_HOOKS`.
+/// Pool counts include buffers taken by other tasks meanwhile, and the heap figures include
+/// everyone's allocations, but between commands the system is mostly idle.
+class CommandMemoryScope {
+ public:
+  /// \param command  must outlive the log, e.g. a string literal
+  explicit CommandMemoryScope(const char* command);
+  ~CommandMemoryScope();
+
+  NOT_COPYABLE_NOR_MOVABLE(CommandMemoryScope)
+
+ private:
+  const char* command_;
+  HeapSnapshot heap_;
+  BlockPool::Stats pool_;
+};
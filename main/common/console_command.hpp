@@ -5,7 +5,9 @@
 
 #include "argtable3/argtable3.h"
 
+#include "common/command_memory.hpp"
 #include "common/console_command_registry.hpp"
+#include "common/macros.hpp"
 
 #define DEFINE_CONSOLE_COMMAND(name, help_str, hint_str, argtable_struct_body, num_end)         \
   struct Argtable_##name argtable_struct_body;                                                  \
@@ -18,6 +20,8 @@
         arg_print_errors(stderr, this->end, argv[0]);                                           \
         return 1;                                                                               \
       }                                                                                         \
+      CommandMemoryScope memory_scope(#name);                                                   \
+      TRACE_SCOPE(kConsoleCommand, 0);                                                          \
       return RunInternal(argc, argv);                                                           \
     }                                                                                           \
     int RunInternal(int argc, char** argv);                                                     \
@@ -0,0 +1,50 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "common/console_output.hpp"
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include <cstring>
+
+void ConsoleOutput::Write(std::string_view data) {
+  if (size_ + data.size() < kBufferSize && size_ + data.size() <= buf_.size()) {
+    memcpy(buf_.data() + size_, data.data(), data.size());
+    size_ += data.size();
+    return;
+  }
+  Flush();
+  WriteOut(data.data(), data.size());
+}
+
+esp_err_t ConsoleOutput::Flush() {
+  WriteOut(buf_.data(), size_);
+  size_ = 0;
+  return error_;
+}
+
+void ConsoleOutput::WriteOut(const char* data, size_t size) {
+  if (size == 0 || error_ != ESP_OK) {
+    return;
+  }
+  // Straight to the file descriptor: through a line-buffered `FILE` (the console's stdout) newlib
+  // would split the chunk back into one write per line. Whatever is still in the `FILE`'s own
+  // buffer goes first, to keep the order.
+  if (fflush(f_) != 0) {
+    error_ = ESP_FAIL;
+    return;
+  }
+  const int fd = fileno(f_);
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n <= 0) {
+      error_ = ESP_FAIL;
+      return;
+    }
+    data += n;
+    size -= n;
+    bytes_flushed_ += n;
+  }
+}
@@ -0,0 +1,87 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+#include "fmt/format.h"
+
+#include "common/macros.hpp"
+#include "common/memory_pool.hpp"
+#include "common/platform.hpp"
+
+/// Buffered output for console commands that print a lot (one line per directory entry, ...).
+///
+/// Everything is formatted with fmt into a buffer from `BlockPool` (not the stack: commands run on
+/// the console REPL task, whose stack is small), and written to the file descriptor behind the
+/// `FILE` (stdout, or a file on the card when the command's output is redirected) only in chunks
+/// of about `kBufferSize` bytes. Compared to a `printf` per field this
+/// saves parsing the format string at run time and, more importantly on the console, the VFS/UART
+/// driver round trip per line: the console's stdout is line-buffered.
+///
+/// \example
+/// \code{.cpp}
+/// ConsoleOutput out(stdout);
+/// for (const auto& e : entries) {
+///   out.Print("name='{}' size={}\n", e.name, e.size);
+/// }
+/// out.Flush();
+/// \endcode
+class ConsoleOutput {
+ public:
+  static constexpr size_t kBufferSize = 1024;
+
+  /// \param f  destination (not owned); must outlive this object
+  explicit ConsoleOutput(FILE* f) : f_(f), buf_(BlockPool::Get().Allocate(kBufferSize + 256)) {}
+  ~ConsoleOutput() { Flush(); }
+
+  /// Formats into the buffer (fmt syntax, checked at compile time), writing the buffer out once
+  /// it is full.
+  template <typename... Args>
+  void Print(fmt::format_string<Args...> format, const Args&... args) {
+    const size_t room = buf_.size() - size_;
+    // `format` was checked at the call site; handing it to `format_to_n` would check it again
+    // against `const Args&...`, which is not a constant expression under C++20
+    const auto arg_store = fmt::make_format_args(args...);
+    const auto result = fmt::vformat_to_n(buf_.data() + size_, room, format, arg_store);
+    if (result.size > room) {
+      // a single field larger than what is left of the buffer (or no buffer at all): rare
+      Write(fmt::vformat(format, arg_store));
+      return;
+    }
+    size_ += result.size;
+    if (size_ >= kBufferSize) {
+      Flush();
+    }
+  }
+
+  /// Appends raw bytes. Large pieces bypass the buffer.
+  void Write(std::string_view data);
+
+  /// Writes out everything buffered so far.
+  ///
+  /// \return `ESP_OK` unless this or any earlier write failed
+  esp_err_t Flush();
+
+  /// \return `ESP_OK` unless a write has failed (the rest of the output is dropped then)
+  esp_err_t error() const { return error_; }
+
+  /// \return bytes handed to the destination so far, plus those still buffered
+  uint64_t size() const { return bytes_flushed_ + size_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(ConsoleOutput)
+
+ private:
+  FILE* f_;
+  // at least `kBufferSize`, plus some slack for the one format call that overflows it before
+  // `Print` flushes (a whole pool block unless the pool is exhausted)
+  PoolBuffer buf_;
+  size_t size_ = 0;  // bytes buffered
+  uint64_t bytes_flushed_ = 0;
+  esp_err_t error_ = ESP_OK;
+
+  void WriteOut(const char* data, size_t size);
+};
@@ -0,0 +1,54 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+#endif  // ESP_PLATFORM
+
+/// CRC-32 (IEEE 802.3, reflected, same as zlib's `crc32`). Pass the previous result as `crc` to
+/// continue a running checksum; start with 0.
+///
+/// On device this uses the ROM implementation (no table in RAM); on host a table-driven fallback
+/// that produces identical values.
+#ifdef ESP_PLATFORM
+
+inline uint32_t Crc32(uint32_t crc, const void* data, size_t size) {
+  return esp_rom_crc32_le(crc, static_cast<const uint8_t*>(data), size);
+}
+
+#else
+
+namespace crc32_internal {
+
+constexpr std::array<uint32_t, 256> MakeTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+inline constexpr std::array<uint32_t, 256> kTable = MakeTable();
+
+}  // namespace crc32_internal
+
+inline uint32_t Crc32(uint32_t crc, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = crc32_internal::kTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#endif  // ESP_PLATFORM
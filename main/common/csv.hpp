@@ -0,0 +1,240 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "common/iter.hpp"
+#include "common/strings.hpp"
+
+// Zero-copy parsing of delimited text (CSV and the like), typically lines from `FileLineReader`.
+// Fields are views into the line, so nothing here allocates.
+
+/// Implementation for `FieldIter`
+class FieldIterImpl {
+ public:
+  using Item = std::string_view;
+
+  /// \param line   one line; a trailing "\n" or "\r\n" is ignored
+  /// \param delim  field delimiter
+  /// \param trim   strip spaces and tabs around each field
+  explicit FieldIterImpl(std::string_view line, char delim = ',', bool trim = false)
+      : p_(line.data()), end_(line.data() + line.size()), delim_(delim), trim_(trim) {
+    if (p_ < end_ && end_[-1] == '\n') {
+      --end_;
+    }
+    if (p_ < end_ && end_[-1] == '\r') {
+      --end_;
+    }
+  }
+
+  std::optional<std::string_view> Next() {
+    if (done_) {
+      return {};
+    }
+    const char* field_begin = p_;
+    const char* field_end;
+    if (p_ < end_ && *p_ == '"') {
+      // quoted: runs until a quote followed by the delimiter (or the end); doubled quotes inside
+      // are left as-is, since unescaping would need a copy
+      ++field_begin;
+      const char* q = field_begin;
+      while (true) {
+        q = FindByte(q, end_, '"');
+        if (q == end_ || q + 1 == end_ || q[1] == delim_) {
+          break;
+        }
+        q += q[1] == '"' ? 2 : 1;
+      }
+      field_end = q;
+      p_ = q == end_ ? end_ : q + 1;
+    } else {
+      field_end = p_ = FindByte(p_, end_, delim_);
+    }
+    if (p_ == end_) {
+      done_ = true;
+    } else {
+      ++p_;  // skip the delimiter
+    }
+
+    std::string_view field(field_begin, field_end - field_begin);
+    if (trim_) {
+      field = TrimSuffix(TrimPrefix(field, " \t"), " \t");
+    }
+    return field;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+  char delim_;
+  bool trim_;
+  bool done_ = false;
+};
+
+/// Iterator/Iterable over the fields of one line of delimited text.
+///
+/// \example
+/// \code{.cpp}
+/// for (std::string_view line : io::FileLineReader(reader->AsByteSource(), 256)) {
+///   for (std::string_view field : FieldIter(line)) { /* ... */ }
+/// }
+/// \endcode
+///
+/// \see FieldIterImpl
+using FieldIter = RustIter<FieldIterImpl>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Number parsing: strict (the whole field must be consumed), no locale, no allocation.
+
+/// Parses a decimal integer with an optional sign.
+///
+/// \return false if `s` is not entirely a valid integer, or it overflows
+inline bool ParseInt(std::string_view s, int64_t* out) {
+  const char* p = s.data();
+  const char* const end = p + s.size();
+  const bool negative = p < end && *p == '-';
+  if (p < end && (*p == '-' || *p == '+')) {
+    ++p;
+  }
+  if (p == end) {
+    return false;
+  }
+  // accumulate as negative, so that INT64_MIN is representable
+  int64_t value = 0;
+  for (; p < end; ++p) {
+    const unsigned digit = static_cast<unsigned char>(*p) - '0';
+    if (digit > 9 || __builtin_mul_overflow(value, 10, &value) ||
+        __builtin_sub_overflow(value, static_cast<int64_t>(digit), &value)) {
+      return false;
+    }
+  }
+  if (!negative) {
+    if (value == INT64_MIN) {
+      return false;
+    }
+    value = -value;
+  }
+  *out = value;
+  return true;
+}
+
+/// Parses a decimal number into fixed point with `frac_digits` digits after the point, e.g.
+/// "-12.3456" with `frac_digits = 3` => -12345. Extra fractional digits are truncated (towards 0);
+/// missing ones count as 0. "12", "12." and ".5" are all accepted.
+///
+/// \return false if `s` is not entirely a valid number, or it overflows
+inline bool ParseFixedPoint(std::string_view s, int frac_digits, int64_t* out) {
+  const size_t point = s.find('.');
+  const std::string_view int_part = s.substr(0, point);
+  const std::string_view frac_part =
+      point == std::string_view::npos ? std::string_view{} : s.substr(point + 1);
+
+  const bool has_sign = !int_part.empty() && (int_part[0] == '-' || int_part[0] == '+');
+  const bool negative = has_sign && int_part[0] == '-';
+  int64_t value = 0;
+  if (int_part.size() > has_sign) {
+    if (!ParseInt(int_part, &value)) {
+      return false;
+    }
+  } else if (frac_part.empty()) {
+    return false;  // no digits at all
+  }
+  int64_t frac = 0;
+  for (int i = 0; i < frac_digits; i++) {
+    unsigned digit = 0;
+    if (i < static_cast<int>(frac_part.size())) {
+      digit = static_cast<unsigned char>(frac_part[i]) - '0';
+      if (digit > 9) {
+        return false;
+      }
+    }
+    frac = frac * 10 + digit;
+  }
+  for (size_t i = frac_digits; i < frac_part.size(); i++) {
+    if (static_cast<unsigned>(static_cast<unsigned char>(frac_part[i]) - '0') > 9) {
+      return false;
+    }
+  }
+  int64_t scale = 1;
+  for (int i = 0; i < frac_digits; i++) {
+    scale *= 10;
+  }
+  if (__builtin_mul_overflow(value, scale, &value) ||
+      __builtin_add_overflow(value, negative ? -frac : frac, &value)) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Typed column extraction
+
+/// Column handlers for `ParseColumns`: each takes one field and reports whether it parsed.
+namespace column {
+
+struct Skip {
+  bool operator()(std::string_view) const { return true; }
+};
+
+struct Str {
+  std::string_view* out;
+  bool operator()(std::string_view s) const {
+    *out = s;
+    return true;
+  }
+};
+
+template <typename T>
+struct Int {
+  static_assert(std::is_signed_v<T> || sizeof(T) < sizeof(int64_t), "must fit in int64_t");
+
+  T* out;
+  bool operator()(std::string_view s) const {
+    int64_t value;
+    if (!ParseInt(s, &value) || value < static_cast<int64_t>(std::numeric_limits<T>::min()) ||
+        value > static_cast<int64_t>(std::numeric_limits<T>::max())) {
+      return false;
+    }
+    *out = static_cast<T>(value);
+    return true;
+  }
+};
+
+struct Fixed {
+  int frac_digits;
+  int64_t* out;
+  bool operator()(std::string_view s) const { return ParseFixedPoint(s, frac_digits, out); }
+};
+
+}  // namespace column
+
+/// Splits `line` and hands the leading fields to `columns` in order; fields beyond the last column
+/// are ignored.
+///
+/// \example
+/// \code{.cpp}
+/// int64_t t_us;
+/// std::string_view name;
+/// int64_t volts_milli;
+/// if (ParseColumns(line, ',', column::Int<int64_t>{&t_us}, column::Skip{}, column::Str{&name},
+///                  column::Fixed{3, &volts_milli})) { /* ... */ }
+/// \endcode
+///
+/// \return false if there are fewer fields than columns, or any column fails to parse
+template <typename... Columns>
+bool ParseColumns(std::string_view line, char delim, Columns&&... columns) {
+  FieldIterImpl fields(line, delim);
+  const auto parse_one = [&fields](auto&& column) {
+    const std::optional<std::string_view> field = fields.Next();
+    return field && column(*field);
+  };
+  return (parse_one(columns) && ...);
+}
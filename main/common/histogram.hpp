@@ -0,0 +1,106 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "common/split_counter.hpp"
+
+/// Log-linear histogram of non-negative integer samples (typically latencies in us).
+///
+/// Each power of two is split into `kSubBuckets` equal buckets, so any reported percentile is
+/// within 1 / `kSubBuckets` (relative) of the true value, using ~0.5 KiB of fixed counters and no
+/// allocation. Samples are counted with relaxed 32-bit atomics: recording never blocks, and reading
+/// while another thread records gives a slightly inconsistent but usable snapshot.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 2;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kNumBuckets = (32 - kSubBucketBits + 1) * kSubBuckets;
+
+  void Record(uint32_t value) {
+    counts_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.Add(value);
+    uint32_t prev = max_.load(std::memory_order_relaxed);
+    while (value > prev && !max_.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  /// Adds the samples of `other`, e.g. to combine per-core histograms for reporting.
+  void Merge(const LatencyHistogram& other) {
+    for (int i = 0; i < kNumBuckets; i++) {
+      counts_[i].fetch_add(other.bucket_count(i), std::memory_order_relaxed);
+    }
+    count_.fetch_add(other.count(), std::memory_order_relaxed);
+    sum_.Add(other.sum());
+    const uint32_t other_max = other.max();
+    uint32_t prev = max_.load(std::memory_order_relaxed);
+    while (other_max > prev &&
+           !max_.compare_exchange_weak(prev, other_max, std::memory_order_relaxed)) {
+    }
+  }
+
+  void Reset() {
+    for (auto& c : counts_) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.Reset();
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(); }
+  uint32_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint32_t mean() const { return count() ? sum() / count() : 0; }
+
+  /// \param q    quantile in [0, 1], e.g. 0.99 for p99
+  /// \return upper bound of the bucket containing the q-th sample (never more than `max()`);
+  ///         0 if empty
+  uint32_t Percentile(double q) const {
+    const uint32_t n = count();
+    if (n == 0) {
+      return 0;
+    }
+    const uint32_t rank = q >= 1 ? n : static_cast<uint32_t>(q * n) + 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        const uint32_t upper = BucketUpperBound(i);
+        return upper < max() ? upper : max();
+      }
+    }
+    return max();
+  }
+
+  /// Buckets exposed for custom reporting.
+  uint32_t bucket_count(int i) const { return counts_[i].load(std::memory_order_relaxed); }
+  static uint32_t BucketUpperBound(int i) {
+    if (i < 2 * kSubBuckets) {
+      return i;
+    }
+    const int exponent = i / kSubBuckets - 1 + kSubBucketBits;
+    const uint64_t step = uint64_t{1} << (exponent - kSubBucketBits);
+    const uint64_t upper = (uint64_t{1} << exponent) + (i % kSubBuckets + 1) * step - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(upper);
+  }
+
+  static int BucketOf(uint32_t value) {
+    if (value < 2 * kSubBuckets) {
+      return value;  // exact
+    }
+    const int exponent = 31 - __builtin_clz(value);
+    const int sub = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+  }
+
+ private:
+  std::atomic<uint32_t> counts_[kNumBuckets] = {};
+  std::atomic<uint32_t> count_{0};
+  SplitCounter64 sum_;
+  std::atomic<uint32_t> max_{0};
+};
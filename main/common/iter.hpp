@@ -49,7 +49,7 @@ class RustIter {
   std::monostate end() const noexcept { return {}; }
   friend bool operator!=(const Proxy& lhs, const std::monostate& rhs) { return lhs; }
 
-  NOT_COPYABLE_NOR_MOVABLE(RustIter<TInner>)
+  NOT_COPYABLE_NOR_MOVABLE(RustIter)
 
  private:
   TInner inner_;
@@ -0,0 +1,91 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <functional>
+#include <utility>
+
+#ifdef ESP_PLATFORM
+#include "common/task.hpp"
+#else
+#include <thread>
+#endif  // ESP_PLATFORM
+
+#include "common/macros.hpp"
+
+/// Runs `step` over and over on its own thread of execution until it returns false: a pinned
+/// `Task` on device, a `std::thread` on host (so that code built on top of it can be tested with
+/// pthreads).
+///
+/// `Stop` must only be called once `step` has returned false (or is guaranteed to do so without
+/// further input); it does not interrupt a running step.
+///
+/// \example
+/// \code{.cpp}
+/// LoopTask worker([this]() { return DrainOne(); });
+/// worker.Start("drain", 4096, 3, APP_CPU_NUM);
+/// /* ... make `DrainOne` return false ... */
+/// worker.Stop();
+/// \endcode
+#ifdef ESP_PLATFORM
+
+class LoopTask : public Task {
+ public:
+  explicit LoopTask(std::function<bool()> step) : step_(std::move(step)) {
+    set_instrumented(true);  // one step per loop
+  }
+  virtual ~LoopTask() = default;
+
+  esp_err_t Start(const char* name, uint32_t stack_depth, uint32_t priority, BaseType_t cpu) {
+    return Task::SpawnPinned(name, stack_depth, priority, cpu);
+  }
+  void Stop() { Task::Kill(); }
+
+ protected:
+  void Run() override {
+    while (step_()) {
+      MarkLoop();
+    }
+    while (true) {
+      vTaskSuspend(nullptr);  // wait for `Stop`
+    }
+  }
+
+ private:
+  std::function<bool()> step_;
+};
+
+#else
+
+class LoopTask {
+ public:
+  explicit LoopTask(std::function<bool()> step) : step_(std::move(step)) {}
+  ~LoopTask() { Stop(); }
+
+  /// Same signature as on device; a host thread has none of these properties.
+  esp_err_t Start(
+      [[maybe_unused]] const char* name,
+      [[maybe_unused]] uint32_t stack_depth,
+      [[maybe_unused]] uint32_t priority,
+      [[maybe_unused]] int cpu) {
+    thread_ = std::thread([this]() {
+      while (step_()) {
+      }
+    });
+    return ESP_OK;
+  }
+  void Stop() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(LoopTask)
+
+ private:
+  std::function<bool()> step_;
+  std::thread thread_;
+};
+
+#endif  // ESP_PLATFORM
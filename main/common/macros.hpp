@@ -3,10 +3,9 @@
 
 #pragma once
 
-#include "esp_err.h"
-#include "esp_log.h"
+#include "common/platform.hpp"
 
-#if CONFIG_ESP_SYSTEM_PANIC_PRINT_HALT
+#if CONFIG_ESP_SYSTEM_PANIC_PRINT_HALT || !defined(ESP_PLATFORM)
 #define DIEDIEDIE abort()
 #else
 #warning "Consider changing system panic behavior to CONFIG_ESP_SYSTEM_PANIC_PRINT_HALT."
@@ -91,3 +90,49 @@
   T(T&&) = delete;                  \
   T& operator=(const T&) = delete;  \
   T&& operator=(T&&) = delete;
+
+#ifndef CONFIG_TRACE_ENABLED
+#define CONFIG_TRACE_ENABLED 0
+#endif  // CONFIG_TRACE_ENABLED
+
+// Event tracing into `TraceRing` (see `common/trace.hpp`). `event` is the name of a `TraceEvent`
+// enumerator, e.g. `TRACE_SCOPE(kCompressBlock, size)`. With `CONFIG_TRACE_ENABLED` off these
+// expand to nothing, and `arg` is not evaluated.
+#if CONFIG_TRACE_ENABLED
+
+#include "common/trace.hpp"
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/// Records the start of a span on the current task; must be matched by `TRACE_END` on the same
+/// task.
+#define TRACE_BEGIN(event, arg) \
+  TraceRing::Get().Record(TraceEvent::event, TracePhase::kBegin, static_cast<uint32_t>(arg))
+
+#define TRACE_END(event) TraceRing::Get().Record(TraceEvent::event, TracePhase::kEnd, 0)
+
+/// Records a point in time.
+#define TRACE_INSTANT(event, arg) \
+  TraceRing::Get().Record(TraceEvent::event, TracePhase::kInstant, static_cast<uint32_t>(arg))
+
+/// Records a span from here to the end of the enclosing scope.
+#define TRACE_SCOPE(event, arg) \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(TraceEvent::event, static_cast<uint32_t>(arg))
+
+#else  // CONFIG_TRACE_ENABLED
+
+#define TRACE_BEGIN(event, arg) \
+  do {                          \
+  } while (0)
+#define TRACE_END(event) \
+  do {                   \
+  } while (0)
+#define TRACE_INSTANT(event, arg) \
+  do {                            \
+  } while (0)
+#define TRACE_SCOPE(event, arg) \
+  do {                          \
+  } while (0)
+
+#endif  // CONFIG_TRACE_ENABLED
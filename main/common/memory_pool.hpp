@@ -0,0 +1,288 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "common/macros.hpp"
+
+class BlockPool;
+
+/// Buffer handed out by `BlockPool::Allocate`: either one of the pool's blocks, or (if the request
+/// was too large, or the pool was empty) a plain heap allocation. Returned on destruction.
+class PoolBuffer {
+ public:
+  PoolBuffer() = default;
+  PoolBuffer(PoolBuffer&& other) noexcept { *this = std::move(other); }
+  PoolBuffer& operator=(PoolBuffer&& other) noexcept;
+  ~PoolBuffer() { Release(); }
+
+  char* data() const { return data_; }
+  size_t size() const { return size_; }
+  char& operator[](size_t i) const { return data_[i]; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+  /// \return true if this buffer came from the heap rather than the pool
+  bool is_fallback() const { return block_ < 0; }
+
+ private:
+  friend class BlockPool;
+
+  BlockPool* pool_ = nullptr;
+  char* data_ = nullptr;
+  size_t size_ = 0;
+  int block_ = -1;  // index into the pool, or -1 for a heap allocation
+
+  PoolBuffer(BlockPool* pool, char* data, size_t size, int block)
+      : pool_(pool), data_(data), size_(size), block_(block) {}
+  void Release();
+};
+
+/// A fixed number of fixed-size blocks for short-lived I/O buffers (line readers, command scratch).
+///
+/// All blocks are carved out of a single allocation made on first use and never freed, so
+/// repeatedly opening and closing readers does not churn (and fragment) the heap. Requests larger
+/// than a block, or made while all blocks are taken, fall back to the heap and are counted, which
+/// tells whether the pool is sized right.
+class BlockPool {
+ public:
+  static constexpr size_t kBlockSize = 8 * 1024;
+  static constexpr int kNumBlocks = 4;
+
+  struct Stats {
+    int num_in_use;
+    int max_in_use;
+    uint32_t num_acquires;   ///< served from the pool
+    uint32_t num_fallbacks;  ///< served from the heap
+  };
+
+  static BlockPool& Get() {
+    static BlockPool instance;
+    return instance;
+  }
+
+  /// \return buffer of at least `size` bytes (uninitialized); empty only if the heap is exhausted
+  PoolBuffer Allocate(size_t size) {
+    if (size <= kBlockSize) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!storage_) {
+        storage_.reset(static_cast<char*>(malloc(kNumBlocks * kBlockSize)));
+      }
+      if (storage_ && free_mask_) {
+        const int block = __builtin_ctz(free_mask_);
+        free_mask_ &= ~(1u << block);
+        stats_.max_in_use = std::max(stats_.max_in_use, ++stats_.num_in_use);
+        ++stats_.num_acquires;
+        return PoolBuffer(this, &storage_[block * kBlockSize], kBlockSize, block);
+      }
+    }
+    num_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+    char* const data = static_cast<char*>(malloc(size));
+    return PoolBuffer(this, data, data ? size : 0, -1);
+  }
+
+  Stats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.num_fallbacks = num_fallbacks_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(BlockPool)
+
+ private:
+  friend class PoolBuffer;
+
+  struct FreeDeleter {
+    void operator()(char* p) const { free(p); }
+  };
+
+  std::mutex mutex_;
+  std::unique_ptr<char[], FreeDeleter> storage_;
+  uint32_t free_mask_ = (1u << kNumBlocks) - 1;
+  Stats stats_{};
+  std::atomic<uint32_t> num_fallbacks_{0};
+
+  static_assert(kNumBlocks <= 32, "free_mask_ is 32 bits");
+
+  BlockPool() = default;
+
+  void Free(int block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_mask_ |= 1u << block;
+    --stats_.num_in_use;
+  }
+};
+
+inline PoolBuffer& PoolBuffer::operator=(PoolBuffer&& other) noexcept {
+  if (this != &other) {
+    Release();
+    pool_ = std::exchange(other.pool_, nullptr);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    block_ = std::exchange(other.block_, -1);
+  }
+  return *this;
+}
+
+inline void PoolBuffer::Release() {
+  if (!data_) {
+    return;
+  }
+  if (block_ >= 0) {
+    pool_->Free(block_);
+  } else {
+    free(data_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Bump allocator for memory that lives exactly as long as one unit of work (e.g. a console
+/// command, see `CommandArena`): allocations are never freed individually, only all at once by
+/// `Reset`.
+///
+/// The first chunk is allocated once and kept across resets, so a command that fits in it touches
+/// the heap not at all. Larger demands add overflow chunks, which `Reset` returns to the heap.
+/// Only for trivially destructible objects; not thread-safe.
+///
+/// \example
+/// \code{.cpp}
+/// Arena arena(4096);
+/// const std::string_view path = arena.Concat({"0:", "/logs"});  // null-terminated
+/// // ...
+/// arena.Reset();
+/// \endcode
+class Arena {
+ public:
+  struct Stats {
+    uint32_t num_allocs;           ///< since the last `Reset`
+    size_t bytes;                  ///< allocated since the last `Reset`, including padding
+    size_t max_bytes;              ///< largest `bytes` ever reached
+    uint32_t num_overflow_chunks;  ///< since the last `Reset`
+  };
+
+  explicit Arena(size_t chunk_size) : chunk_size_(chunk_size) {}
+  ~Arena() {
+    Reset();
+    free(first_);
+  }
+
+  /// \return `size` uninitialized bytes aligned to `align` (a power of 2); nullptr if out of memory
+  void* Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    if (!head_) {
+      if (!first_ && !(first_ = NewChunk(chunk_size_, nullptr))) {
+        return nullptr;
+      }
+      head_ = first_;
+    }
+    uintptr_t p = (reinterpret_cast<uintptr_t>(head_->data()) + used_ + align - 1) & ~(align - 1);
+    size_t end = p - reinterpret_cast<uintptr_t>(head_->data()) + size;
+    if (end > head_->size) {
+      // the unused tail of the current chunk is abandoned until `Reset`
+      Chunk* const chunk = NewChunk(std::max(chunk_size_, size + align), head_);
+      if (!chunk) {
+        return nullptr;
+      }
+      head_ = chunk;
+      ++stats_.num_overflow_chunks;
+      used_ = 0;
+      p = (reinterpret_cast<uintptr_t>(head_->data()) + align - 1) & ~(align - 1);
+      end = p - reinterpret_cast<uintptr_t>(head_->data()) + size;
+    }
+    stats_.bytes += end - used_;
+    stats_.max_bytes = std::max(stats_.max_bytes, stats_.bytes);
+    ++stats_.num_allocs;
+    used_ = end;
+    return reinterpret_cast<void*>(p);
+  }
+
+  /// \return uninitialized array of `n` `T`s
+  template <typename T>
+  T* AllocateArray(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "Arena never runs destructors");
+    return static_cast<T*>(Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  /// \return copy of all `parts` joined together, null-terminated (not counted in the size); empty
+  ///         if out of memory
+  std::string_view Concat(std::initializer_list<std::string_view> parts) {
+    size_t size = 0;
+    for (const std::string_view part : parts) {
+      size += part.size();
+    }
+    char* const data = AllocateArray<char>(size + 1);
+    if (!data) {
+      return {};
+    }
+    char* p = data;
+    for (const std::string_view part : parts) {
+      memcpy(p, part.data(), part.size());
+      p += part.size();
+    }
+    *p = '\0';
+    return {data, size};
+  }
+
+  /// Invalidates everything allocated so far; overflow chunks go back to the heap.
+  void Reset() {
+    for (Chunk* c = head_; c && c != first_;) {
+      Chunk* const next = c->next;
+      free(c);
+      c = next;
+    }
+    head_ = nullptr;
+    used_ = 0;
+    stats_.num_allocs = 0;
+    stats_.bytes = 0;
+    stats_.num_overflow_chunks = 0;
+  }
+
+  const Stats& stats() const { return stats_; }
+  size_t chunk_size() const { return chunk_size_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(Arena)
+
+ private:
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  size_t chunk_size_;
+  Chunk* first_ = nullptr;  // kept across `Reset`
+  Chunk* head_ = nullptr;   // chunk being allocated from; chunks are linked back to `first_`
+  size_t used_ = 0;         // bytes used in `head_`
+  Stats stats_{};
+
+  static Chunk* NewChunk(size_t size, Chunk* next) {
+    Chunk* const chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+    if (chunk) {
+      chunk->next = next;
+      chunk->size = size;
+    }
+    return chunk;
+  }
+};
+
+/// Scratch memory for the console command being run; reset after every command (see
+/// `DEFINE_CONSOLE_COMMAND`). Only to be used from the console task.
+inline Arena& CommandArena() {
+  static Arena instance(4096);
+  return instance;
+}
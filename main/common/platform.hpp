@@ -0,0 +1,87 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+// Pulls in the few ESP-IDF definitions that platform-neutral modules rely on (`esp_err_t`,
+// `ESP_LOGx`, `likely`/`unlikely`). On a Linux host (no `ESP_PLATFORM`), minimal stand-ins are
+// provided instead, so that e.g. the codecs under `io/` can be built and measured off-target.
+//
+// Modules that depend on ESP-IDF only through this header (and other platform-neutral ones) build
+// on a Linux host as well: among others `LzCodec`, the compressed file writer/readers,
+// `SectorReader`, `FileBlockDevice`, `RawRingLog`, `IoStats`, `BlockPool`/`Arena`, `OwnedFile`
+// and `DmaBuffer` (see the tools under `host/`).
+
+#ifdef ESP_PLATFORM
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#else  // ESP_PLATFORM
+
+#include <cstdio>
+
+using esp_err_t = int;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+
+inline const char* esp_err_to_name(esp_err_t err) {
+  switch (err) {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_FAIL:
+      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+      return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+      return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+      return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+      return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:
+      return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+      return "ESP_ERR_INVALID_VERSION";
+    default:
+      return "UNKNOWN ERROR";
+  }
+}
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) (void)(tag)
+#define ESP_LOGV(tag, format, ...) (void)(tag)
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,79 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "common/histogram.hpp"
+#include "common/macros.hpp"
+#include "common/times.hpp"
+
+/// A named code section whose durations (in us) are collected into a `LatencyHistogram`.
+///
+/// Probes are meant to be static objects (see `SCOPED_TIMER`): each one links itself into a global
+/// list once, on construction, so that they can all be listed (e.g. by the `stats` console command)
+/// without allocating or locking anything.
+class TimerProbe {
+ public:
+  /// \param name  must outlive the probe, e.g. a string literal
+  explicit TimerProbe(const char* name) : name_(name), next_(head_.load()) {
+    while (!head_.compare_exchange_weak(next_, this)) {
+    }
+  }
+
+  void Record(uint32_t us) { hist_.Record(us); }
+
+  const char* name() const { return name_; }
+  const LatencyHistogram& hist() const { return hist_; }
+  void Reset() { hist_.Reset(); }
+
+  /// Calls `f(TimerProbe&)` for every probe constructed so far, most recent first.
+  template <typename F>
+  static void ForEach(F&& f) {
+    for (TimerProbe* p = head_.load(); p; p = p->next_) {
+      f(*p);
+    }
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(TimerProbe)
+
+ private:
+  const char* name_;
+  TimerProbe* next_;
+  LatencyHistogram hist_;
+
+  static inline std::atomic<TimerProbe*> head_{nullptr};
+};
+
+/// Records the lifetime of the scope into a `TimerProbe`.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(TimerProbe* probe) : probe_(probe), t0_(NowMonotonicUs()) {}
+  ~ScopedTimer() { probe_->Record(static_cast<uint32_t>(NowMonotonicUs() - t0_)); }
+
+  NOT_COPYABLE_NOR_MOVABLE(ScopedTimer)
+
+ private:
+  TimerProbe* probe_;
+  int64_t t0_;
+};
+
+#define SCOPED_TIMER_CONCAT_INNER(a, b) a##b
+#define SCOPED_TIMER_CONCAT(a, b) SCOPED_TIMER_CONCAT_INNER(a, b)
+
+/// Times from here to the end of the enclosing scope, into the probe `name` (a string literal).
+/// Each use site has its own static probe, so `name` should be unique.
+///
+/// \example
+/// \code{.cpp}
+/// esp_err_t Mount() {
+///   SCOPED_TIMER("sd.mount");
+///   // ...
+/// }
+/// \endcode
+#define SCOPED_TIMER(name)                                             \
+  static TimerProbe SCOPED_TIMER_CONCAT(timer_probe_, __LINE__)(name); \
+  ScopedTimer SCOPED_TIMER_CONCAT(scoped_timer_, __LINE__)(            \
+      &SCOPED_TIMER_CONCAT(timer_probe_, __LINE__))
@@ -0,0 +1,50 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// 64-bit counter made of two relaxed 32-bit atomics.
+///
+/// The ESP32 (Xtensa) has no 64-bit atomic instructions, so `std::atomic<uint64_t>` goes through
+/// libatomic, i.e. a global spinlock shared by every 64-bit atomic in the program. This only uses
+/// the native 32-bit ones instead: the low word is added to, and whoever makes it wrap around
+/// carries into the high word. A reader racing with that carry may see a value short by 2^32 for a
+/// moment; otherwise reads are as consistent as any relaxed counter.
+class SplitCounter64 {
+ public:
+  void Add(uint64_t value) {
+    const uint32_t lo = static_cast<uint32_t>(value);
+    const uint32_t prev = lo_.fetch_add(lo, std::memory_order_relaxed);
+    const uint32_t carry = static_cast<uint32_t>(prev + lo < prev);
+    const uint32_t hi = static_cast<uint32_t>(value >> 32) + carry;
+    if (hi) {
+      hi_.fetch_add(hi, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t load() const {
+    uint32_t hi = hi_.load(std::memory_order_relaxed);
+    uint32_t lo;
+    for (;;) {
+      lo = lo_.load(std::memory_order_relaxed);
+      const uint32_t hi2 = hi_.load(std::memory_order_relaxed);
+      if (hi2 == hi) {
+        break;
+      }
+      hi = hi2;
+    }
+    return (uint64_t{hi} << 32) | lo;
+  }
+
+  void Reset() {
+    lo_.store(0, std::memory_order_relaxed);
+    hi_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint32_t> lo_{0};
+  std::atomic<uint32_t> hi_{0};
+};
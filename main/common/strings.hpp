@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <string_view>
 
 inline std::string_view TrimPrefix(std::string_view s, const char* char_set = " \r\n\t") {
@@ -20,3 +22,93 @@ inline std::string_view TrimSuffix(std::string_view s, const char* char_set = "
   ret.remove_suffix(s.size() - (s.find_last_not_of(char_set) + 1));
   return ret;
 }
+
+/// Finds the first occurrence of `c` in `[begin, end)`, like `std::find` but a word at a time.
+///
+/// On host this is `memchr` (vectorized by libc). On device, where newlib's `memchr` goes byte by
+/// byte, each aligned 32-bit word is tested for a matching byte with the SWAR "has zero byte"
+/// trick.
+///
+/// \return pointer to the first match; `end` if not found
+inline const char* FindByte(const char* begin, const char* end, char c) {
+#ifdef ESP_PLATFORM
+  const char* p = begin;
+  while (p < end && (reinterpret_cast<uintptr_t>(p) & 3)) {
+    if (*p == c) {
+      return p;
+    }
+    ++p;
+  }
+  const uint32_t pattern = 0x01010101u * static_cast<uint8_t>(c);
+  while (end - p >= 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));  // aligned: compiles to a single load
+    word ^= pattern;                 // matching bytes become zero
+    if ((word - 0x01010101u) & ~word & 0x80808080u) {
+      break;
+    }
+    p += 4;
+  }
+  while (p < end) {
+    if (*p == c) {
+      return p;
+    }
+    ++p;
+  }
+  return end;
+#else
+  const void* const p = memchr(begin, c, end - begin);
+  return p ? static_cast<const char*>(p) : end;
+#endif  // ESP_PLATFORM
+}
+
+/// Finds the last occurrence of `c` in `[begin, end)`.
+///
+/// \return pointer to the last match; `end` if not found
+inline const char* FindLastByte(const char* begin, const char* end, char c) {
+#if defined(__GLIBC__)
+  const void* const p = memrchr(begin, c, end - begin);
+  return p ? static_cast<const char*>(p) : end;
+#else
+  for (const char* p = end; p > begin;) {
+    if (*--p == c) {
+      return p;
+    }
+  }
+  return end;
+#endif  // __GLIBC__
+}
+
+/// Matches `name` against a shell-style wildcard `pattern`: `*` matches any run of characters
+/// (including none), `?` matches any single character. Runs in O(|pattern| * |name|) worst case
+/// without recursion or allocation.
+///
+/// \param ignore_case  compare ASCII letters case-insensitively, as FAT does for file names
+inline bool GlobMatch(std::string_view pattern, std::string_view name, bool ignore_case = false) {
+  const auto fold = [ignore_case](char c) {
+    return ignore_case && c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  };
+  size_t p = 0;
+  size_t n = 0;
+  size_t star = std::string_view::npos;  // position of the last `*` seen in `pattern`
+  size_t star_n = 0;                     // position in `name` that `*` currently extends to
+  while (n < name.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_n = n;
+    } else if (p < pattern.size() && (pattern[p] == '?' || fold(pattern[p]) == fold(name[n]))) {
+      ++p;
+      ++n;
+    } else if (star != std::string_view::npos) {
+      // let the last `*` swallow one more character and retry from there
+      p = star + 1;
+      n = ++star_n;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
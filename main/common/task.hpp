@@ -9,6 +9,7 @@
 #include "freertos/task.h"
 
 #include "common/macros.hpp"
+#include "common/task_stats.hpp"
 
 /// Bare-minimum wrapper base class for a FreeRTOS task. This allows encapsulation of a task
 /// alongside with its context.
@@ -43,12 +44,26 @@ class Task {
   ///          `nullptr` otherwise.
   TaskHandle_t handle() const { return handle_.load(); }
 
+  /// Opts in to instrumentation: from the next spawn on, the task is listed in `TaskRegistry`, and
+  /// its calls to `MarkLoop` are counted (e.g. by the `top` console command).
+  void set_instrumented(bool instrumented) { instrumented_ = instrumented; }
+
+  const TaskLoopStats& loop_stats() const { return loop_stats_; }
+
  protected:
   explicit Task() {}
 
   /// Entry point for the task (must be overridden by the subclass and never return)
   [[noreturn]] virtual void Run() = 0;
 
+  /// To be called by `Run` once per iteration of its main loop. Cheap; does nothing unless the
+  /// task is instrumented.
+  void MarkLoop() {
+    if (instrumented_) {
+      loop_stats_.MarkLoop();
+    }
+  }
+
   /// Starts the task without specifying CPU core affinity.
   /// If the task has already been started, it will be killed then restarted.
   /// \param name           FreeRTOS task name.
@@ -60,7 +75,7 @@ class Task {
     if (xTaskCreate(RunAdapter, name, stack_depth, this, priority, &handle) != pdTRUE) {
       return ESP_ERR_NO_MEM;
     }
-    handle_.store(handle);
+    OnSpawned(handle);
     return ESP_OK;
   }
 
@@ -77,7 +92,7 @@ class Task {
         pdTRUE) {
       return ESP_ERR_NO_MEM;
     }
-    handle_.store(handle);
+    OnSpawned(handle);
     return ESP_OK;
   }
 
@@ -94,16 +109,28 @@ class Task {
   void Kill() {
     const TaskHandle_t handle = handle_.exchange(nullptr);
     if (handle) {
+      if (instrumented_) {
+        TaskRegistry::Get().Remove(handle);
+      }
       vTaskDelete(handle);
     }
   }
 
  private:
   std::atomic<TaskHandle_t> handle_ = nullptr;
+  bool instrumented_ = false;
+  TaskLoopStats loop_stats_;
   static_assert(
       std::atomic<TaskHandle_t>::is_always_lock_free,
       "Task wrapper class is not usable on this platform.");
 
+  void OnSpawned(TaskHandle_t handle) {
+    handle_.store(handle);
+    if (instrumented_) {
+      TaskRegistry::Get().Add(handle, &loop_stats_);
+    }
+  }
+
   static void RunAdapter(void* self) { reinterpret_cast<Task*>(self)->Run(); }
 
   NON_COPYABLE_NOR_MOVABLE(Task)
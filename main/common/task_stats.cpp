@@ -0,0 +1,83 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "common/task_stats.hpp"
+
+#include <algorithm>
+
+namespace {
+
+/// \return false if the task table changed size too fast to snapshot
+bool Snapshot(std::vector<TaskStatus_t>* tasks, uint32_t* total_run_time) {
+  // leave room for tasks spawned in between
+  tasks->resize(uxTaskGetNumberOfTasks() + 4);
+  const UBaseType_t n = uxTaskGetSystemState(tasks->data(), tasks->size(), total_run_time);
+  tasks->resize(n);
+  return n > 0;
+}
+
+}  // namespace
+
+esp_err_t SampleTasks(int interval_ms, std::vector<TaskSample>* out) {
+  std::vector<TaskStatus_t> before, after;
+  uint32_t total_before, total_after;
+  if (!Snapshot(&before, &total_before)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  struct Loops {
+    TaskHandle_t handle;
+    uint32_t num_loops;
+  };
+  std::vector<Loops> loops_before;
+  for (const TaskStatus_t& t : before) {
+    uint32_t num_loops, last_loop_ms;
+    if (TaskRegistry::Get().Lookup(t.xHandle, &num_loops, &last_loop_ms)) {
+      loops_before.push_back({t.xHandle, num_loops});
+    }
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(interval_ms));
+
+  if (!Snapshot(&after, &total_after)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const uint32_t now_ms = static_cast<uint32_t>(NowMonotonicUs() / 1000);
+  // the run time counter is the esp_timer in us, shared by both cores
+  const uint32_t elapsed = std::max<uint32_t>(total_after - total_before, 1);
+
+  out->clear();
+  for (const TaskStatus_t& t : after) {
+    const auto prev = std::find_if(before.begin(), before.end(), [&t](const TaskStatus_t& b) {
+      return b.xHandle == t.xHandle;
+    });
+    // a task spawned during the interval has only run during the interval
+    const uint32_t run_time =
+        t.ulRunTimeCounter - (prev != before.end() ? prev->ulRunTimeCounter : 0);
+    TaskSample sample{
+        .handle = t.xHandle,
+        .name = t.pcTaskName,
+        .core = t.xCoreID == tskNO_AFFINITY ? -1 : static_cast<int>(t.xCoreID),
+        .priority = static_cast<int>(t.uxCurrentPriority),
+        .stack_free = static_cast<uint32_t>(t.usStackHighWaterMark * sizeof(StackType_t)),
+        .cpu_percent = 100.0f * run_time / elapsed,
+        .instrumented = false,
+        .loops = 0,
+        .since_last_loop_ms = 0,
+    };
+    uint32_t num_loops, last_loop_ms;
+    if (TaskRegistry::Get().Lookup(t.xHandle, &num_loops, &last_loop_ms)) {
+      const auto prev_loops =
+          std::find_if(loops_before.begin(), loops_before.end(), [&t](const Loops& l) {
+            return l.handle == t.xHandle;
+          });
+      sample.instrumented = true;
+      sample.loops = num_loops - (prev_loops != loops_before.end() ? prev_loops->num_loops : 0);
+      sample.since_last_loop_ms = now_ms - last_loop_ms;
+    }
+    out->push_back(sample);
+  }
+  std::sort(out->begin(), out->end(), [](const TaskSample& a, const TaskSample& b) {
+    return a.cpu_percent > b.cpu_percent;
+  });
+  return ESP_OK;
+}
@@ -0,0 +1,106 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "common/times.hpp"
+
+/// Counters an instrumented `Task` keeps about its own main loop.
+struct TaskLoopStats {
+  std::atomic<uint32_t> num_loops{0};
+  std::atomic<uint32_t> last_loop_ms{0};  ///< `NowMonotonicUs() / 1000` at the last loop
+
+  void MarkLoop() {
+    num_loops.fetch_add(1, std::memory_order_relaxed);
+    last_loop_ms.store(static_cast<uint32_t>(NowMonotonicUs() / 1000), std::memory_order_relaxed);
+  }
+};
+
+/// Instrumented tasks currently running, so that `SampleTasks` can attach their loop counters to
+/// what FreeRTOS reports. Fixed capacity; tasks beyond it simply go unlisted.
+class TaskRegistry {
+ public:
+  static constexpr int kMaxTasks = 16;
+
+  static TaskRegistry& Get() {
+    static TaskRegistry instance;
+    return instance;
+  }
+
+  void Add(TaskHandle_t handle, const TaskLoopStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Entry& e : entries_) {
+      if (!e.handle) {
+        e = {handle, stats};
+        return;
+      }
+    }
+  }
+
+  void Remove(TaskHandle_t handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Entry& e : entries_) {
+      if (e.handle == handle) {
+        e = {};
+      }
+    }
+  }
+
+  /// Copies the loop counters of `handle`.
+  ///
+  /// \return false if `handle` is not instrumented
+  bool Lookup(TaskHandle_t handle, uint32_t* num_loops, uint32_t* last_loop_ms) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Entry& e : entries_) {
+      if (e.handle == handle) {
+        *num_loops = e.stats->num_loops.load(std::memory_order_relaxed);
+        *last_loop_ms = e.stats->last_loop_ms.load(std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct Entry {
+    TaskHandle_t handle = nullptr;
+    const TaskLoopStats* stats = nullptr;
+  };
+
+  mutable std::mutex mutex_;
+  Entry entries_[kMaxTasks];
+
+  TaskRegistry() = default;
+};
+
+/// One task over one sampling interval of `SampleTasks`.
+struct TaskSample {
+  TaskHandle_t handle;
+  const char* name;     ///< owned by FreeRTOS; valid while the task exists
+  int core;             ///< -1 if not pinned
+  int priority;
+  uint32_t stack_free;  ///< stack high-water mark: least free stack ever, in bytes
+  float cpu_percent;    ///< of one core
+
+  bool instrumented;          ///< the rest is only valid if true
+  uint32_t loops;             ///< main loop iterations during the interval
+  uint32_t since_last_loop_ms;
+};
+
+/// Measures the CPU time of every task over `interval_ms` (blocking the caller meanwhile), from the
+/// FreeRTOS run time counters.
+///
+/// NOTE: Requires `CONFIG_FREERTOS_USE_TRACE_FACILITY` and
+/// `CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS`.
+///
+/// \param out  one entry per task alive at the end of the interval, by descending CPU time
+esp_err_t SampleTasks(int interval_ms, std::vector<TaskSample>* out);
@@ -8,6 +8,12 @@
 #include <ctime>
 #include <type_traits>
 
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#else
+#include <chrono>
+#endif  // ESP_PLATFORM
+
 #include "common/utils.hpp"
 
 // Time point conventions in this project:
@@ -121,6 +127,17 @@ constexpr uint16_t ToFat32Time(const TimeParts& t_parts) {
          (((t_parts.tm_sec / 2) & 0x1f) << 0);
 }
 
+/// Inverse of the FAT32 date/time encoding above, e.g. for `FILINFO::fdate` and `FILINFO::ftime`.
+constexpr TimeParts FromFat32DateTime(uint16_t fat_date, uint16_t fat_time) {
+  return MakeTimeParts(
+      1980 + (fat_date >> 9),
+      (fat_date >> 5) & 0xf,
+      fat_date & 0x1f,
+      fat_time >> 11,
+      (fat_time >> 5) & 0x3f,
+      (fat_time & 0x1f) * 2);
+}
+
 /////////////////////////////////////////////////////////
 
 inline TimeUnix NowUnix() { return time(nullptr); }
@@ -133,4 +150,16 @@ inline int64_t NowUnixMs() { return ToMilliseconds(NowUnixWithUs()); }
 inline int64_t NowUnixUs() { return ToMicroseconds(NowUnixWithUs()); }
 inline TimeParts NowParts() { return ToParts(NowUnix()); }
 
+/// Monotonic time since boot (or an arbitrary epoch on host) in microseconds. Unlike `NowUnixUs`,
+/// this never jumps when the wall clock is set, so use it for measuring durations.
+inline int64_t NowMonotonicUs() {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif  // ESP_PLATFORM
+}
+
 ////////////////////////////////////////////////////////
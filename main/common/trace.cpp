@@ -0,0 +1,67 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "common/trace.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+bool WriteName(FILE* f, const char* name) {
+  const uint8_t size = static_cast<uint8_t>(std::min<size_t>(strlen(name), 255));
+  return fwrite(&size, 1, 1, f) == 1 && fwrite(name, 1, size, f) == size;
+}
+
+struct TaskName {
+  uint32_t task;
+  const char* name;
+};
+
+std::vector<TaskName> ListTaskNames() {
+  std::vector<TaskName> names;
+#ifdef ESP_PLATFORM
+  std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks() + 4);
+  tasks.resize(uxTaskGetSystemState(tasks.data(), tasks.size(), nullptr));
+  for (const TaskStatus_t& t : tasks) {
+    names.push_back({static_cast<uint32_t>(reinterpret_cast<uintptr_t>(t.xHandle)), t.pcTaskName});
+  }
+#endif  // ESP_PLATFORM
+  return names;
+}
+
+}  // namespace
+
+esp_err_t DumpTrace(FILE* f) {
+  TraceRing& ring = TraceRing::Get();
+  const bool was_enabled = ring.enabled();
+  ring.set_enabled(false);
+#ifdef ESP_PLATFORM
+  vTaskDelay(1);  // let a record being written on the other core finish
+#endif  // ESP_PLATFORM
+
+  const std::vector<TaskName> task_names = ListTaskNames();
+  TraceFileHeader header{
+      .magic = {},
+      .version = kTraceVersion,
+      .record_size = sizeof(TraceRecord),
+      .num_records = ring.size(),
+      .num_event_names = kNumTraceEvents,
+      .num_task_names = static_cast<uint16_t>(task_names.size()),
+  };
+  memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (int i = 0; ok && i < kNumTraceEvents; i++) {
+    ok = WriteName(f, TraceEventName(static_cast<TraceEvent>(i)));
+  }
+  for (const TaskName& t : task_names) {
+    ok = ok && fwrite(&t.task, sizeof(t.task), 1, f) == 1 && WriteName(f, t.name);
+  }
+  ring.ForEachRecord([f, &ok](const TraceRecord& r) {
+    ok = ok && fwrite(&r, sizeof(r), 1, f) == 1;
+  });
+
+  ring.set_enabled(was_enabled);
+  return ok ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,205 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <pthread.h>
+#endif  // ESP_PLATFORM
+
+#include "common/macros.hpp"
+#include "common/platform.hpp"
+#include "common/times.hpp"
+
+// Binary event trace: a ring of fixed-size records per core, filled by the `TRACE_*` macros in
+// `common/macros.hpp` (compiled out unless `CONFIG_TRACE_ENABLED`), dumped to a file with
+// `DumpTrace`, and turned into Chrome trace JSON (chrome://tracing, Perfetto) on the host by
+// `host/trace_to_json.cpp`.
+
+#ifndef CONFIG_TRACE_RECORDS_PER_CORE
+#define CONFIG_TRACE_RECORDS_PER_CORE 1024
+#endif  // CONFIG_TRACE_RECORDS_PER_CORE
+
+/// What is being traced. Append only: the names are written into every dump, but old dumps are
+/// easier to compare if ids stay put.
+enum class TraceEvent : uint16_t {
+  kMark,            ///< ad-hoc
+  kConsoleCommand,  ///< one console command, from parsing to return
+  kIoWrite,         ///< see `io::IoOp::kWrite`
+  kIoSync,          ///< see `io::IoOp::kSync`
+  kCompressBlock,   ///< arg: uncompressed bytes
+  kSdMount,         ///< full mount of the card
+  kSdReinit,        ///< in-place recovery of the card
+};
+constexpr int kNumTraceEvents = 7;
+
+inline const char* TraceEventName(TraceEvent event) {
+  constexpr const char* kNames[kNumTraceEvents] = {
+      "mark",
+      "console",
+      "io_write",
+      "io_sync",
+      "compress",
+      "sd_mount",
+      "sd_reinit",
+  };
+  const int i = static_cast<int>(event);
+  return i < kNumTraceEvents ? kNames[i] : "?";
+}
+
+enum class TracePhase : uint8_t {
+  kBegin,
+  kEnd,
+  kInstant,
+};
+
+/// One traced event. Written as-is into dumps (little-endian on both ESP32 and x86 hosts).
+struct TraceRecord {
+  uint32_t t_us;  ///< `NowMonotonicUs()`, truncated (wraps every ~71 min)
+  uint16_t event;
+  uint8_t phase;
+  uint8_t core;
+  uint32_t task;  ///< low 32 bits of the FreeRTOS task handle (host: pthread id)
+  uint32_t arg;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is a file format");
+
+/// Dump layout: this header, then `num_event_names` names (u8 length + bytes, in `TraceEvent`
+/// order), then `num_task_names` of (u32 task, u8 length + bytes), then `num_records` records,
+/// each core's from oldest to newest.
+struct TraceFileHeader {
+  char magic[4];  ///< `kTraceMagic`
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t num_records;
+  uint16_t num_event_names;
+  uint16_t num_task_names;
+};
+static_assert(sizeof(TraceFileHeader) == 16, "TraceFileHeader is a file format");
+
+constexpr char kTraceMagic[4] = {'T', 'R', 'C', 'E'};
+constexpr uint16_t kTraceVersion = 1;
+
+/// Per-core trace rings.
+///
+/// Recording is lock-free and wait-free apart from the one atomic increment that claims a slot:
+/// a core only ever writes its own ring, so the increment is never contended across cores, and a
+/// task preempting another on the same core simply claims the next slot. Old records are
+/// overwritten. A record being written while the ring is read may be seen half-updated, which is
+/// why `DumpTrace` pauses recording.
+class TraceRing {
+ public:
+#ifdef ESP_PLATFORM
+  static constexpr int kMaxCores = portNUM_PROCESSORS;
+#else
+  static constexpr int kMaxCores = 1;
+#endif  // ESP_PLATFORM
+  static constexpr uint32_t kRecordsPerCore = CONFIG_TRACE_RECORDS_PER_CORE;
+  static_assert((kRecordsPerCore & (kRecordsPerCore - 1)) == 0, "must be a power of 2");
+
+  static TraceRing& Get() {
+    static TraceRing instance;
+    return instance;
+  }
+
+  void Record(TraceEvent event, TracePhase phase, uint32_t arg) {
+    if (!enabled_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const uint32_t t_us = static_cast<uint32_t>(NowMonotonicUs());
+    const int core = CurrentCore();
+    PerCore& c = per_core_[core];
+    const uint32_t i = c.head.fetch_add(1, std::memory_order_relaxed);
+    c.records[i & (kRecordsPerCore - 1)] = {
+        .t_us = t_us,
+        .event = static_cast<uint16_t>(event),
+        .phase = static_cast<uint8_t>(phase),
+        .core = static_cast<uint8_t>(core),
+        .task = CurrentTask(),
+        .arg = arg,
+    };
+  }
+
+  bool enabled() const { return enabled_.load(); }
+  void set_enabled(bool enabled) { enabled_.store(enabled); }
+
+  /// Drops all records.
+  void Clear() {
+    for (PerCore& c : per_core_) {
+      c.head.store(0);
+    }
+  }
+
+  /// \return records currently held, over all cores
+  uint32_t size() const {
+    uint32_t n = 0;
+    for (const PerCore& c : per_core_) {
+      n += std::min(c.head.load(), kRecordsPerCore);
+    }
+    return n;
+  }
+
+  /// Calls `f(const TraceRecord&)` for each record held, per core from oldest to newest.
+  template <typename F>
+  void ForEachRecord(F&& f) const {
+    for (const PerCore& c : per_core_) {
+      const uint32_t head = c.head.load();
+      for (uint32_t i = head > kRecordsPerCore ? head - kRecordsPerCore : 0; i < head; i++) {
+        f(c.records[i & (kRecordsPerCore - 1)]);
+      }
+    }
+  }
+
+ private:
+  struct PerCore {
+    std::atomic<uint32_t> head{0};  // total records ever claimed
+    TraceRecord records[kRecordsPerCore];
+  };
+
+  PerCore per_core_[kMaxCores];
+  std::atomic<bool> enabled_{true};
+
+  TraceRing() = default;
+
+  static int CurrentCore() {
+#ifdef ESP_PLATFORM
+    return xPortGetCoreID();
+#else
+    return 0;
+#endif  // ESP_PLATFORM
+  }
+
+  static uint32_t CurrentTask() {
+#ifdef ESP_PLATFORM
+    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(xTaskGetCurrentTaskHandle()));
+#else
+    return static_cast<uint32_t>(pthread_self());
+#endif  // ESP_PLATFORM
+  }
+};
+
+/// Records a begin/end pair around its lifetime. Use through `TRACE_SCOPE`.
+class TraceScope {
+ public:
+  TraceScope(TraceEvent event, uint32_t arg) : event_(event) {
+    TraceRing::Get().Record(event, TracePhase::kBegin, arg);
+  }
+  ~TraceScope() { TraceRing::Get().Record(event_, TracePhase::kEnd, 0); }
+
+  NOT_COPYABLE_NOR_MOVABLE(TraceScope)
+
+ private:
+  TraceEvent event_;
+};
+
+/// Writes everything in `TraceRing` to `f` in the dump layout described at `TraceFileHeader`,
+/// with the names of the tasks alive now. Recording is paused meanwhile.
+esp_err_t DumpTrace(FILE* f);
@@ -0,0 +1,265 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/async_file_writer.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/times.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+namespace {
+constexpr char TAG[] = "awriter";
+}  // namespace
+
+AsyncFileWriter::AsyncFileWriter(OwnedFile file, Option option)
+    : file_(std::move(file)),
+      option_(option),
+      free_(option.num_buffers),
+      full_(option.num_buffers),
+      barrier_done_(1) {}
+
+AsyncFileWriter::~AsyncFileWriter() {
+  if (!closed_ && writer_) {
+    (void)Close();
+  }
+}
+
+esp_err_t AsyncFileWriter::Setup() {
+  if (!file_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (option_.buffer_size <= 0 || option_.num_buffers < 1) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  // we only ever write whole buffers; stdio buffering would just add a copy
+  setvbuf(file_.get(), nullptr, _IONBF, 0);
+  // where the first buffer lands: in append mode that is the end of the file, not the position
+  const int fd = fileno(file_.get());
+  const int flags = fcntl(fd, F_GETFL);
+  struct stat s {};
+  if (flags >= 0 && (flags & O_APPEND) && fstat(fd, &s) == 0) {
+    base_offset_ = static_cast<uint64_t>(s.st_size);
+  } else if (const off_t pos = lseek(fd, 0, SEEK_CUR); pos > 0) {
+    base_offset_ = static_cast<uint64_t>(pos);
+  }
+
+  // whole buffers go straight from here to the card, so each starts DMA-aligned
+  const size_t stride = (option_.buffer_size + kSdSectorSize - 1) / kSdSectorSize * kSdSectorSize;
+  storage_ = DmaBuffer::Allocate(option_.num_buffers * stride);
+  if (!storage_) {
+    return ESP_ERR_NO_MEM;
+  }
+  buffers_ = std::make_unique<Buffer[]>(option_.num_buffers);
+  for (int i = 0; i < option_.num_buffers; i++) {
+    buffers_[i] = {
+        .data = storage_.data() + i * stride,
+        .size = 0,
+        .first_write_us = 0,
+        .barrier = false,
+        .close = false,
+    };
+    CHECK(free_.Push(&buffers_[i]));
+  }
+
+  last_sync_us_ = NowMonotonicUs();
+  auto writer = std::make_unique<LoopTask>([this]() { return WriterStep(); });
+  TRY(writer->Start("awriter", option_.stack_size, option_.priority, option_.cpu));
+  writer_ = std::move(writer);
+  return ESP_OK;
+}
+
+esp_err_t AsyncFileWriter::Write(const void* data, size_t size) {
+  if (closed_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  std::unique_lock<std::mutex> lock(current_mutex_);
+  while (size > 0) {
+    AcquireCurrent(lock);
+    if (current_->size == 0) {
+      current_->first_write_us = NowMonotonicUs();
+    }
+    const size_t n = std::min(size, static_cast<size_t>(option_.buffer_size - current_->size));
+    memcpy(current_->data + current_->size, p, n);
+    current_->size += n;
+    p += n;
+    size -= n;
+    if (current_->size == option_.buffer_size) {
+      CHECK(full_.Push(current_, /*timeout_ms*/ 0));  // never more buffers than queue slots
+      current_ = nullptr;
+    }
+  }
+  return error_.load();
+}
+
+esp_err_t AsyncFileWriter::Barrier() {
+  if (closed_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return SubmitBarrier(/*close*/ false);
+}
+
+esp_err_t AsyncFileWriter::Close() {
+  if (closed_ || !writer_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  closed_ = true;
+  (void)SubmitBarrier(/*close*/ true);
+  writer_->Stop();
+  if (fclose(file_.release()) != 0) {
+    SetError(ESP_FAIL);
+  }
+  return error_.load();
+}
+
+AsyncFileWriter::Stats AsyncFileWriter::GetStats() const {
+  return {
+      .bytes_written = bytes_written_.load(),
+      .buffers_written = buffers_written_.load(),
+      .age_flushes = age_flushes_.load(),
+      .barriers = barriers_.load(),
+      .syncs = syncs_.load(),
+      .producer_blocks = producer_block_hist_.count(),
+      .producer_block_us = static_cast<int64_t>(producer_block_hist_.sum()),
+  };
+}
+
+void AsyncFileWriter::AcquireCurrent(std::unique_lock<std::mutex>& lock) {
+  if (current_) {
+    return;
+  }
+  Buffer* buffer;
+  if (!free_.Pop(&buffer, /*timeout_ms*/ 0)) {
+    // all buffers are in flight: wait for the writer task without blocking it on our lock
+    lock.unlock();
+    const int64_t t0 = NowMonotonicUs();
+    free_.Pop(&buffer);
+    producer_block_hist_.Record(NowMonotonicUs() - t0);
+    lock.lock();
+  }
+  buffer->size = 0;
+  buffer->barrier = false;
+  buffer->close = false;
+  current_ = buffer;
+}
+
+esp_err_t AsyncFileWriter::SubmitBarrier(bool close) {
+  {
+    std::unique_lock<std::mutex> lock(current_mutex_);
+    AcquireCurrent(lock);
+    current_->barrier = true;
+    current_->close = close;
+    CHECK(full_.Push(current_, /*timeout_ms*/ 0));
+    current_ = nullptr;
+  }
+  esp_err_t err;
+  barrier_done_.Pop(&err);
+  return err;
+}
+
+int AsyncFileWriter::NextAgeCheckMs() {
+  if (option_.max_age_ms <= 0) {
+    return BoundedQueue<Buffer*>::kForever;
+  }
+  std::lock_guard<std::mutex> lock(current_mutex_);
+  if (!current_ || current_->size == 0) {
+    return option_.max_age_ms;
+  }
+  const int64_t age_us = NowMonotonicUs() - current_->first_write_us;
+  return std::max<int64_t>(0, option_.max_age_ms - age_us / 1000);
+}
+
+bool AsyncFileWriter::WriterStep() {
+  Buffer* buffer = nullptr;
+  if (!full_.Pop(&buffer, NextAgeCheckMs())) {
+    // nothing full in time: take the pending buffer if it has become too old --- unless a full
+    // buffer was queued meanwhile, which holds older data and must go first (the producer only
+    // queues under the lock, so this check cannot race with it)
+    std::lock_guard<std::mutex> lock(current_mutex_);
+    if (!full_.Pop(&buffer, /*timeout_ms*/ 0) && current_ && current_->size > 0 &&
+        NowMonotonicUs() - current_->first_write_us >= option_.max_age_ms * 1000) {
+      buffer = current_;
+      current_ = nullptr;
+      ++age_flushes_;
+    }
+  }
+  if (!buffer) {
+    return true;
+  }
+
+  WriteBuffer(buffer);
+  const Durability durability = option_.durability;
+  if (buffer->barrier) {
+    ++barriers_;
+    if (durability == Durability::kNone) {
+      if (fflush(file_.get()) != 0) {
+        SetError(ESP_FAIL);
+      }
+    } else {
+      Sync();
+    }
+  } else if (
+      durability == Durability::kEveryWrite ||
+      (durability == Durability::kInterval &&
+       NowMonotonicUs() - last_sync_us_ >= option_.sync_interval_ms * int64_t{1000})) {
+    Sync();
+  }
+
+  const bool barrier = buffer->barrier;
+  const bool close = buffer->close;
+  free_.Push(buffer);
+  if (barrier) {
+    barrier_done_.Push(error_.load());
+  }
+  return !close;
+}
+
+void AsyncFileWriter::WriteBuffer(Buffer* buffer) {
+  if (buffer->size == 0 || error_.load() != ESP_OK) {
+    return;  // after an error keep draining so that producers never block forever
+  }
+  const int64_t t0 = NowMonotonicUs();
+  const size_t written = fwrite(buffer->data, 1, buffer->size, file_.get());
+  const uint32_t latency_us = NowMonotonicUs() - t0;
+  write_latency_hist_.Record(latency_us);
+  IoStats::Get().Record(IoOp::kWrite, latency_us);
+  // unbuffered, so this was one `write` at the end of what this writer had written
+  DmaStats::Get().RecordTransfer(buffer->data, written, base_offset_ + bytes_written_.load());
+  bytes_written_ += written;
+  ++buffers_written_;
+  if (written != static_cast<size_t>(buffer->size)) {
+    ESP_LOGE(TAG, "fwrite(%d) => %d", buffer->size, static_cast<int>(written));
+    SetError(ESP_FAIL);
+  }
+}
+
+void AsyncFileWriter::Sync() {
+  if (error_.load() != ESP_OK) {
+    return;
+  }
+  const int64_t t0 = NowMonotonicUs();
+  if (const esp_err_t err = FlushAndSync(file_.get()); err != ESP_OK) {
+    ESP_LOGE(TAG, "FlushAndSync => %s", esp_err_to_name(err));
+    SetError(err);
+  }
+  last_sync_us_ = NowMonotonicUs();
+  sync_latency_hist_.Record(last_sync_us_ - t0);
+  ++syncs_;
+}
+
+void AsyncFileWriter::SetError(esp_err_t err) {
+  esp_err_t expected = ESP_OK;
+  error_.compare_exchange_strong(expected, err);
+}
+
+}  // namespace io
@@ -0,0 +1,160 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "common/bounded_queue.hpp"
+#include "common/histogram.hpp"
+#include "common/loop_task.hpp"
+#include "common/macros.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+
+namespace io {
+
+/// Appends to a file from a dedicated writer task, so that producers never wait on the SD card
+/// (which routinely stalls for tens to hundreds of ms during its internal garbage collection).
+///
+/// Producers copy into one of `Option::num_buffers` buffers allocated at creation, and only block
+/// if all of them are waiting to be written. The writer task writes a buffer out when:
+/// - it is full;
+/// - its first byte is older than `Option::max_age_ms` (the writer waits only for the remaining
+///   age, so data is written ~`max_age_ms` after it was appended, plus the time taken by any
+///   buffers queued ahead of it);
+/// - `Barrier` is called.
+///
+/// When to `fsync` (i.e. `FlushAndSync`) is decided by `Option::durability`.
+///
+/// `Write` and `Barrier` must be called from one task at a time.
+///
+/// \example
+/// \code{.cpp}
+/// auto writer = io::AsyncFileWriter::Create(io::OpenFile("/s/log.txt", "a"), {
+///     .durability = io::AsyncFileWriter::Durability::kInterval,
+/// });
+/// writer->Write(line.data(), line.size());  // returns as soon as the line is copied
+/// writer->Barrier();                        // everything so far is on the card
+/// \endcode
+class AsyncFileWriter {
+ public:
+  enum class Durability {
+    kNone,        ///< never `fsync`; `Barrier` only flushes to FATFS
+    kOnBarrier,   ///< `fsync` on `Barrier` and `Close`
+    kInterval,    ///< like `kOnBarrier`, and also at most every `sync_interval_ms` while writing
+    kEveryWrite,  ///< `fsync` after every buffer (safest and slowest)
+  };
+
+  struct Option {
+    int buffer_size = 8 * 1024;
+    int num_buffers = 4;
+    int max_age_ms = 500;  ///< 0 => only write full buffers (and on `Barrier`)
+    Durability durability = Durability::kOnBarrier;
+    int sync_interval_ms = 5000;  ///< for `Durability::kInterval`
+
+    // Device only
+    int cpu = 0;  ///< `PRO_CPU_NUM`
+    int priority = 3;
+    int stack_size = 4096;
+  };
+
+  struct Stats {
+    uint64_t bytes_written = 0;
+    uint32_t buffers_written = 0;
+    uint32_t age_flushes = 0;  ///< partial buffers written because of `max_age_ms`
+    uint32_t barriers = 0;
+    uint32_t syncs = 0;
+    uint32_t producer_blocks = 0;  ///< times a producer had to wait for a free buffer
+    int64_t producer_block_us = 0;
+  };
+
+  DEFINE_CREATE(AsyncFileWriter)
+  ~AsyncFileWriter();
+
+  /// Copies `size` bytes into the pending buffer, handing full buffers to the writer task.
+  ///
+  /// \return the first error the writer task has run into (data is dropped after an error)
+  esp_err_t Write(const void* data, size_t size);
+
+  /// Hands the pending data to the writer task and waits until it has been written (and synced,
+  /// unless `Durability::kNone`).
+  esp_err_t Barrier();
+
+  /// `Barrier`, then stops the writer task and closes the file.
+  esp_err_t Close();
+
+  /// \return the first error the writer task has run into
+  esp_err_t error() const { return error_.load(); }
+
+  Stats GetStats() const;
+
+  /// Time producers spent waiting for a free buffer, per blocking `Write`/`Barrier` (us).
+  const LatencyHistogram& producer_block_hist() const { return producer_block_hist_; }
+  /// Time spent in `fwrite` per buffer (us).
+  const LatencyHistogram& write_latency_hist() const { return write_latency_hist_; }
+  /// Time spent in `fsync` (us).
+  const LatencyHistogram& sync_latency_hist() const { return sync_latency_hist_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(AsyncFileWriter)
+
+ private:
+  struct Buffer {
+    uint8_t* data;
+    int size;
+    int64_t first_write_us;  // monotonic
+    bool barrier;            // writer acknowledges through `barrier_done_` once written
+    bool close;              // writer stops after this buffer
+  };
+
+  OwnedFile file_;
+  Option option_;
+
+  DmaBuffer storage_;  // buffers start at sector boundaries within
+  std::unique_ptr<Buffer[]> buffers_;
+  BoundedQueue<Buffer*> free_;
+  BoundedQueue<Buffer*> full_;
+  BoundedQueue<esp_err_t> barrier_done_;
+
+  std::mutex current_mutex_;  // `current_` is also taken by the writer task when it gets too old
+  Buffer* current_ = nullptr;
+
+  std::atomic<esp_err_t> error_{ESP_OK};
+  bool closed_ = false;
+  int64_t last_sync_us_ = 0;  // writer task only
+  uint64_t base_offset_ = 0;  // file offset of the first byte written
+
+  std::atomic<uint64_t> bytes_written_{0};
+  std::atomic<uint32_t> buffers_written_{0};
+  std::atomic<uint32_t> age_flushes_{0};
+  std::atomic<uint32_t> barriers_{0};
+  std::atomic<uint32_t> syncs_{0};
+  LatencyHistogram producer_block_hist_;
+  LatencyHistogram write_latency_hist_;
+  LatencyHistogram sync_latency_hist_;
+
+  std::unique_ptr<LoopTask> writer_;
+
+  AsyncFileWriter(OwnedFile file, Option option);
+  esp_err_t Setup();
+
+  /// Makes sure `current_` points to a buffer, waiting for one to be freed if necessary.
+  /// Must be called with `lock` held; may release it while waiting.
+  void AcquireCurrent(std::unique_lock<std::mutex>& lock);
+  /// Hands a buffer over to the writer task and waits for it to be written.
+  esp_err_t SubmitBarrier(bool close);
+
+  /// One iteration of the writer task. \return false once the closing buffer has been written.
+  bool WriterStep();
+  /// \return how long the writer task may sleep before the pending buffer gets too old
+  int NextAgeCheckMs();
+  void WriteBuffer(Buffer* buffer);
+  void Sync();
+  void SetError(esp_err_t err);
+};
+
+}  // namespace io
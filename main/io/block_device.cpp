@@ -0,0 +1,125 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/block_device.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstring>
+
+#include "io/dma_buffer.hpp"
+#ifdef ESP_PLATFORM
+#include "io/fs_utils.hpp"
+#endif  // ESP_PLATFORM
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "block_device";
+
+}  // namespace
+
+FileBlockDevice::FileBlockDevice(std::string path, bool writable, uint32_t num_sectors)
+    : path_(std::move(path)), writable_(writable), num_sectors_(num_sectors) {}
+
+FileBlockDevice::~FileBlockDevice() {
+  if (fd_ >= 0) {
+    (void)close(fd_);
+  }
+}
+
+esp_err_t FileBlockDevice::Setup() {
+  const int flags = writable_ ? (O_RDWR | (num_sectors_ ? O_CREAT : 0)) : O_RDONLY;
+  fd_ = open(path_.c_str(), flags, 0666);
+  if (fd_ < 0) {
+    ESP_LOGE(TAG, "open(%s) => %s", path_.c_str(), strerror(errno));
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (num_sectors_) {
+    if (!writable_ || ftruncate(fd_, static_cast<off_t>(num_sectors_) * kSdSectorSize) != 0) {
+      ESP_LOGE(TAG, "cannot resize %s to %u sectors", path_.c_str(), unsigned(num_sectors_));
+      return ESP_FAIL;
+    }
+    return ESP_OK;
+  }
+  struct stat s {};
+  if (fstat(fd_, &s) != 0) {
+    return ESP_FAIL;
+  }
+  num_sectors_ = static_cast<uint32_t>(s.st_size / kSdSectorSize);
+  return ESP_OK;
+}
+
+esp_err_t FileBlockDevice::ReadSectors(void* data, uint32_t sector, uint32_t count) {
+  if (uint64_t{sector} + count > num_sectors_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const size_t size = size_t{count} * kSdSectorSize;
+  const ssize_t n = pread(fd_, data, size, static_cast<off_t>(sector) * kSdSectorSize);
+  if (n > 0) {
+    DmaStats::Get().RecordTransfer(data, n, uint64_t{sector} * kSdSectorSize);
+  }
+  if (n != static_cast<ssize_t>(size)) {
+    ESP_LOGE(
+        TAG, "pread(%s, %u+%u) => %d", path_.c_str(), unsigned(sector), unsigned(count), int(n));
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t FileBlockDevice::WriteSectors(const void* data, uint32_t sector, uint32_t count) {
+  if (uint64_t{sector} + count > num_sectors_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const size_t size = size_t{count} * kSdSectorSize;
+  const ssize_t n = pwrite(fd_, data, size, static_cast<off_t>(sector) * kSdSectorSize);
+  if (n > 0) {
+    DmaStats::Get().RecordTransfer(data, n, uint64_t{sector} * kSdSectorSize);
+  }
+  if (n != static_cast<ssize_t>(size)) {
+    ESP_LOGE(
+        TAG, "pwrite(%s, %u+%u) => %d", path_.c_str(), unsigned(sector), unsigned(count), int(n));
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+#ifdef ESP_PLATFORM
+
+esp_err_t SdmmcBlockDevice::ReadSectors(void* data, uint32_t sector, uint32_t count) {
+  if (uint64_t{sector} + count > num_sectors_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  FatVolumeLock lock(volume_);
+  if (!lock.locked()) {
+    return ESP_ERR_TIMEOUT;
+  }
+  TRY(sdmmc_read_sectors(card_, data, first_sector_ + sector, count));
+  DmaStats::Get().RecordTransfer(
+      data, size_t{count} * kSdSectorSize, uint64_t{first_sector_ + sector} * kSdSectorSize);
+  return ESP_OK;
+}
+
+esp_err_t SdmmcBlockDevice::WriteSectors(const void* data, uint32_t sector, uint32_t count) {
+  if (uint64_t{sector} + count > num_sectors_) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  FatVolumeLock lock(volume_);
+  if (!lock.locked()) {
+    return ESP_ERR_TIMEOUT;
+  }
+  TRY(sdmmc_write_sectors(card_, data, first_sector_ + sector, count));
+  DmaStats::Get().RecordTransfer(
+      data, size_t{count} * kSdSectorSize, uint64_t{first_sector_ + sector} * kSdSectorSize);
+  return ESP_OK;
+}
+
+#endif  // ESP_PLATFORM
+
+}  // namespace io
@@ -0,0 +1,90 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "common/macros.hpp"
+#include "io/file.hpp"
+
+#ifdef ESP_PLATFORM
+#include "ff.h"
+#include "sdmmc_cmd.h"
+#endif  // ESP_PLATFORM
+
+namespace io {
+
+/// A range of `kSdSectorSize`-byte sectors that can be read and written in whole sectors, addressed
+/// from 0. Used for I/O that bypasses the file system (see `RawRingLog`).
+class BlockDevice {
+ public:
+  virtual ~BlockDevice() = default;
+
+  /// \param sector  first sector, relative to the start of the device
+  virtual esp_err_t ReadSectors(void* data, uint32_t sector, uint32_t count) = 0;
+  /// \param sector  first sector, relative to the start of the device
+  virtual esp_err_t WriteSectors(const void* data, uint32_t sector, uint32_t count) = 0;
+
+  virtual uint32_t num_sectors() const = 0;
+};
+
+/// `BlockDevice` backed by a regular file (or a device node, e.g. an SD card image or a card
+/// reader on a PC), through `pread`/`pwrite` (VFS on ESP-IDF).
+class FileBlockDevice : public BlockDevice {
+ public:
+  DEFINE_CREATE(FileBlockDevice)
+  ~FileBlockDevice() override;
+
+  esp_err_t ReadSectors(void* data, uint32_t sector, uint32_t count) override;
+  esp_err_t WriteSectors(const void* data, uint32_t sector, uint32_t count) override;
+  uint32_t num_sectors() const override { return num_sectors_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(FileBlockDevice)
+
+ private:
+  std::string path_;
+  bool writable_;
+  int fd_ = -1;
+  uint32_t num_sectors_ = 0;
+
+  /// \param path         file to use; its size (rounded down to whole sectors) is the device size
+  /// \param writable     open for writing as well
+  /// \param num_sectors  if not 0, create or resize the file to this many sectors
+  FileBlockDevice(std::string path, bool writable, uint32_t num_sectors = 0);
+  esp_err_t Setup();
+};
+
+#ifdef ESP_PLATFORM
+
+/// `BlockDevice` on a range of sectors of an SD card, through multi-sector `sdmmc` transfers.
+/// Buffers should be DMA-capable (see `DmaBuffer`); otherwise the driver bounces them one sector at
+/// a time, which shows up in `DmaStats`.
+///
+/// Every transfer holds the FATFS volume lock of the card (see `FatVolumeLock`), so that it never
+/// overlaps with `SdCardDaemon` re-initializing the card.
+class SdmmcBlockDevice : public BlockDevice {
+ public:
+  /// \param first_sector  absolute sector on the card where the device starts
+  /// \param volume        FATFS volume on the card (`SdCardDaemon::fatfs`)
+  SdmmcBlockDevice(sdmmc_card_t* card, FATFS* volume, uint32_t first_sector, uint32_t num_sectors)
+      : card_(card), volume_(volume), first_sector_(first_sector), num_sectors_(num_sectors) {}
+
+  esp_err_t ReadSectors(void* data, uint32_t sector, uint32_t count) override;
+  esp_err_t WriteSectors(const void* data, uint32_t sector, uint32_t count) override;
+  uint32_t num_sectors() const override { return num_sectors_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(SdmmcBlockDevice)
+
+ private:
+  sdmmc_card_t* card_;
+  FATFS* volume_;
+  uint32_t first_sector_;
+  uint32_t num_sectors_;
+};
+
+#endif  // ESP_PLATFORM
+
+}  // namespace io
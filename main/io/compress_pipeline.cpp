@@ -0,0 +1,342 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/compress_pipeline.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/crc32.hpp"
+#include "common/times.hpp"
+#include "io/compressed_file.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "zpipe";
+
+void UpdateMax(std::atomic<int>& max, int value) {
+  int prev = max.load(std::memory_order_relaxed);
+  while (value > prev && !max.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+CompressPipeline::StageStats CompressPipeline::AtomicStageStats::Load() const {
+  return {
+      .blocks = blocks.load(std::memory_order_relaxed),
+      .bytes_in = bytes_in.load(std::memory_order_relaxed),
+      .bytes_out = bytes_out.load(std::memory_order_relaxed),
+      .busy_us = busy_us.load(std::memory_order_relaxed),
+      .wait_us = wait_us.load(std::memory_order_relaxed),
+  };
+}
+
+CompressPipeline::CompressPipeline(OwnedFile file, Option option)
+    : file_(std::move(file)),
+      option_(option),
+      raw_free_(option.num_raw_buffers),
+      raw_full_(option.num_raw_buffers + 1),  // + end of stream
+      out_free_(option.num_out_buffers),
+      out_full_(option.num_out_buffers),
+      done_(1) {}
+
+CompressPipeline::~CompressPipeline() {
+  if (!closed_ && compressor_) {
+    (void)Close();
+  }
+}
+
+esp_err_t CompressPipeline::Setup() {
+  if (!file_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (option_.block_size <= 0 || option_.block_size > LzCodec::kMaxBlockSize ||
+      option_.num_raw_buffers < 1 || option_.num_out_buffers < 1) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!LzCodec::IsValidParams(option_.window_log, option_.hash_log)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  codec_.emplace(option_.window_log, option_.hash_log);
+  const int num_raw = option_.num_raw_buffers;
+  const int num_out = option_.num_out_buffers;
+  const int out_size = kBlockHeaderSize + option_.block_size;
+  const int out_stride = (out_size + kSdSectorSize - 1) / kSdSectorSize * kSdSectorSize;
+  raw_storage_ = std::make_unique<uint8_t[]>(num_raw * option_.block_size);
+  out_storage_ = DmaBuffer::Allocate(num_out * out_stride);
+  if (!out_storage_) {
+    return ESP_ERR_NO_MEM;
+  }
+  slots_ = std::make_unique<Slot[]>(num_raw + num_out);
+  for (int i = 0; i < num_raw + num_out; i++) {
+    const bool is_raw = i < num_raw;
+    slots_[i] = {
+        .data = is_raw ? &raw_storage_[i * option_.block_size]
+                       : &out_storage_[(i - num_raw) * out_stride],
+        .size = 0,
+        .raw_size = 0,
+        .timestamp_us = 0,
+        .crc32 = 0,
+    };
+    CHECK((is_raw ? raw_free_ : out_free_).Push(&slots_[i]));
+  }
+  if (!option_.index_spool_path.empty()) {
+    index_spool_ = OpenFile(option_.index_spool_path, "w+b");
+    if (!index_spool_) {
+      ESP_LOGE(TAG, "cannot open index spool: %s", option_.index_spool_path.c_str());
+      return ESP_ERR_NOT_FOUND;
+    }
+  }
+
+  uint8_t header[kCompressedFileHeaderSize];
+  EncodeFileHeader(
+      option_.window_log,
+      index_spool_ ? kCompressedFileFlagIndexed : 0,
+      option_.block_size,
+      header);
+  TRY(WriteOut(header, sizeof(header)));
+
+  // only keep the stages once both are running, so that a failed `Setup` has nothing to drain
+  auto writer = std::make_unique<LoopTask>([this]() { return WriterStep(); });
+  auto compressor = std::make_unique<LoopTask>([this]() { return CompressorStep(); });
+  TRY(writer->Start("zpipe_w", option_.stack_size, option_.priority, option_.writer_cpu));
+  TRY(compressor->Start(
+      "zpipe_c", option_.stack_size, option_.priority, option_.compressor_cpu));
+  writer_ = std::move(writer);
+  compressor_ = std::move(compressor);
+  return ESP_OK;
+}
+
+esp_err_t CompressPipeline::Write(const void* data, size_t size) {
+  if (closed_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const int64_t t_begin = NowMonotonicUs();
+  int64_t wait_us = 0;
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  producer_stats_.bytes_in += size;
+  while (size > 0) {
+    if (!current_) {
+      const int64_t t0 = NowMonotonicUs();
+      raw_free_.Pop(&current_);
+      wait_us += NowMonotonicUs() - t0;
+      current_->size = 0;
+      current_->timestamp_us = NowUnixUs();
+    }
+    const size_t n = std::min(size, static_cast<size_t>(option_.block_size - current_->size));
+    memcpy(current_->data + current_->size, p, n);
+    current_->size += n;
+    p += n;
+    size -= n;
+    if (current_->size == option_.block_size) {
+      SubmitCurrent();
+    }
+  }
+  producer_stats_.wait_us += wait_us;
+  producer_stats_.busy_us += NowMonotonicUs() - t_begin - wait_us;
+  return error_.load();
+}
+
+esp_err_t CompressPipeline::Flush() {
+  if (closed_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (current_ && current_->size > 0) {
+    SubmitCurrent();
+  }
+  return error_.load();
+}
+
+esp_err_t CompressPipeline::Close() {
+  if (closed_ || !compressor_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  // errors are reported below, after the pipeline has been drained
+  (void)Flush();
+  closed_ = true;
+  if (!current_) {
+    raw_free_.Pop(&current_);
+  }
+  current_->size = 0;  // end of stream
+  SubmitCurrent();
+
+  esp_err_t writer_err;
+  done_.Pop(&writer_err);
+  compressor_->Stop();
+  writer_->Stop();
+  if (fclose(file_.release()) != 0) {
+    SetError(ESP_FAIL);
+  }
+  return error_.load();
+}
+
+CompressPipeline::Stats CompressPipeline::GetStats() const {
+  return {
+      .producer = producer_stats_.Load(),
+      .compressor = compressor_stats_.Load(),
+      .writer = writer_stats_.Load(),
+      .raw_queue_depth = raw_full_.size(),
+      .raw_queue_max_depth = raw_queue_max_depth_.load(),
+      .out_queue_depth = out_full_.size(),
+      .out_queue_max_depth = out_queue_max_depth_.load(),
+  };
+}
+
+void CompressPipeline::SubmitCurrent() {
+  if (current_->size > 0) {
+    ++producer_stats_.blocks;
+  }
+  raw_full_.Push(current_);
+  UpdateMax(raw_queue_max_depth_, raw_full_.size());
+  current_ = nullptr;
+}
+
+bool CompressPipeline::CompressorStep() {
+  const int64_t t0 = NowMonotonicUs();
+  Slot* raw;
+  Slot* out;
+  raw_full_.Pop(&raw);
+  out_free_.Pop(&out);
+  const int64_t t1 = NowMonotonicUs();
+
+  const bool end_of_stream = raw->size == 0;
+  if (end_of_stream) {
+    out->size = 0;
+  } else {
+    TRACE_SCOPE(kCompressBlock, raw->size);
+    out->size = EncodeBlock(&*codec_, raw->data, raw->size, out->data);
+    out->raw_size = raw->size;
+    out->timestamp_us = raw->timestamp_us;
+    if (!option_.index_spool_path.empty()) {
+      // on this core rather than the writer's, which may be stalled on the card
+      out->crc32 = Crc32(0, out->data + kBlockHeaderSize, out->size - kBlockHeaderSize);
+    }
+    ++compressor_stats_.blocks;
+    compressor_stats_.bytes_in += raw->size;
+    compressor_stats_.bytes_out += out->size;
+  }
+  const int64_t t2 = NowMonotonicUs();
+  raw_free_.Push(raw);
+  out_full_.Push(out);
+  UpdateMax(out_queue_max_depth_, out_full_.size());
+
+  compressor_stats_.wait_us += t1 - t0;
+  compressor_stats_.busy_us += t2 - t1;
+  return !end_of_stream;
+}
+
+bool CompressPipeline::WriterStep() {
+  const int64_t t0 = NowMonotonicUs();
+  Slot* out;
+  out_full_.Pop(&out);
+  const int64_t t1 = NowMonotonicUs();
+
+  const bool end_of_stream = out->size == 0;
+  if (end_of_stream) {
+    const uint8_t end_marker[kBlockHeaderSize] = {};
+    out->size = sizeof(end_marker);
+    memcpy(out->data, end_marker, sizeof(end_marker));
+  }
+  // after an error keep draining so that the other stages never block forever
+  if (error_.load() == ESP_OK) {
+    esp_err_t err = ESP_OK;
+    if (index_spool_ && !end_of_stream) {
+      err = AddIndexEntry(*out);
+    }
+    if (err == ESP_OK) {
+      err = WriteOut(out->data, out->size);
+    }
+    if (err == ESP_OK && end_of_stream && index_spool_) {
+      // the end marker is out; the slot is free to copy the index through
+      err = WriteIndex(out->data, kBlockHeaderSize + option_.block_size);
+    }
+    if (err == ESP_OK && end_of_stream && fflush(file_.get()) != 0) {
+      err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+      SetError(err);
+    }
+  }
+  ++writer_stats_.blocks;
+  writer_stats_.bytes_in += out->size;
+  const int64_t t2 = NowMonotonicUs();
+  out_free_.Push(out);
+
+  writer_stats_.wait_us += t1 - t0;
+  writer_stats_.busy_us += t2 - t1;
+  if (end_of_stream) {
+    done_.Push(error_.load());
+  }
+  return !end_of_stream;
+}
+
+esp_err_t CompressPipeline::WriteOut(const void* data, size_t size) {
+  size_t written;
+  {
+    ScopedIoTimer timer(IoOp::kWrite);
+    written = fwrite(data, 1, size, file_.get());
+  }
+  if (written != size) {
+    ESP_LOGE(TAG, "fwrite(%d) fail", static_cast<int>(size));
+    return ESP_FAIL;
+  }
+  writer_stats_.bytes_out += size;
+  return ESP_OK;
+}
+
+esp_err_t CompressPipeline::AddIndexEntry(const Slot& out) {
+  uint8_t entry[kIndexEntrySize];
+  EncodeIndexEntry(
+      raw_written_bytes_,
+      writer_stats_.bytes_out.load(),  // the block header is about to be written here
+      out.timestamp_us,
+      out.raw_size,
+      out.crc32,
+      entry);
+  if (fwrite(entry, sizeof(entry), 1, index_spool_.get()) != 1) {
+    ESP_LOGE(TAG, "index spool write fail");
+    return ESP_FAIL;
+  }
+  raw_written_bytes_ += out.raw_size;
+  ++num_index_entries_;
+  return ESP_OK;
+}
+
+esp_err_t CompressPipeline::WriteIndex(uint8_t* buf, size_t capacity) {
+  const uint64_t index_offset = writer_stats_.bytes_out.load();
+  FILE* const spool = index_spool_.get();
+  if (fflush(spool) != 0 || fseek(spool, 0, SEEK_SET) != 0) {
+    return ESP_FAIL;
+  }
+  while (true) {
+    const size_t n = fread(buf, 1, capacity, spool);
+    if (n > 0) {
+      TRY(WriteOut(buf, n));
+    }
+    if (n < capacity) {
+      break;
+    }
+  }
+  if (ferror(spool)) {
+    return ESP_FAIL;
+  }
+  uint8_t footer[kIndexFooterSize];
+  EncodeIndexFooter(index_offset, raw_written_bytes_, num_index_entries_, footer);
+  TRY(WriteOut(footer, sizeof(footer)));
+  index_spool_.reset();
+  if (remove(option_.index_spool_path.c_str()) != 0) {
+    ESP_LOGW(TAG, "cannot remove index spool: %s", option_.index_spool_path.c_str());
+  }
+  return ESP_OK;
+}
+
+void CompressPipeline::SetError(esp_err_t err) {
+  esp_err_t expected = ESP_OK;
+  error_.compare_exchange_strong(expected, err);
+}
+
+}  // namespace io
@@ -0,0 +1,162 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "common/bounded_queue.hpp"
+#include "common/loop_task.hpp"
+#include "common/macros.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+#include "io/lz_codec.hpp"
+
+namespace io {
+
+/// Two-stage compress-then-write pipeline producing the same stream format as
+/// `CompressedFileWriter`, optionally with the trailing block index:
+///
+///     producer --(raw blocks)--> compressor stage --(compressed blocks)--> writer stage --> file
+///
+/// On device the compressor and writer stages are `Task`s pinned to different cores, so an SD write
+/// stall does not hold up compression and both cores stay busy; on host they are plain threads.
+/// Blocks are handed over through `BoundedQueue`s of buffers allocated once at creation; nothing is
+/// allocated per block.
+///
+/// `Write` is meant to be called from a single producer thread.
+class CompressPipeline {
+ public:
+  struct Option {
+    int block_size = 16 * 1024;  ///< uncompressed bytes per block; at most `kMaxBlockSize`
+    int window_log = 12;
+    int hash_log = 12;
+    int num_raw_buffers = 3;  ///< blocks being filled / waiting for the compressor
+    int num_out_buffers = 3;  ///< compressed blocks waiting for the writer
+    /// If not empty, the stream gets a trailing block index, spooled to this scratch file by the
+    /// writer stage (see `CompressedFileWriter::Option::index_spool_path`).
+    std::string index_spool_path;
+
+    // Device only
+    int compressor_cpu = 1;  ///< `APP_CPU_NUM`
+    int writer_cpu = 0;      ///< `PRO_CPU_NUM`
+    int priority = 3;
+    int stack_size = 4096;
+  };
+
+  struct StageStats {
+    uint64_t blocks = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    int64_t busy_us = 0;  ///< time spent doing work
+    int64_t wait_us = 0;  ///< time spent blocked on a queue
+
+    double mbps() const { return busy_us ? double(bytes_in) / busy_us : 0; }
+  };
+
+  struct Stats {
+    StageStats producer;
+    StageStats compressor;
+    StageStats writer;
+    int raw_queue_depth = 0;
+    int raw_queue_max_depth = 0;
+    int out_queue_depth = 0;
+    int out_queue_max_depth = 0;
+  };
+
+  DEFINE_CREATE(CompressPipeline)
+  ~CompressPipeline();
+
+  /// Appends bytes to the stream. Blocks only if every raw buffer is in flight.
+  esp_err_t Write(const void* data, size_t size);
+
+  /// Hands the pending partial block (if any) to the compressor. Does not wait for it to be
+  /// written.
+  esp_err_t Flush();
+
+  /// Drains the pipeline, writes the end marker, stops both stages and closes the file.
+  ///
+  /// \return the first error encountered by any stage
+  esp_err_t Close();
+
+  Stats GetStats() const;
+
+  NOT_COPYABLE_NOR_MOVABLE(CompressPipeline)
+
+ private:
+  /// A pre-allocated buffer travelling through the pipeline. `size == 0` marks end of stream.
+  struct Slot {
+    uint8_t* data;
+    int size;
+    // carried from the raw slot to the out slot of a block, for its index entry
+    int raw_size;
+    int64_t timestamp_us;  ///< Unix time when the first byte of the block was written
+    uint32_t crc32;        ///< of the stored payload; only computed if indexed
+  };
+
+  struct AtomicStageStats {
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<int64_t> busy_us{0};
+    std::atomic<int64_t> wait_us{0};
+
+    StageStats Load() const;
+  };
+
+  OwnedFile file_;
+  Option option_;
+  std::optional<LzCodec> codec_;  // constructed by `Setup`; only touched by the compressor stage
+
+  std::unique_ptr<uint8_t[]> raw_storage_;
+  DmaBuffer out_storage_;  // written straight from; each slot starts at a sector boundary
+  std::unique_ptr<Slot[]> slots_;  // raw slots, then out slots
+
+  BoundedQueue<Slot*> raw_free_;
+  BoundedQueue<Slot*> raw_full_;
+  BoundedQueue<Slot*> out_free_;
+  BoundedQueue<Slot*> out_full_;
+  BoundedQueue<esp_err_t> done_;  // writer reports completion here
+
+  Slot* current_ = nullptr;  // raw slot being filled by the producer
+  std::atomic<esp_err_t> error_{ESP_OK};
+  bool closed_ = false;
+
+  AtomicStageStats producer_stats_;
+  AtomicStageStats compressor_stats_;
+  AtomicStageStats writer_stats_;
+  std::atomic<int> raw_queue_max_depth_{0};
+  std::atomic<int> out_queue_max_depth_{0};
+
+  // index state; only touched by the writer stage once running
+  OwnedFile index_spool_{nullptr, fclose};
+  uint64_t raw_written_bytes_ = 0;
+  uint32_t num_index_entries_ = 0;
+
+  std::unique_ptr<LoopTask> compressor_;
+  std::unique_ptr<LoopTask> writer_;
+
+  CompressPipeline(OwnedFile file, Option option);
+  esp_err_t Setup();
+
+  /// One iteration of each stage. \return false once the end of stream has passed through.
+  bool CompressorStep();
+  bool WriterStep();
+
+  /// Hands `current_` to the compressor.
+  void SubmitCurrent();
+  /// Appends to the file, accounting the bytes to the writer stage.
+  esp_err_t WriteOut(const void* data, size_t size);
+  esp_err_t AddIndexEntry(const Slot& out);
+  /// Appends the spooled index and the footer, using `buf` (`capacity` bytes) for copying.
+  esp_err_t WriteIndex(uint8_t* buf, size_t capacity);
+  void SetError(esp_err_t err);
+};
+
+}  // namespace io
@@ -0,0 +1,359 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/compressed_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/crc32.hpp"
+#include "common/times.hpp"
+#include "common/utils.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+namespace {
+constexpr char TAG[] = "lzb";
+}  // namespace
+
+void EncodeFileHeader(int window_log, uint8_t flags, int block_size, uint8_t* out) {
+  const uint8_t header[kCompressedFileHeaderSize] = {
+      kCompressedFileMagic[0],
+      kCompressedFileMagic[1],
+      kCompressedFileMagic[2],
+      kCompressedFileMagic[3],
+      kCompressedFileVersion,
+      static_cast<uint8_t>(window_log),
+      flags,
+      0,
+      UINT32_LE_BYTES(static_cast<uint32_t>(block_size)),
+  };
+  memcpy(out, header, sizeof(header));
+}
+
+void EncodeIndexEntry(
+    uint64_t raw_offset,
+    uint64_t file_offset,
+    int64_t timestamp_us,
+    int raw_size,
+    uint32_t crc32,
+    uint8_t* out) {
+  const uint8_t entry[kIndexEntrySize] = {
+      UINT64_LE_BYTES(raw_offset),
+      UINT64_LE_BYTES(file_offset),
+      UINT64_LE_BYTES(static_cast<uint64_t>(timestamp_us)),
+      UINT32_LE_BYTES(static_cast<uint32_t>(raw_size)),
+      UINT32_LE_BYTES(crc32),
+  };
+  memcpy(out, entry, sizeof(entry));
+}
+
+void EncodeIndexFooter(
+    uint64_t index_offset,
+    uint64_t total_raw_size,
+    uint32_t num_entries,
+    uint8_t* out) {
+  const uint8_t footer[kIndexFooterSize] = {
+      UINT64_LE_BYTES(index_offset),
+      UINT64_LE_BYTES(total_raw_size),
+      UINT32_LE_BYTES(num_entries),
+      kIndexFooterMagic[0],
+      kIndexFooterMagic[1],
+      kIndexFooterMagic[2],
+      kIndexFooterMagic[3],
+  };
+  memcpy(out, footer, sizeof(footer));
+}
+
+int EncodeBlock(LzCodec* codec, const uint8_t* raw, int raw_size, uint8_t* out) {
+  uint8_t* const payload = out + kBlockHeaderSize;
+  // Only accept output strictly smaller than the input; otherwise store the block as-is.
+  const int compressed_size = codec->Compress(raw, raw_size, payload, raw_size - 1);
+  const bool stored_raw = compressed_size < 0;
+  const uint32_t stored_size = stored_raw ? raw_size : compressed_size;
+  const uint32_t stored_tag = stored_raw ? (stored_size | kStoredRawFlag) : stored_size;
+  if (stored_raw) {
+    memcpy(payload, raw, raw_size);
+  }
+  const uint8_t block_header[kBlockHeaderSize] = {
+      UINT32_LE_BYTES(static_cast<uint32_t>(raw_size)),
+      UINT32_LE_BYTES(stored_tag),
+  };
+  memcpy(out, block_header, sizeof(block_header));
+  return kBlockHeaderSize + stored_size;
+}
+
+CompressedFileWriter::CompressedFileWriter(OwnedFile file, Option option)
+    : file_(std::move(file)), option_(option) {}
+
+CompressedFileWriter::~CompressedFileWriter() {
+  if (file_) {
+    (void)Close();
+  }
+}
+
+esp_err_t CompressedFileWriter::Setup() {
+  if (!file_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (option_.block_size <= 0 || option_.block_size > LzCodec::kMaxBlockSize) {
+    ESP_LOGE(TAG, "invalid block size: %d", option_.block_size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!LzCodec::IsValidParams(option_.window_log, option_.hash_log)) {
+    ESP_LOGE(TAG, "invalid codec params: window=%d hash=%d", option_.window_log, option_.hash_log);
+    return ESP_ERR_INVALID_ARG;
+  }
+  codec_.emplace(option_.window_log, option_.hash_log);
+  raw_ = std::make_unique<uint8_t[]>(option_.block_size);
+  out_ = DmaBuffer::Allocate(kBlockHeaderSize + option_.block_size);
+  if (!out_) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (!option_.index_spool_path.empty()) {
+    index_spool_ = OpenFile(option_.index_spool_path, "w+b");
+    if (!index_spool_) {
+      ESP_LOGE(TAG, "cannot open index spool: %s", option_.index_spool_path.c_str());
+      return ESP_ERR_NOT_FOUND;
+    }
+  }
+
+  uint8_t header[kCompressedFileHeaderSize];
+  EncodeFileHeader(
+      option_.window_log,
+      index_spool_ ? kCompressedFileFlagIndexed : 0,
+      option_.block_size,
+      header);
+  return WriteOut(header, sizeof(header));
+}
+
+esp_err_t CompressedFileWriter::Write(const void* data, size_t size) {
+  if (!file_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  raw_bytes_ += size;
+  while (size > 0) {
+    if (raw_size_ == 0) {
+      block_timestamp_us_ = NowUnixUs();
+    }
+    if (raw_size_ == 0 && size >= static_cast<size_t>(option_.block_size)) {
+      // whole block available from the caller --- compress in place without staging
+      TRY(WriteBlock(p, option_.block_size));
+      p += option_.block_size;
+      size -= option_.block_size;
+      continue;
+    }
+    const size_t n = std::min(size, static_cast<size_t>(option_.block_size - raw_size_));
+    memcpy(&raw_[raw_size_], p, n);
+    raw_size_ += n;
+    p += n;
+    size -= n;
+    if (raw_size_ == option_.block_size) {
+      TRY(WriteBlock(raw_.get(), raw_size_));
+      raw_size_ = 0;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t CompressedFileWriter::Flush() {
+  if (!file_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (raw_size_ > 0) {
+    TRY(WriteBlock(raw_.get(), raw_size_));
+    raw_size_ = 0;
+  }
+  return fflush(file_.get()) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t CompressedFileWriter::Close() {
+  TRY(Flush());
+  const uint8_t end_marker[kBlockHeaderSize] = {};
+  TRY(WriteOut(end_marker, sizeof(end_marker)));
+  if (index_spool_) {
+    TRY(WriteIndex());
+  }
+  // fclose also flushes; its failure means the tail of the stream may be lost
+  const bool ok = fclose(file_.release()) == 0;
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t CompressedFileWriter::WriteBlock(const uint8_t* raw, int raw_size) {
+  const int size = EncodeBlock(&*codec_, raw, raw_size, out_.data());
+  if (index_spool_) {
+    TRY(AddIndexEntry(raw_size, &out_[kBlockHeaderSize], size - kBlockHeaderSize));
+  }
+  TRY(WriteOut(out_.data(), size));
+  ++num_blocks_;
+  raw_written_bytes_ += raw_size;
+  return ESP_OK;
+}
+
+esp_err_t CompressedFileWriter::AddIndexEntry(
+    int raw_size,
+    const uint8_t* payload,
+    uint32_t stored_size) {
+  uint8_t entry[kIndexEntrySize];
+  EncodeIndexEntry(
+      raw_written_bytes_,
+      stored_bytes_,  // the block header is about to be written here
+      block_timestamp_us_,
+      raw_size,
+      Crc32(0, payload, stored_size),
+      entry);
+  if (fwrite(entry, sizeof(entry), 1, index_spool_.get()) != 1) {
+    ESP_LOGE(TAG, "index spool write fail");
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t CompressedFileWriter::WriteIndex() {
+  const uint64_t index_offset = stored_bytes_;
+  FILE* const spool = index_spool_.get();
+  if (fflush(spool) != 0 || fseek(spool, 0, SEEK_SET) != 0) {
+    return ESP_FAIL;
+  }
+  // the compressed block buffer is free by now; reuse it for copying
+  const size_t chunk_size = kBlockHeaderSize + option_.block_size;
+  while (true) {
+    const size_t n = fread(out_.data(), 1, chunk_size, spool);
+    if (n > 0) {
+      TRY(WriteOut(out_.data(), n));
+    }
+    if (n < chunk_size) {
+      break;
+    }
+  }
+  if (ferror(spool)) {
+    return ESP_FAIL;
+  }
+  uint8_t footer[kIndexFooterSize];
+  EncodeIndexFooter(index_offset, raw_written_bytes_, num_blocks_, footer);
+  TRY(WriteOut(footer, sizeof(footer)));
+  index_spool_.reset();
+  if (remove(option_.index_spool_path.c_str()) != 0) {
+    ESP_LOGW(TAG, "cannot remove index spool: %s", option_.index_spool_path.c_str());
+  }
+  return ESP_OK;
+}
+
+esp_err_t CompressedFileWriter::WriteOut(const void* data, size_t size) {
+  size_t written;
+  {
+    ScopedIoTimer timer(IoOp::kWrite);
+    written = fwrite(data, 1, size, file_.get());
+  }
+  if (written != size) {
+    ESP_LOGE(TAG, "fwrite(%d) fail", static_cast<int>(size));
+    return ESP_FAIL;
+  }
+  stored_bytes_ += size;
+  return ESP_OK;
+}
+
+CompressedFileReader::CompressedFileReader(OwnedFile file) : file_(std::move(file)) {}
+
+esp_err_t CompressedFileReader::Setup() {
+  if (!file_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint8_t header[kCompressedFileHeaderSize];
+  if (fread(header, sizeof(header), 1, file_.get()) != 1) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (memcmp(header, kCompressedFileMagic, sizeof(kCompressedFileMagic)) != 0) {
+    ESP_LOGE(TAG, "bad magic");
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  if (header[4] != 1 && header[4] != kCompressedFileVersion) {
+    ESP_LOGE(TAG, "unsupported version: %d", header[4]);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  block_size_ = static_cast<int>(Uint32LeAt(&header[8]));
+  if (block_size_ <= 0 || block_size_ > LzCodec::kMaxBlockSize) {
+    ESP_LOGE(TAG, "invalid block size: %d", block_size_);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  in_ = DmaBuffer::Allocate(block_size_);
+  out_ = DmaBuffer::Allocate(block_size_);
+  if (!in_ || !out_) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+size_t CompressedFileReader::Read(void* data, size_t size) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  size_t total = 0;
+  while (total < size) {
+    if (begin_ == end_) {
+      if (eof_) {
+        break;
+      }
+      LoadNextBlock();
+      continue;
+    }
+    const size_t n = std::min(size - total, static_cast<size_t>(end_ - begin_));
+    memcpy(p + total, &out_[begin_], n);
+    begin_ += n;
+    total += n;
+  }
+  return total;
+}
+
+void CompressedFileReader::LoadNextBlock() {
+  begin_ = end_ = 0;
+  uint8_t header[kBlockHeaderSize];
+  if (fread(header, sizeof(header), 1, file_.get()) != 1) {
+    // clean EOF is only expected right after the end marker
+    ESP_LOGW(TAG, "stream truncated (no end marker)");
+    error_ = ESP_ERR_INVALID_SIZE;
+    eof_ = true;
+    return;
+  }
+  const uint32_t raw_size = Uint32LeAt(&header[0]);
+  const uint32_t stored_tag = Uint32LeAt(&header[4]);
+  const uint32_t stored_size = stored_tag & ~kStoredRawFlag;
+  if (raw_size == 0 && stored_tag == 0) {
+    eof_ = true;
+    return;
+  }
+  if (raw_size > static_cast<uint32_t>(block_size_) || stored_size > raw_size) {
+    ESP_LOGE(
+        TAG,
+        "corrupted block header: raw=%u stored=%u",
+        static_cast<unsigned>(raw_size),
+        static_cast<unsigned>(stored_tag));
+    error_ = ESP_ERR_INVALID_RESPONSE;
+    eof_ = true;
+    return;
+  }
+  if (stored_tag & kStoredRawFlag) {
+    if (stored_size != raw_size || fread(out_.data(), 1, raw_size, file_.get()) != raw_size) {
+      error_ = ESP_ERR_INVALID_SIZE;
+      eof_ = true;
+      return;
+    }
+  } else {
+    if (fread(in_.data(), 1, stored_size, file_.get()) != stored_size) {
+      error_ = ESP_ERR_INVALID_SIZE;
+      eof_ = true;
+      return;
+    }
+    const int decompressed_size =
+        LzCodec::Decompress(in_.data(), stored_size, out_.data(), static_cast<int>(raw_size));
+    if (decompressed_size != static_cast<int>(raw_size)) {
+      ESP_LOGE(TAG, "corrupted block payload");
+      error_ = ESP_ERR_INVALID_RESPONSE;
+      eof_ = true;
+      return;
+    }
+  }
+  end_ = static_cast<int>(raw_size);
+}
+
+}  // namespace io
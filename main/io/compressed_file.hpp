@@ -0,0 +1,213 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "common/macros.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+#include "io/lz_codec.hpp"
+
+namespace io {
+
+// Compressed stream layout (all integers little-endian):
+//
+// | field        | size | notes                                               |
+// |--------------|------|-----------------------------------------------------|
+// | magic        | 4    | `kCompressedFileMagic`                              |
+// | version      | 1    | `kCompressedFileVersion`                            |
+// | window_log   | 1    | informative only; not needed for decoding           |
+// | flags        | 1    | `kCompressedFileFlagIndexed`                        |
+// | reserved     | 1    | zero                                                |
+// | block_size   | 4    | max uncompressed bytes per block                    |
+// | blocks...    |      | `raw_size:u32 | stored_size:u32 | payload`          |
+// | end marker   | 8    | a block header with `raw_size == stored_size == 0`  |
+// | index...     |      | (indexed only) one `kIndexEntrySize` entry per block |
+// | footer       | 24   | (indexed only) see below                            |
+//
+// `stored_size` has `kStoredRawFlag` set if the payload is the raw bytes (block did not shrink).
+// A missing end marker means the writer did not close the stream (e.g. power loss); every complete
+// block before that point is still readable.
+//
+// Every block is compressed independently, so with the trailing index any uncompressed offset can
+// be reached by decoding exactly one block. Index entry (sorted by `raw_offset`):
+//
+//     raw_offset:u64 | file_offset:u64 | timestamp_us:i64 | raw_size:u32 | crc32:u32
+//
+// where `file_offset` points at the block header, `timestamp_us` is the Unix time when the first
+// byte of the block was written, and `crc32` covers the stored payload. Footer:
+//
+//     index_offset:u64 | total_raw_size:u64 | num_entries:u32 | magic:4 (`kIndexFooterMagic`)
+//
+// Version 1 streams (no flags, never indexed) are still readable.
+
+constexpr uint8_t kCompressedFileMagic[4] = {'L', 'Z', 'B', 'K'};
+constexpr uint8_t kCompressedFileVersion = 2;
+constexpr uint8_t kCompressedFileFlagIndexed = 1 << 0;
+constexpr int kCompressedFileHeaderSize = 12;
+constexpr int kBlockHeaderSize = 8;
+constexpr uint32_t kStoredRawFlag = uint32_t{1} << 31;
+
+constexpr int kIndexEntrySize = 32;
+constexpr int kIndexFooterSize = 24;
+constexpr uint8_t kIndexFooterMagic[4] = {'L', 'Z', 'B', 'X'};
+
+/// Serializes the stream header into `out` (`kCompressedFileHeaderSize` bytes).
+void EncodeFileHeader(int window_log, uint8_t flags, int block_size, uint8_t* out);
+
+/// Serializes one block index entry into `out` (`kIndexEntrySize` bytes).
+void EncodeIndexEntry(
+    uint64_t raw_offset,
+    uint64_t file_offset,
+    int64_t timestamp_us,
+    int raw_size,
+    uint32_t crc32,
+    uint8_t* out);
+
+/// Serializes the index footer into `out` (`kIndexFooterSize` bytes).
+void EncodeIndexFooter(
+    uint64_t index_offset,
+    uint64_t total_raw_size,
+    uint32_t num_entries,
+    uint8_t* out);
+
+/// Compresses one block into `out` as `block header | payload`, falling back to storing the raw
+/// bytes if compression does not help.
+///
+/// \param out   at least `kBlockHeaderSize + raw_size` bytes
+/// \return number of bytes written to `out`
+int EncodeBlock(LzCodec* codec, const uint8_t* raw, int raw_size, uint8_t* out);
+
+/// Streaming compressor with a `FILE*`-style interface: bytes are accepted incrementally, chopped
+/// into blocks of `Option::block_size`, and each block is compressed independently with `LzCodec`
+/// then appended to the underlying file. Memory use is fixed at creation time (two block buffers
+/// plus the codec hash table).
+///
+/// \example
+/// \code{.cpp}
+/// auto writer = io::CompressedFileWriter::Create(io::OpenFile("/s/log.lzb", "wb"), {});
+/// writer->Write(line.data(), line.size());
+/// writer->Close();
+/// \endcode
+class CompressedFileWriter {
+ public:
+  struct Option {
+    int block_size = 16 * 1024;  ///< uncompressed bytes per block; at most `kMaxBlockSize`
+    int window_log = 12;         ///< log2 of the match window (4 KiB by default)
+    int hash_log = 12;           ///< log2 of the codec hash table entries
+    /// If not empty, the stream gets a trailing block index (see `SeekableCompressedFile`).
+    /// Index entries are spooled to this scratch file while writing, so memory use stays fixed
+    /// no matter how long the stream grows; on `Close` the spool is appended then deleted.
+    std::string index_spool_path;
+  };
+
+  DEFINE_CREATE(CompressedFileWriter)
+  ~CompressedFileWriter();
+
+  /// Appends bytes to the stream. Full blocks are compressed and written out immediately.
+  esp_err_t Write(const void* data, size_t size);
+
+  /// Compresses and writes out the pending partial block (if any), then flushes the file.
+  esp_err_t Flush();
+
+  /// Flushes, writes the end marker, and closes the file. Further writes are rejected.
+  esp_err_t Close();
+
+  /// \return total uncompressed bytes accepted so far
+  uint64_t raw_bytes() const { return raw_bytes_; }
+  /// \return total bytes written to the file so far (including headers)
+  uint64_t stored_bytes() const { return stored_bytes_; }
+  /// \return number of blocks written so far
+  uint32_t num_blocks() const { return num_blocks_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(CompressedFileWriter)
+
+ private:
+  OwnedFile file_;
+  Option option_;
+  std::optional<LzCodec> codec_;  // constructed by `Setup` once the option is validated
+
+  std::unique_ptr<uint8_t[]> raw_;  // pending uncompressed bytes
+  int raw_size_ = 0;
+  DmaBuffer out_;                   // compressed block incl. header
+
+  uint64_t raw_bytes_ = 0;
+  uint64_t stored_bytes_ = 0;
+  uint32_t num_blocks_ = 0;
+
+  OwnedFile index_spool_{nullptr, fclose};
+  uint64_t raw_written_bytes_ = 0;  // raw bytes in blocks already written out
+  int64_t block_timestamp_us_ = 0;  // when the first byte of the pending block arrived
+
+  CompressedFileWriter(OwnedFile file, Option option);
+  esp_err_t Setup();
+
+  esp_err_t WriteBlock(const uint8_t* raw, int raw_size);
+  esp_err_t WriteOut(const void* data, size_t size);
+  esp_err_t AddIndexEntry(int raw_size, const uint8_t* payload, uint32_t stored_size);
+  esp_err_t WriteIndex();
+};
+
+/// Streaming decompressor for files produced by `CompressedFileWriter`, with an `fread`-style
+/// interface. Only one block is held in memory at a time (compressed + decompressed), so the cost
+/// is bounded by the block size chosen by the writer, regardless of the file size.
+///
+/// \example
+/// \code{.cpp}
+/// auto reader = io::CompressedFileReader::Create(io::OpenFile("/s/log.lzb", "rb"));
+/// for (std::string_view line : io::FileLineReader(reader->AsByteSource(), 256)) {
+///   /* ... */
+/// }
+/// \endcode
+class CompressedFileReader {
+ public:
+  DEFINE_CREATE(CompressedFileReader)
+
+  /// Reads up to `size` decompressed bytes.
+  ///
+  /// \return number of bytes read; less than `size` only at the end of the stream or on error
+  size_t Read(void* data, size_t size);
+
+  /// Adapts `Read` to the byte source expected by e.g. `FileLineReaderImpl`.
+  auto AsByteSource() {
+    return [this](char* data, size_t size) { return Read(data, size); };
+  }
+
+  /// \return true if all blocks have been consumed (or reading stopped due to an error)
+  bool eof() const { return eof_ && begin_ == end_; }
+
+  /// \return `ESP_OK` if the stream was well-formed so far;
+  ///         `ESP_ERR_INVALID_SIZE` if it was truncated (missing end marker);
+  ///         other error code if it was corrupted or could not be read
+  esp_err_t error() const { return error_; }
+
+  int block_size() const { return block_size_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(CompressedFileReader)
+
+ private:
+  OwnedFile file_;
+  int block_size_ = 0;
+
+  DmaBuffer in_;   // compressed payload of the current block
+  DmaBuffer out_;  // decompressed current block
+  int begin_ = 0;
+  int end_ = 0;
+  bool eof_ = false;
+  esp_err_t error_ = ESP_OK;
+
+  explicit CompressedFileReader(OwnedFile file);
+  esp_err_t Setup();
+
+  /// Decompresses the next block into `out_`. Sets `eof_` (and `error_` if appropriate) when no
+  /// more blocks can be read.
+  void LoadNextBlock();
+};
+
+}  // namespace io
@@ -0,0 +1,126 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/dir_walker.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "esp_log.h"
+
+#include "common/macros.hpp"
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "dir_walker";
+
+}  // namespace
+
+DirWalkerImpl::DirWalkerImpl(std::string_view fatfs_root, int max_depth)
+    : max_depth_(max_depth), path_(fatfs_root) {
+  CHECK(max_depth >= 0);
+  // "0:/logs/" => "0:/logs", "0:/" => "0:", so that entries are always `path_ + '/' + name`
+  while (!path_.empty() && path_.back() == '/') {
+    path_.pop_back();
+  }
+  root_size_ = path_.size();
+  path_.reserve(root_size_ + 256);
+  frames_.reserve(max_depth + 1);
+  (void)OpenDir(FatDirEntry{});
+}
+
+DirWalkerImpl::~DirWalkerImpl() { CloseAll(); }
+
+std::optional<const DirWalkEntry*> DirWalkerImpl::Next() {
+  if (pending_enter_) {
+    pending_enter_ = false;
+    bool enter = !std::exchange(skip_, false);
+    if (enter && static_cast<int>(frames_.size()) > max_depth_) {
+      ++num_depth_limited_;
+      enter = false;
+    }
+    if (!enter || !OpenDir(current_.entry)) {
+      current_.kind = DirWalkEntry::Kind::kLeaveDir;
+      return &current_;
+    }
+  }
+  while (!frames_.empty()) {
+    Frame& top = frames_.back();
+    const FRESULT result = f_readdir(&top.dir, &info_);
+    if (result != FR_OK) {
+      ESP_LOGE(TAG, "f_readdir(%s) => %d", path_.c_str(), result);
+      error_ = ESP_FAIL;
+      CloseAll();
+      break;
+    }
+    if (info_.fname[0] == '\0') {
+      // end of this directory
+      (void)f_closedir(&top.dir);
+      path_.resize(top.path_size);
+      const FatDirEntry entry = top.entry;
+      frames_.pop_back();
+      if (frames_.empty()) {
+        break;  // the root is not yielded
+      }
+      current_ = {
+          .kind = DirWalkEntry::Kind::kLeaveDir,
+          .depth = static_cast<int>(frames_.size()) - 1,
+          .path = RelativePath(),
+          .entry = entry,
+      };
+      current_.entry.name = std::string_view(path_).substr(frames_.back().path_size + 1);
+      return &current_;
+    }
+    path_.resize(top.path_size);
+    path_ += '/';
+    path_ += info_.fname;
+    const bool is_dir = info_.fattrib & AM_DIR;
+    current_ = {
+        .kind = is_dir ? DirWalkEntry::Kind::kEnterDir : DirWalkEntry::Kind::kFile,
+        .depth = static_cast<int>(frames_.size()) - 1,
+        .path = RelativePath(),
+        .entry =
+            {
+                .name = info_.fname,
+                .size = info_.fsize,
+                .attrib = info_.fattrib,
+                .fdate = info_.fdate,
+                .ftime = info_.ftime,
+            },
+    };
+    pending_enter_ = is_dir;
+    return &current_;
+  }
+  return std::nullopt;
+}
+
+bool DirWalkerImpl::OpenDir(const FatDirEntry& entry) {
+  // `path_` may be reallocated when the next entry is appended, so only its size is kept
+  Frame& frame = frames_.emplace_back();
+  frame.path_size = path_.size();
+  frame.entry = entry;
+  frame.entry.name = {};
+  const FRESULT result = f_opendir(&frame.dir, path_.c_str());
+  if (result != FR_OK) {
+    ESP_LOGE(TAG, "f_opendir(%s) => %d", path_.c_str(), result);
+    error_ = ESP_FAIL;
+    frames_.pop_back();
+    return false;
+  }
+  return true;
+}
+
+void DirWalkerImpl::CloseAll() {
+  for (Frame& frame : frames_) {
+    (void)f_closedir(&frame.dir);
+  }
+  frames_.clear();
+}
+
+std::string_view DirWalkerImpl::RelativePath() const {
+  return std::string_view(path_).substr(std::min(path_.size(), root_size_ + 1));
+}
+
+}  // namespace io
@@ -0,0 +1,105 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "esp_err.h"
+#include "ff.h"
+
+#include "common/iter.hpp"
+#include "io/fs_utils.hpp"
+
+namespace io {
+
+/// One step of a `DirWalker` walk.
+struct DirWalkEntry {
+  enum class Kind {
+    kFile,
+    kEnterDir,  // before the contents of the directory
+    kLeaveDir,  // after the contents of the directory (also for directories that were skipped)
+  };
+
+  Kind kind;
+  /// 0 for the direct children of the root
+  int depth;
+  /// relative to the root, e.g. "2022/07/15/log.txt"
+  std::string_view path;
+  /// metadata from the directory entry; `entry.name` is the last component of `path`
+  FatDirEntry entry;
+};
+
+/// Implementation for `DirWalker`
+///
+/// The walk is depth-first and non-recursive: an explicit stack holds one open `FF_DIR` per level,
+/// capped at `max_depth` levels and reserved up front. Together with a single `FILINFO` and one
+/// path buffer, memory does not grow with the number of entries, and no list of paths is ever
+/// built.
+class DirWalkerImpl {
+ public:
+  using Item = const DirWalkEntry*;
+
+  static constexpr int kDefaultMaxDepth = 16;
+
+  /// \param fatfs_root  FATFS path of the directory to walk, e.g. "0:/logs" (see `ToFatfsPath`);
+  ///                    the root itself is not yielded
+  /// \param max_depth   directories deeper than this are yielded but not entered
+  explicit DirWalkerImpl(std::string_view fatfs_root, int max_depth = kDefaultMaxDepth);
+  ~DirWalkerImpl();
+
+  /// \return entry valid until the next call
+  std::optional<const DirWalkEntry*> Next();
+
+  /// After `Next` has returned a `kEnterDir`, skips its contents: the next entry is its
+  /// `kLeaveDir`.
+  void SkipCurrentDir() { skip_ = true; }
+
+  /// \return `ESP_OK` unless opening or reading a directory has failed
+  esp_err_t error() const { return error_; }
+
+  /// \return number of directories not entered because of `max_depth`
+  int num_depth_limited() const { return num_depth_limited_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(DirWalkerImpl)
+
+ private:
+  struct Frame {
+    FF_DIR dir;
+    size_t path_size;  // `path_` is this directory while its contents are walked
+    FatDirEntry entry;  // `name` is left empty; it is restored from `path_`
+  };
+
+  std::vector<Frame> frames_;
+  int max_depth_;
+  std::string path_;  // FATFS path of the current entry
+  size_t root_size_;
+  FILINFO info_;
+  DirWalkEntry current_;
+  bool pending_enter_ = false;
+  bool skip_ = false;
+  int num_depth_limited_ = 0;
+  esp_err_t error_ = ESP_OK;
+
+  bool OpenDir(const FatDirEntry& entry);
+  void CloseAll();
+  std::string_view RelativePath() const;
+};
+
+/// Iterator/Iterable over a whole directory tree on FATFS, e.g. for `du` and `find`.
+///
+/// \example
+/// \code{.cpp}
+/// for (const io::DirWalkEntry* e : io::DirWalker("0:/logs")) {
+///   if (e->kind == io::DirWalkEntry::Kind::kFile) { total += e->entry.size; }
+/// }
+/// \endcode
+///
+/// \see DirWalkerImpl
+using DirWalker = RustIter<DirWalkerImpl>;
+
+}  // namespace io
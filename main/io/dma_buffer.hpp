@@ -0,0 +1,176 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#if __has_include("esp_memory_utils.h")
+#include "esp_memory_utils.h"  // `esp_ptr_dma_capable` since ESP-IDF 5.0
+#else
+#include "soc/soc_memory_layout.h"
+#endif
+#endif  // ESP_PLATFORM
+
+#include "common/macros.hpp"
+#include "common/split_counter.hpp"
+#include "io/file.hpp"
+
+namespace io {
+
+/// How the transfers of the read and write paths in `io` reached the card. Counted with relaxed
+/// atomics, from any task.
+///
+/// The SDMMC driver DMAs straight from/into the caller's buffer only if it is DMA-capable and
+/// word-aligned; otherwise it bounces the transfer through its own one-sector buffer, one sector
+/// per command. Likewise FATFS only passes whole sectors at sector-aligned file offsets through to
+/// the driver, and copies the rest through its sector window. A healthy system shows (almost) only
+/// direct transfers.
+///
+/// Only calls that hand data to FATFS or the driver themselves are recorded (`read`/`write` on a
+/// descriptor or an unbuffered stream, `f_write`, sector transfers), once they have returned; what
+/// goes through a buffered `FILE` reaches the card through the stream's buffer instead.
+class DmaStats {
+ public:
+  struct Counters {
+    uint32_t num_direct;   ///< whole sectors from/into a DMA-capable buffer
+    uint32_t num_bounced;  ///< buffer not DMA-capable (or misaligned): bounced sector by sector
+    uint32_t num_partial;  ///< not whole sectors at a sector boundary: through the sector window
+    uint64_t bytes;
+    uint32_t num_buffers;         ///< `DmaBuffer`s allocated
+    uint32_t num_alloc_failures;  ///< `DmaBuffer`s that could not be allocated
+  };
+
+  static DmaStats& Get() {
+    static DmaStats instance;
+    return instance;
+  }
+
+  /// Classifies one transfer of `size` bytes (as actually moved) from/into `data`, at file (or
+  /// device) byte `offset`.
+  void RecordTransfer(const void* data, size_t size, uint64_t offset) {
+    if (!IsDmaCapable(data)) {
+      num_bounced_.fetch_add(1, std::memory_order_relaxed);
+    } else if (size % kSdSectorSize || offset % kSdSectorSize) {
+      num_partial_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      num_direct_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bytes_.Add(size);
+  }
+
+  void RecordAllocation(bool ok) {
+    (ok ? num_buffers_ : num_alloc_failures_).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Counters counters() const {
+    return {
+        .num_direct = num_direct_.load(std::memory_order_relaxed),
+        .num_bounced = num_bounced_.load(std::memory_order_relaxed),
+        .num_partial = num_partial_.load(std::memory_order_relaxed),
+        .bytes = bytes_.load(),
+        .num_buffers = num_buffers_.load(std::memory_order_relaxed),
+        .num_alloc_failures = num_alloc_failures_.load(std::memory_order_relaxed),
+    };
+  }
+
+  /// Clears the transfer counters (allocation counts are kept).
+  void Reset() {
+    num_direct_.store(0, std::memory_order_relaxed);
+    num_bounced_.store(0, std::memory_order_relaxed);
+    num_partial_.store(0, std::memory_order_relaxed);
+    bytes_.Reset();
+  }
+
+  /// \return true if the SDMMC driver can DMA straight from/into `p` (on a Linux host: if `p` is
+  ///         word-aligned)
+  static bool IsDmaCapable(const void* p) {
+    const bool aligned = (reinterpret_cast<uintptr_t>(p) & 3) == 0;
+#ifdef ESP_PLATFORM
+    return aligned && esp_ptr_dma_capable(p);
+#else
+    return aligned;
+#endif  // ESP_PLATFORM
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(DmaStats)
+
+ private:
+  std::atomic<uint32_t> num_direct_{0};
+  std::atomic<uint32_t> num_bounced_{0};
+  std::atomic<uint32_t> num_partial_{0};
+  SplitCounter64 bytes_;
+  std::atomic<uint32_t> num_buffers_{0};
+  std::atomic<uint32_t> num_alloc_failures_{0};
+
+  DmaStats() = default;
+};
+
+/// Owned buffer that the SDMMC driver can DMA into/from directly: DMA-capable internal memory,
+/// aligned to `kAlignment`, and a whole number of sectors long. Use it for every buffer handed to
+/// `read`/`write`/`fread`/`fwrite`/`f_write` or a `BlockDevice` in bulk. On a Linux host it is a
+/// plain aligned allocation.
+///
+/// \example
+/// \code{.cpp}
+/// io::DmaBuffer buf = io::DmaBuffer::Allocate(32 * 1024);
+/// if (!buf) {
+///   return ESP_ERR_NO_MEM;
+/// }
+/// const ssize_t n = read(fd, buf.data(), buf.size());
+/// \endcode
+class DmaBuffer {
+ public:
+  /// A word is all the DMA needs; a cache line keeps buffers from sharing one with other data on
+  /// targets with cached external RAM.
+  static constexpr size_t kAlignment = 64;
+
+  DmaBuffer() = default;
+  DmaBuffer(DmaBuffer&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+  DmaBuffer& operator=(DmaBuffer&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+  ~DmaBuffer() {
+#ifdef ESP_PLATFORM
+    heap_caps_aligned_free(data_);
+#else
+    free(data_);
+#endif  // ESP_PLATFORM
+  }
+
+  /// \param size  rounded up to a multiple of `kSdSectorSize`
+  /// \return empty if out of memory
+  static DmaBuffer Allocate(size_t size) {
+    DmaBuffer buf;
+    const size_t rounded = (size + kSdSectorSize - 1) / kSdSectorSize * kSdSectorSize;
+#ifdef ESP_PLATFORM
+    buf.data_ = static_cast<uint8_t*>(heap_caps_aligned_alloc(kAlignment, rounded, MALLOC_CAP_DMA));
+#else
+    buf.data_ = static_cast<uint8_t*>(aligned_alloc(kAlignment, rounded));
+#endif  // ESP_PLATFORM
+    buf.size_ = buf.data_ ? rounded : 0;
+    DmaStats::Get().RecordAllocation(buf.data_ != nullptr);
+    return buf;
+  }
+
+  uint8_t* data() const { return data_; }
+  char* chars() const { return reinterpret_cast<char*>(data_); }
+  size_t size() const { return size_; }
+  uint8_t& operator[](size_t i) const { return data_[i]; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+ private:
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace io
@@ -0,0 +1,46 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "common/platform.hpp"
+#include "common/scoped_timer.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+// Fixed value for SDHC/SDXC
+constexpr int kSdSectorSize = 512;
+
+using OwnedFile = std::unique_ptr<FILE, decltype(&fclose)>;
+
+inline OwnedFile OpenFile(const std::string& path, const char* modestr) {
+  return OwnedFile(fopen(path.c_str(), modestr), fclose);
+}
+
+/// Pushes everything written to `f` so far all the way to the storage medium. Recorded in
+/// `IoStats` as `IoOp::kSync`.
+inline esp_err_t FlushAndSync(FILE* f) {
+  if (f == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  SCOPED_TIMER("io.flush_and_sync");
+  ScopedIoTimer timer(IoOp::kSync);
+  if (fflush(f) != 0) {
+    return ESP_FAIL;
+  }
+  if (fsync(fileno(f)) != 0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+}  // namespace io
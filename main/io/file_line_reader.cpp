@@ -5,49 +5,144 @@
 #include <cstring>
 
 #include "common/macros.hpp"
+#include "common/scoped_timer.hpp"
+#include "common/strings.hpp"
 #include "io/file_line_reader.hpp"
 
 namespace io {
 
 FileLineReaderImpl::FileLineReaderImpl(FILE* f, int max_line_size, char sep)
-    : f_(f),
-      buf_{std::make_unique<char[]>(max_line_size)},
-      size_(max_line_size),
-      begin_(0),
-      end_(0),
+    : FileLineReaderImpl(
+          [f](char* data, size_t size) { return fread(data, 1, size, f); }, max_line_size, sep) {}
+
+FileLineReaderImpl::FileLineReaderImpl(
+    ByteSource source, int max_line_size, char sep, int read_size)
+    : source_(std::move(source)),
+      max_line_size_(max_line_size),
+      read_size_(read_size),
+      capacity_(max_line_size + kRingReads * read_size),
       sep_(sep) {
-  FillBuffer();
+  CHECK(max_line_size > 0 && read_size > 0);
+  buf_ = BlockPool::Get().Allocate(capacity_);
+  CHECK(buf_);
 }
 
 std::optional<std::string_view> FileLineReaderImpl::Next() {
-  // ESP_LOGI("", "[%d, %d)", begin_, end_);
-  if (begin_ == end_ && feof(f_)) {
-    return {};
+  // iterative: a line spanning many reads costs no extra stack
+  while (true) {
+    const int limit = std::min(end_, begin_ + max_line_size_);
+    const char* const found = FindByte(&buf_[scan_], &buf_[limit], sep_);
+    if (found != &buf_[limit]) {
+      const int next = found - &buf_[0] + 1;
+      const std::string_view result(&buf_[begin_], next - begin_);
+      begin_ = scan_ = next;
+      return result;
+    }
+    scan_ = limit;
+    if (limit - begin_ == max_line_size_ || (eof_ && begin_ < end_)) {
+      // oversized line, or last line without a separator
+      const std::string_view result(&buf_[begin_], limit - begin_);
+      begin_ = scan_ = limit;
+      return result;
+    }
+    if (eof_) {
+      return {};
+    }
+    Refill();
   }
-  const int next = std::min(end_, std::find(&buf_[begin_], &buf_[end_], sep_) - &buf_[0] + 1);
-  if (next < end_ || begin_ == 0) {
-    // found separator, or we have an oversized line (buffer already maxed out)
-    const std::string_view result(&buf_[begin_], next - begin_);
-    begin_ = next;
-    return result;
-  }
-  // did not find separator but we should try again after eliminating the gap
-  // at the begin of the buffer
-  FillBuffer();
-  return Next();
 }
 
-bool FileLineReaderImpl::FillBuffer() {
-  if (begin_) {
-    memmove(&buf_[0], &buf_[begin_], end_ - begin_);
-    end_ -= begin_;
+void FileLineReaderImpl::Refill() {
+  // timed here rather than per line in `Next`, where the timer would cost more than the splitting
+  SCOPED_TIMER("io.line_reader.refill");
+  if (capacity_ - end_ < read_size_) {
+    // only the partial line (shorter than `max_line_size_`) is left; bring it to the front
+    const int size = end_ - begin_;
+    memmove(&buf_[0], &buf_[begin_], size);
+    scan_ -= begin_;
+    end_ = size;
     begin_ = 0;
   }
-  if (end_ < size_) {
-    const int read_size = fread(&buf_[end_], 1, size_ - end_, f_);
-    end_ += read_size;
+  const int read_size = source_(&buf_[end_], read_size_);
+  end_ += read_size;
+  eof_ = read_size < read_size_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ReverseLineReaderImpl::ReverseLineReaderImpl(
+    FILE* f, int max_line_size, char sep, int block_size)
+    : f_(f),
+      max_line_size_(max_line_size),
+      block_size_(block_size),
+      capacity_(max_line_size + kRingReads * block_size),
+      begin_(capacity_),
+      end_(capacity_),
+      scan_(capacity_),
+      file_pos_(0),
+      sep_(sep) {
+  CHECK(max_line_size > 0 && block_size > 0);
+  buf_ = BlockPool::Get().Allocate(capacity_);
+  CHECK(buf_);
+  long size;
+  if (!f_ || fseek(f_, 0, SEEK_END) != 0 || (size = ftell(f_)) < 0) {
+    error_ = ESP_FAIL;
+    return;
+  }
+  file_pos_ = size;
+}
+
+std::optional<std::string_view> ReverseLineReaderImpl::Next() {
+  while (error_ == ESP_OK) {
+    if (begin_ == end_) {
+      if (file_pos_ == 0) {
+        return {};
+      }
+      error_ = Refill();
+      continue;
+    }
+    // the last byte is this line's own separator, so search before it
+    const int limit = std::max(begin_, end_ - max_line_size_);
+    const int hi = std::max(std::min(scan_, end_ - 1), limit);
+    const char* const found = FindLastByte(&buf_[limit], &buf_[hi], sep_);
+    if (found != &buf_[hi]) {
+      const int next = found - &buf_[0] + 1;
+      const std::string_view result(&buf_[next], end_ - next);
+      end_ = next;
+      scan_ = end_ - 1;
+      return result;
+    }
+    scan_ = limit;
+    if (end_ - limit == max_line_size_ || (limit == begin_ && file_pos_ == 0)) {
+      // oversized line, or the first line of the file
+      const std::string_view result(&buf_[limit], end_ - limit);
+      end_ = limit;
+      scan_ = end_ - 1;
+      return result;
+    }
+    error_ = Refill();
+  }
+  return {};
+}
+
+esp_err_t ReverseLineReaderImpl::Refill() {
+  // after the first (partial) block, reads are aligned to `block_size_`
+  const int read_size = file_pos_ % block_size_ ? file_pos_ % block_size_ : block_size_;
+  if (begin_ < read_size) {
+    // only the partial line (shorter than `max_line_size_`) is left; bring it to the back
+    const int shift = capacity_ - end_;
+    memmove(&buf_[begin_ + shift], &buf_[begin_], end_ - begin_);
+    begin_ += shift;
+    end_ += shift;
+    scan_ += shift;
+  }
+  if (fseek(f_, file_pos_ - read_size, SEEK_SET) != 0 ||
+      fread(&buf_[begin_ - read_size], 1, read_size, f_) != static_cast<size_t>(read_size)) {
+    return ESP_FAIL;
   }
-  return feof(f_);
+  begin_ -= read_size;
+  file_pos_ -= read_size;
+  return ESP_OK;
 }
 
 }  // namespace io
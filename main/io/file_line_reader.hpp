@@ -1,35 +1,114 @@
 // Copyright 2022 summivox. All rights reserved.
 // Authors: summivox@gmail.com
 
+#pragma once
+
+#include <cstdint>
 #include <cstdio>
-#include <memory>
+#include <functional>
 #include <optional>
 #include <string_view>
 
 #include "common/iter.hpp"
+#include "common/memory_pool.hpp"
+#include "common/platform.hpp"
 
 namespace io {
 
 // NOTE: ASCII only
 
+/// Splits a byte stream into lines (including the separator), returned as views into an internal
+/// buffer that stay valid until the next call to `Next`. Lines longer than `max_line_size` are
+/// returned in pieces of `max_line_size`.
+///
+/// The buffer is a ring of `max_line_size + kRingReads * read_size` bytes, filled `read_size` bytes
+/// at a time. Nothing is moved until a read no longer fits before the end of the ring; then only
+/// the partial line at the end (less than `max_line_size` bytes) is copied to the front, i.e. at
+/// most once per `kRingReads` reads. The ring is taken from `BlockPool` (when it fits in a block),
+/// so readers opened and closed over and over do not fragment the heap.
 class FileLineReaderImpl {
  public:
   using Item = std::string_view;
+
+  /// Reads up to `size` bytes into `data`; returns the number of bytes read, which is less than
+  /// `size` only at the end of the input.
+  using ByteSource = std::function<size_t(char* data, size_t size)>;
+
+  static constexpr int kDefaultReadSize = 1024;
+  static constexpr int kRingReads = 4;
+
   FileLineReaderImpl(FILE* f, int max_line_size, char sep = '\n');
+  /// Reads lines from any byte source, e.g. `CompressedFileReader::AsByteSource()`.
+  ///
+  /// \param read_size  bytes requested from `source` at a time
+  FileLineReaderImpl(
+      ByteSource source, int max_line_size, char sep = '\n', int read_size = kDefaultReadSize);
 
   std::optional<std::string_view> Next();
 
  private:
-  FILE* f_;  // not owned
-  std::unique_ptr<char[]> buf_;
-  int size_;
-  int begin_;
-  int end_;
+  ByteSource source_;
+  PoolBuffer buf_;
+  int max_line_size_;
+  int read_size_;
+  int capacity_;
+  int begin_ = 0;  // start of the next line
+  int scan_ = 0;   // `[begin_, scan_)` is known not to contain the separator
+  int end_ = 0;    // end of valid data
   char sep_;
+  bool eof_ = false;
 
-  bool FillBuffer();
+  /// Reads once from the source, first wrapping the partial line around to the front of the ring
+  /// if the read would not fit.
+  void Refill();
 };
 
 using FileLineReader = RustIter<FileLineReaderImpl>;
 
+/// Like `FileLineReaderImpl`, but yields the lines of a file from the last one to the first,
+/// reading the file backwards in blocks aligned to `block_size`. Finding the last N lines therefore
+/// costs O(N lines), regardless of the size of the file.
+///
+/// Lines include their separator; a line longer than `max_line_size` is returned in pieces of
+/// `max_line_size`, also from the back. Like `FileLineReaderImpl`, the ring comes from `BlockPool`
+/// when it fits in a block.
+class ReverseLineReaderImpl {
+ public:
+  using Item = std::string_view;
+
+  static constexpr int kRingReads = 4;
+
+  /// Reads `f` from its current end. `f` must be seekable (`fseek` takes a `long`, so on ESP32 only
+  /// the last 2 GiB are reachable).
+  ReverseLineReaderImpl(FILE* f, int max_line_size, char sep = '\n', int block_size = 512);
+
+  std::optional<std::string_view> Next();
+
+  /// \return file offset of the first byte of the line last returned by `Next` (or of the end of
+  ///         the file before the first call)
+  uint64_t line_offset() const { return file_pos_ + (end_ - begin_); }
+
+  /// \return `ESP_OK` unless a read has failed
+  esp_err_t error() const { return error_; }
+
+ private:
+  FILE* f_;
+  PoolBuffer buf_;
+  int max_line_size_;
+  int block_size_;
+  int capacity_;
+  int begin_;          // `[begin_, end_)` is valid data; lines are taken from the back
+  int end_;
+  int scan_;           // `[scan_, end_ - 1)` is known not to contain the separator
+  uint64_t file_pos_;  // file offset of `buf_[begin_]`
+  char sep_;
+  esp_err_t error_ = ESP_OK;
+
+  /// Reads the block before `file_pos_`, first wrapping the partial line around to the back of the
+  /// ring if the block would not fit.
+  esp_err_t Refill();
+};
+
+using ReverseLineReader = RustIter<ReverseLineReaderImpl>;
+
 }  // namespace io
@@ -4,6 +4,7 @@
 #include "io/fs_utils.hpp"
 
 extern "C" {
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
 #include <utime.h>
@@ -11,15 +12,18 @@ extern "C" {
 
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <initializer_list>
 #include <numeric>
 
 #include "driver/gpio.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "scope_guard/scope_guard.hpp"
 
 #include "common/macros.hpp"
 #include "common/times.hpp"
+#include "io/dma_buffer.hpp"
 
 namespace io {
 
@@ -27,50 +31,166 @@ namespace {
 
 constexpr char TAG[] = "fs";
 
+/// Whole-file reads go through a DMA-capable chunk of this size (then get copied out), so that the
+/// SD driver never bounces them sector by sector, while the DMA memory used stays bounded.
+constexpr size_t kReadChunkSize = 16 * 1024;
+
+/// Reads exactly `size` bytes from the start of `fd` into `out`.
+esp_err_t ReadFdFully(int fd, char* out, size_t size) {
+  const DmaBuffer chunk = DmaBuffer::Allocate(std::min(size, kReadChunkSize));
+  if (!chunk && size) {
+    return ESP_ERR_NO_MEM;
+  }
+  size_t total = 0;
+  while (total < size) {
+    const size_t want = std::min(size - total, chunk.size());
+    const ssize_t n = read(fd, chunk.data(), want);
+    if (n <= 0) {
+      return ESP_FAIL;
+    }
+    DmaStats::Get().RecordTransfer(chunk.data(), n, total);
+    memcpy(out + total, chunk.data(), n);
+    total += n;
+  }
+  return ESP_OK;
+}
+
 }  // namespace
 
-esp_err_t FlushAndSync(FILE* f) {
-  if (f == nullptr) {
-    return ESP_ERR_INVALID_ARG;
+std::string ToFatfsPath(std::string_view vfs_path) {
+  const std::string_view root(kVfsRoot);
+  if (vfs_path.substr(0, root.size()) != root ||
+      (vfs_path.size() > root.size() && vfs_path[root.size()] != '/')) {
+    return {};
   }
-  if (fflush(f) != 0) {
-    return ESP_FAIL;
+  std::string result(kFatfsRoot);
+  result += vfs_path.substr(root.size());
+  if (result.size() == sizeof(kFatfsRoot) - 1) {
+    result += '/';
   }
-  if (fsync(fileno(f)) != 0) {
-    return ESP_FAIL;
+  return result;
+}
+
+const char* ToFatfsPath(std::string_view vfs_path, Arena* arena) {
+  const std::string_view root(kVfsRoot);
+  if (vfs_path.substr(0, root.size()) != root ||
+      (vfs_path.size() > root.size() && vfs_path[root.size()] != '/')) {
+    return nullptr;
   }
-  return ESP_OK;
+  const std::string_view rest = vfs_path.substr(root.size());
+  return arena->Concat({kFatfsRoot, rest.empty() ? "/" : rest}).data();
 }
 
-OwnedFile OpenFile(const std::string& path, const char* modestr) {
-  return OwnedFile(fopen(path.c_str(), modestr), fclose);
+FatDirIterImpl::FatDirIterImpl(const char* fatfs_path, FatDirFilter filter)
+    : filter_(std::move(filter)) {
+  const FRESULT result = f_opendir(&dir_, fatfs_path);
+  if (result != FR_OK) {
+    ESP_LOGE(TAG, "f_opendir(%s) => %d", fatfs_path, result);
+    error_ = ESP_FAIL;
+    return;
+  }
+  open_ = true;
+}
+
+FatDirIterImpl::~FatDirIterImpl() {
+  if (open_) {
+    (void)f_closedir(&dir_);
+  }
+}
+
+std::optional<const FatDirEntry*> FatDirIterImpl::Next() {
+  while (open_) {
+    const FRESULT result = f_readdir(&dir_, &info_);
+    if (result != FR_OK || info_.fname[0] == '\0') {
+      if (result != FR_OK) {
+        ESP_LOGE(TAG, "f_readdir => %d", result);
+        error_ = ESP_FAIL;
+      }
+      (void)f_closedir(&dir_);
+      open_ = false;
+      break;
+    }
+    entry_ = {
+        .name = info_.fname,
+        .size = info_.fsize,
+        .attrib = info_.fattrib,
+        .fdate = info_.fdate,
+        .ftime = info_.ftime,
+    };
+    if (!filter_ || filter_(entry_)) {
+      return &entry_;
+    }
+  }
+  return std::nullopt;
+}
+
+esp_err_t ListFatDirSorted(
+    const char* fatfs_path,
+    const FatDirFilter& filter,
+    const FatDirLess& less,
+    size_t limit,
+    std::vector<FatDirRecord>* out) {
+  CHECK(out != nullptr);
+  out->clear();
+  if (limit == 0) {
+    return ESP_OK;
+  }
+  // max-heap on `less`: the front is the entry that drops out first once the heap is full
+  const auto heap_less = [&less](const FatDirRecord& a, const FatDirRecord& b) {
+    return less(a.entry(), b.entry());
+  };
+  FatDirIterImpl iter(fatfs_path, filter);
+  while (const std::optional<const FatDirEntry*> e = iter.Next()) {
+    if (out->size() < limit) {
+      out->emplace_back(**e);
+      std::push_heap(out->begin(), out->end(), heap_less);
+    } else if (less(**e, out->front().entry())) {
+      std::pop_heap(out->begin(), out->end(), heap_less);
+      out->back() = FatDirRecord(**e);
+      std::push_heap(out->begin(), out->end(), heap_less);
+    }
+  }
+  std::sort_heap(out->begin(), out->end(), heap_less);
+  return iter.error();
 }
 
 esp_err_t ReadBinaryFileToString(const std::string& path, std::string* out_file_content) {
   ESP_LOGI(TAG, "ReadBinaryFileToString(%s)", path.c_str());
-  OwnedFile f = OpenFile(path, "rb");
-  if (!f) {
+  // read the descriptor directly: no stdio buffer
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
     ESP_LOGE(TAG, "ReadBinaryFileToString(%s) => %s", path.c_str(), strerror(errno));
     return ESP_ERR_NOT_FOUND;
   }
-  FILE* const ff = f.get();
-  if (fseek(ff, 0, SEEK_END) != 0) {
+  SCOPE_EXIT { (void)close(fd); };
+  struct stat s {};
+  if (fstat(fd, &s) != 0 || s.st_size < 0) {
     return ESP_FAIL;
   }
-  auto len = ftell(ff);
-  if (len < 0) {
-    return ESP_FAIL;
+  const size_t len = static_cast<size_t>(s.st_size);
+  ESP_LOGI(TAG, "file len: %d", static_cast<int>(len));
+  out_file_content->resize(len);
+  return ReadFdFully(fd, out_file_content->data(), len);
+}
+
+esp_err_t ReadBinaryFile(const char* path, Arena* arena, std::string_view* out_file_content) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "ReadBinaryFile(%s) => %s", path, strerror(errno));
+    return ESP_ERR_NOT_FOUND;
   }
-  if (fseek(ff, 0, SEEK_SET) != 0) {
+  SCOPE_EXIT { (void)close(fd); };
+  struct stat s {};
+  if (fstat(fd, &s) != 0 || s.st_size < 0) {
     return ESP_FAIL;
   }
-  ESP_LOGI(TAG, "file len: %d", static_cast<int>(len));
-  out_file_content->resize(static_cast<size_t>(len));
-  if (len > 0) {
-    if (fread(out_file_content->data(), len, 1, ff) != 1) {
-      return ESP_FAIL;
-    }
+  const size_t len = static_cast<size_t>(s.st_size);
+  char* const data = arena->AllocateArray<char>(len);
+  if (!data && len) {
+    return ESP_ERR_NO_MEM;
   }
+  TRY(ReadFdFully(fd, data, len));
+  *out_file_content = std::string_view(data, len);
   return ESP_OK;
 }
 
@@ -134,4 +254,29 @@ int64_t GetFreeSpaceBytes(const char* fatfs_root) {
   return int64_t{clust} * fatfs->csize * kSdSectorSize;
 }
 
+FatVolumeLock::FatVolumeLock(FATFS* fs) : fs_(fs) {
+  if (!fs_) {
+    return;
+  }
+#if FF_DEFINED == 80286  // R0.15: the mutexes are kept by ffsystem.c, one per logical drive
+  const bool ok = ff_mutex_take(fs_->pdrv);
+#else
+  const bool ok = ff_req_grant(fs_->sobj);
+#endif  // FF_DEFINED
+  if (!ok) {
+    fs_ = nullptr;
+  }
+}
+
+FatVolumeLock::~FatVolumeLock() {
+  if (!fs_) {
+    return;
+  }
+#if FF_DEFINED == 80286
+  ff_mutex_give(fs_->pdrv);
+#else
+  ff_rel_grant(fs_->sobj);
+#endif  // FF_DEFINED
+}
+
 }  // namespace io
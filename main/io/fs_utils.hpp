@@ -11,27 +11,29 @@ extern "C" {
 
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <initializer_list>
 #include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "driver/sdmmc_host.h"
 #include "esp_err.h"
 #include "ff.h"
 
 #include "common/iter.hpp"
+#include "common/macros.hpp"
+#include "common/memory_pool.hpp"
 #include "common/times.hpp"
+#include "io/file.hpp"
 
 namespace io {
 
 // We won't be dealing with permissions
 constexpr mode_t kFsMode = 0777;
 
-// Fixed value for SDHC/SDXC
-constexpr int kSdSectorSize = 512;
-
 // Root directories (without trailing slashes)
 #define SD_FATFS_ROOT "0:"
 #define SD_VFS_ROOT CONFIG_MOUNT_ROOT
@@ -43,7 +45,7 @@ class DirIterImpl {
  public:
   using Item = dirent*;
   DirIterImpl() = default;
-  DirIterImpl(const char* path) : dir_(opendir(path)) {}
+  DirIterImpl(const char* path) : dir_(path ? opendir(path) : nullptr) {}
   ~DirIterImpl() {
     if (dir_) {
       (void)closedir(dir_);
@@ -76,13 +78,120 @@ class DirIter : public RustIter<DirIterImpl> {
   explicit DirIter(const char* path) : RustIter<DirIterImpl>(path) {}
   /// \param path   absolute path string
   explicit DirIter(const std::string& path) : DirIter(path.c_str()) {}
+  /// \param path   absolute path string; copied null-terminated into `arena` (e.g. `CommandArena`)
+  DirIter(std::string_view path, Arena* arena) : DirIter(arena->Concat({path}).data()) {}
+};
+
+/// Translates a VFS path (e.g. "/s/logs") into the corresponding FATFS path (e.g. "0:/logs").
+///
+/// \return empty if `vfs_path` is not under `kVfsRoot`
+std::string ToFatfsPath(std::string_view vfs_path);
+/// Like above, but the result is allocated from `arena` instead of the heap.
+///
+/// \return null-terminated; nullptr if `vfs_path` is not under `kVfsRoot` (or out of memory)
+const char* ToFatfsPath(std::string_view vfs_path, Arena* arena);
+
+/// One directory entry as stored by FAT: everything `ls` needs comes with the entry itself, so
+/// there is no `stat` (i.e. no second directory lookup) per file.
+struct FatDirEntry {
+  std::string_view name;
+  uint64_t size;
+  uint8_t attrib;  // `AM_*`
+  uint16_t fdate;  // FAT date, see `FromFat32DateTime`
+  uint16_t ftime;  // FAT time
+
+  bool is_dir() const { return attrib & AM_DIR; }
+  TimeParts mtime() const { return FromFat32DateTime(fdate, ftime); }
+  /// Date and time packed into one integer that sorts chronologically.
+  uint32_t fat_datetime() const { return (uint32_t{fdate} << 16) | ftime; }
 };
 
-using OwnedFile = std::unique_ptr<FILE, decltype(&fclose)>;
+/// \return true to keep the entry
+using FatDirFilter = std::function<bool(const FatDirEntry&)>;
+/// Strict weak ordering of entries
+using FatDirLess = std::function<bool(const FatDirEntry&, const FatDirEntry&)>;
+
+/// Implementation for `FatDirIter`
+class FatDirIterImpl {
+ public:
+  using Item = const FatDirEntry*;
+
+  /// \param fatfs_path  FATFS path, e.g. "0:/logs" (see `ToFatfsPath`)
+  /// \param filter      if set, entries it rejects are skipped
+  explicit FatDirIterImpl(const char* fatfs_path, FatDirFilter filter = {});
+  ~FatDirIterImpl();
+
+  std::optional<const FatDirEntry*> Next();
+
+  /// \return `ESP_OK` unless opening or reading the directory has failed
+  esp_err_t error() const { return error_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(FatDirIterImpl)
+
+ private:
+  FF_DIR dir_;
+  FILINFO info_;      // reused for every entry; `entry_.name` points into it
+  FatDirEntry entry_;
+  FatDirFilter filter_;
+  bool open_ = false;
+  esp_err_t error_ = ESP_OK;
+};
+
+/// Iterator/Iterable for listing items in a FATFS dir with their metadata. Wraps over `f_opendir`
+/// and `f_readdir`, bypassing VFS. Entries come in directory order; "." and ".." are not included.
+///
+/// The yielded entry (including its name) is only valid until the iterator advances.
+///
+/// \example
+/// \code{.cpp}
+/// for (const io::FatDirEntry* e : io::FatDirIter("0:/logs")) {
+///   printf("%.*s %llu\n", (int)e->name.size(), e->name.data(), e->size);
+/// }
+/// \endcode
+///
+/// \see FatDirIterImpl
+using FatDirIter = RustIter<FatDirIterImpl>;
+
+/// Owning copy of a `FatDirEntry`, for entries that must outlive the iteration.
+struct FatDirRecord {
+  std::string name;
+  uint64_t size;
+  uint8_t attrib;
+  uint16_t fdate;
+  uint16_t ftime;
+
+  explicit FatDirRecord(const FatDirEntry& e)
+      : name(e.name), size(e.size), attrib(e.attrib), fdate(e.fdate), ftime(e.ftime) {}
+  FatDirEntry entry() const { return {name, size, attrib, fdate, ftime}; }
+};
+
+/// Reads a FATFS dir in one pass and keeps the first `limit` entries (those accepted by `filter`)
+/// in `less` order. Only `limit` entries are held at any time (bounded heap), so memory stays
+/// O(limit) and time O(n log limit) no matter how large the directory is.
+///
+/// \param out  sorted by `less`; replaced
+esp_err_t ListFatDirSorted(
+    const char* fatfs_path,
+    const FatDirFilter& filter,
+    const FatDirLess& less,
+    size_t limit,
+    std::vector<FatDirRecord>* out);
+
+/// Common orderings for `ListFatDirSorted`
+namespace fat_dir_order {
+inline bool ByName(const FatDirEntry& a, const FatDirEntry& b) { return a.name < b.name; }
+inline bool BySize(const FatDirEntry& a, const FatDirEntry& b) { return a.size < b.size; }
+inline bool ByTime(const FatDirEntry& a, const FatDirEntry& b) {
+  return a.fat_datetime() < b.fat_datetime();
+}
+}  // namespace fat_dir_order
 
-OwnedFile OpenFile(const std::string& path, const char* modestr);
 esp_err_t ReadBinaryFileToString(const std::string& path, std::string* out_file_content);
-esp_err_t FlushAndSync(FILE* f);
+/// Reads a whole file into memory allocated from `arena`. Unlike `ReadBinaryFileToString`, the
+/// memory is not zero-filled before being read into, and is freed along with the arena.
+///
+/// \param out_file_content  points into `arena`; valid until it is reset
+esp_err_t ReadBinaryFile(const char* path, Arena* arena, std::string_view* out_file_content);
 
 esp_err_t Mkdir(const std::string& dir);
 esp_err_t MkdirParts(std::initializer_list<std::string_view> parts, std::string* out_path);
@@ -92,4 +201,30 @@ esp_err_t UpdateFileTime(const std::string& path, TimeUnix t_unix);
 int32_t GetFreeSpaceSectors(const char* fatfs_root = kFatfsRoot);
 int64_t GetFreeSpaceBytes(const char* fatfs_root = kFatfsRoot);
 
+/// Holds the mutex FATFS takes around every operation on the volume of `fs`: while it is held, no
+/// FATFS operation --- hence no SDMMC transfer on its behalf --- is in progress or can start.
+/// Waits at most `FF_FS_TIMEOUT`, like FATFS itself.
+///
+/// \example
+/// \code{.cpp}
+/// io::FatVolumeLock lock(fatfs);
+/// if (!lock.locked()) {
+///   return ESP_ERR_TIMEOUT;
+/// }
+/// \endcode
+class FatVolumeLock {
+ public:
+  /// \param fs  nullptr => not locked
+  explicit FatVolumeLock(FATFS* fs);
+  ~FatVolumeLock();
+
+  /// \return false if `fs` was null or the wait timed out
+  bool locked() const { return fs_ != nullptr; }
+
+  NOT_COPYABLE_NOR_MOVABLE(FatVolumeLock)
+
+ private:
+  FATFS* fs_;
+};
+
 }  // namespace io
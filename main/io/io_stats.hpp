@@ -0,0 +1,175 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#endif  // ESP_PLATFORM
+
+#include "common/histogram.hpp"
+#include "common/macros.hpp"
+#include "common/times.hpp"
+
+namespace io {
+
+/// Kinds of storage calls tracked by `IoStats`.
+enum class IoOp : uint8_t {
+  kWrite,  ///< handing data to the file system / card (`fwrite`, `f_write`, sector writes)
+  kSync,   ///< making it durable (`FlushAndSync`, `f_sync`)
+};
+constexpr int kNumIoOps = 2;
+
+inline const char* IoOpName(IoOp op) { return op == IoOp::kWrite ? "write" : "sync"; }
+
+/// Process-wide latency statistics of the write paths in `io`, kept continuously so that write
+/// buffers can be sized from what the cards in the field actually do.
+///
+/// Every call is recorded into a fixed `LatencyHistogram` per core and per `IoOp` (relaxed atomics:
+/// no lock, no allocation, and the two cores never touch the same counters). Calls that take at
+/// least `stall_threshold_us` are also counted as stalls, and the most recent `kStallRingSize`
+/// stalls per core are kept with their start time. On a Linux host everything is attributed to
+/// core 0.
+class IoStats {
+ public:
+#ifdef ESP_PLATFORM
+  static constexpr int kMaxCores = portNUM_PROCESSORS;
+#else
+  static constexpr int kMaxCores = 1;
+#endif  // ESP_PLATFORM
+  static constexpr int kStallRingSize = 16;
+  static constexpr uint32_t kDefaultStallThresholdUs = 50'000;
+
+  struct Stall {
+    int64_t start_us;  ///< `NowMonotonicUs()` when the call started
+    uint32_t latency_us;
+    IoOp op;
+    uint8_t core;
+  };
+
+  static IoStats& Get() {
+    static IoStats instance;
+    return instance;
+  }
+
+  void Record(IoOp op, uint32_t latency_us) {
+    const int core = CurrentCore();
+    PerCore& c = per_core_[core];
+    c.hist[static_cast<int>(op)].Record(latency_us);
+    if (latency_us >= stall_threshold_us_.load(std::memory_order_relaxed)) {
+      // each stall claims its own slot, so concurrent recorders on one core do not collide
+      const uint32_t i = c.num_stalls.fetch_add(1, std::memory_order_relaxed);
+      c.stalls[i % kStallRingSize] = {
+          .start_us = NowMonotonicUs() - latency_us,
+          .latency_us = latency_us,
+          .op = op,
+          .core = static_cast<uint8_t>(core),
+      };
+    }
+  }
+
+  /// Clears all histograms and stalls (the threshold is kept).
+  void Reset() {
+    for (PerCore& c : per_core_) {
+      for (LatencyHistogram& h : c.hist) {
+        h.Reset();
+      }
+      c.num_stalls.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t stall_threshold_us() const { return stall_threshold_us_.load(); }
+  void set_stall_threshold_us(uint32_t us) { stall_threshold_us_.store(us); }
+
+  const LatencyHistogram& hist(int core, IoOp op) const {
+    return per_core_[core].hist[static_cast<int>(op)];
+  }
+
+  /// Adds up `op` over all cores into `out`, which is reset first.
+  void MergeHist(IoOp op, LatencyHistogram* out) const {
+    out->Reset();
+    for (const PerCore& c : per_core_) {
+      out->Merge(c.hist[static_cast<int>(op)]);
+    }
+  }
+
+  /// \return stalls since the last `Reset`, including those no longer in the rings
+  uint32_t num_stalls() const {
+    uint32_t n = 0;
+    for (const PerCore& c : per_core_) {
+      n += c.num_stalls.load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+  /// Calls `f(const Stall&)` for each stall still in the rings, per core from oldest to newest.
+  /// An entry being written at the same time may be seen half-updated.
+  template <typename F>
+  void ForEachStall(F&& f) const {
+    for (const PerCore& c : per_core_) {
+      const uint32_t n = c.num_stalls.load(std::memory_order_relaxed);
+      for (uint32_t i = n > kStallRingSize ? n - kStallRingSize : 0; i < n; i++) {
+        f(c.stalls[i % kStallRingSize]);
+      }
+    }
+  }
+
+ private:
+  struct PerCore {
+    LatencyHistogram hist[kNumIoOps];
+    std::atomic<uint32_t> num_stalls{0};
+    Stall stalls[kStallRingSize] = {};
+  };
+
+  PerCore per_core_[kMaxCores];
+  std::atomic<uint32_t> stall_threshold_us_{kDefaultStallThresholdUs};
+
+  IoStats() = default;
+
+  static int CurrentCore() {
+#ifdef ESP_PLATFORM
+    return xPortGetCoreID();
+#else
+    return 0;
+#endif  // ESP_PLATFORM
+  }
+};
+
+/// Records the lifetime of the scope into `IoStats` as one `op` call.
+///
+/// \example
+/// \code{.cpp}
+/// {
+///   io::ScopedIoTimer timer(io::IoOp::kWrite);
+///   n = fwrite(data, 1, size, f);
+/// }
+/// \endcode
+class ScopedIoTimer {
+ public:
+  explicit ScopedIoTimer(IoOp op) : op_(op), t0_(NowMonotonicUs()) {
+    if (op_ == IoOp::kWrite) {
+      TRACE_BEGIN(kIoWrite, 0);
+    } else {
+      TRACE_BEGIN(kIoSync, 0);
+    }
+  }
+  ~ScopedIoTimer() {
+    IoStats::Get().Record(op_, NowMonotonicUs() - t0_);
+    if (op_ == IoOp::kWrite) {
+      TRACE_END(kIoWrite);
+    } else {
+      TRACE_END(kIoSync);
+    }
+  }
+
+  NOT_COPYABLE_NOR_MOVABLE(ScopedIoTimer)
+
+ private:
+  IoOp op_;
+  int64_t t0_;
+};
+
+}  // namespace io
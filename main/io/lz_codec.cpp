@@ -0,0 +1,220 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/lz_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/macros.hpp"
+#include "common/utils.hpp"
+
+namespace io {
+
+namespace {
+
+constexpr int kRunMask = 15;
+// After this many consecutive misses (in units of 1/64), start skipping ahead faster, so that
+// incompressible data costs little more than a memcpy.
+constexpr int kSkipTrigger = 6;
+
+inline uint32_t Read32(const uint8_t* p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+inline uint32_t Hash(uint32_t seq, int hash_log) { return (seq * 2654435761u) >> (32 - hash_log); }
+
+/// Writes the extension bytes of a length whose nibble was saturated.
+inline uint8_t* PutLengthExt(uint8_t* op, const uint8_t* oend, int len) {
+  while (len >= 255) {
+    if (op >= oend) {
+      return nullptr;
+    }
+    *op++ = 255;
+    len -= 255;
+  }
+  if (op >= oend) {
+    return nullptr;
+  }
+  *op++ = static_cast<uint8_t>(len);
+  return op;
+}
+
+/// Reads the extension bytes of a length whose nibble was saturated.
+inline const uint8_t* GetLengthExt(const uint8_t* ip, const uint8_t* iend, int limit, int* len) {
+  uint8_t b;
+  do {
+    if (ip >= iend) {
+      return nullptr;
+    }
+    b = *ip++;
+    *len += b;
+    if (*len > limit) {
+      return nullptr;
+    }
+  } while (b == 255);
+  return ip;
+}
+
+/// Emits one sequence. `match_len == 0` marks the final, literal-only sequence.
+/// \return new output pointer; `nullptr` if out of space
+uint8_t* PutSequence(
+    uint8_t* op,
+    const uint8_t* oend,
+    const uint8_t* literals,
+    int literal_len,
+    int offset,
+    int match_len) {
+  const int lit_nibble = std::min(literal_len, kRunMask);
+  const int match_nibble = match_len ? std::min(match_len - LzCodec::kMinMatch, kRunMask) : 0;
+  if (op >= oend) {
+    return nullptr;
+  }
+  *op++ = static_cast<uint8_t>((lit_nibble << 4) | match_nibble);
+  if (lit_nibble == kRunMask && !(op = PutLengthExt(op, oend, literal_len - kRunMask))) {
+    return nullptr;
+  }
+  if (oend - op < literal_len) {
+    return nullptr;
+  }
+  memcpy(op, literals, literal_len);
+  op += literal_len;
+  if (!match_len) {
+    return op;
+  }
+  if (oend - op < 2) {
+    return nullptr;
+  }
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  if (match_nibble == kRunMask &&
+      !(op = PutLengthExt(op, oend, match_len - LzCodec::kMinMatch - kRunMask))) {
+    return nullptr;
+  }
+  return op;
+}
+
+}  // namespace
+
+LzCodec::LzCodec(int window_log, int hash_log)
+    : window_log_(window_log),
+      hash_log_(hash_log),
+      table_{std::make_unique<uint16_t[]>(size_t{1} << hash_log)} {
+  CHECK(IsValidParams(window_log, hash_log));
+}
+
+int LzCodec::Compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity) {
+  CHECK(0 <= src_size && src_size <= kMaxBlockSize);
+  uint16_t* const table = table_.get();
+  std::fill_n(table, size_t{1} << hash_log_, uint16_t{0});
+
+  // offsets are stored as u16, so a 64 KiB window is capped to 65535
+  const int max_distance = (1 << window_log_) - 1;
+  const uint8_t* const iend = src + src_size;
+  const uint8_t* ip = src;
+  const uint8_t* anchor = src;
+  uint8_t* op = dst;
+  const uint8_t* const oend = dst + dst_capacity;
+
+  if (src_size >= kMinMatch) {
+    const uint8_t* const search_end = iend - kMinMatch;
+    int step_counter = 1 << kSkipTrigger;
+    while (ip <= search_end) {
+      const uint32_t seq = Read32(ip);
+      uint16_t& slot = table[Hash(seq, hash_log_)];
+      const uint8_t* ref = src + slot;
+      slot = static_cast<uint16_t>(ip - src);
+      if (ref >= ip || ip - ref > max_distance || Read32(ref) != seq) {
+        ip += step_counter++ >> kSkipTrigger;
+        continue;
+      }
+      // extend backwards into pending literals, then forwards
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      const uint8_t* mp = ip + kMinMatch;
+      const uint8_t* rp = ref + kMinMatch;
+      while (mp < iend && *mp == *rp) {
+        ++mp;
+        ++rp;
+      }
+      op = PutSequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+      if (!op) {
+        return -1;
+      }
+      ip = anchor = mp;
+      step_counter = 1 << kSkipTrigger;
+      // prime the table with a position inside the match, which helps runs of repeated records
+      if (ip - 2 <= search_end) {
+        table[Hash(Read32(ip - 2), hash_log_)] = static_cast<uint16_t>(ip - 2 - src);
+      }
+    }
+  }
+
+  op = PutSequence(op, oend, anchor, iend - anchor, /*offset*/ 0, /*match_len*/ 0);
+  if (!op) {
+    return -1;
+  }
+  return op - dst;
+}
+
+int LzCodec::Decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity) {
+  const uint8_t* ip = src;
+  const uint8_t* const iend = src + src_size;
+  uint8_t* op = dst;
+  uint8_t* const oend = dst + dst_capacity;
+
+  while (true) {
+    if (ip >= iend) {
+      return -1;
+    }
+    const uint8_t token = *ip++;
+
+    int literal_len = token >> 4;
+    if (literal_len == kRunMask && !(ip = GetLengthExt(ip, iend, dst_capacity, &literal_len))) {
+      return -1;
+    }
+    if (iend - ip < literal_len || oend - op < literal_len) {
+      return -1;
+    }
+    memcpy(op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+    if (ip == iend) {
+      break;  // last sequence
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    const int offset = Uint16LeAt(ip);
+    ip += 2;
+    if (offset == 0 || offset > op - dst) {
+      return -1;
+    }
+    int match_len = token & kRunMask;
+    if (match_len == kRunMask && !(ip = GetLengthExt(ip, iend, dst_capacity, &match_len))) {
+      return -1;
+    }
+    match_len += kMinMatch;
+    if (oend - op < match_len) {
+      return -1;
+    }
+    const uint8_t* match = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, match, match_len);
+      op += match_len;
+    } else {
+      // overlapping copy, e.g. a run of one repeated byte
+      for (int i = 0; i < match_len; i++) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op - dst;
+}
+
+}  // namespace io
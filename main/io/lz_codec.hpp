@@ -0,0 +1,73 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+namespace io {
+
+/// Byte-oriented LZ77 block codec with a bounded match window and a fixed working set (one hash
+/// table of `2^hash_log` 16-bit positions). Each block is self-contained: no state is carried
+/// from one `Compress` call to the next.
+///
+/// Block format (LZ4-style, not LZ4-compatible): a sequence of
+///
+///     token:u8 | [literal length ext] | literals | offset:u16le | [match length ext]
+///
+/// where the high nibble of `token` is the literal length and the low nibble is
+/// (match length - `kMinMatch`). A nibble value of 15 is followed by extension bytes that are
+/// summed until a byte other than 255. The last sequence carries literals only (no offset), and
+/// ends exactly at the end of the block.
+class LzCodec {
+ public:
+  static constexpr int kMinMatch = 4;
+  static constexpr int kMinWindowLog = 10;
+  static constexpr int kMaxWindowLog = 16;
+  static constexpr int kMinHashLog = 8;
+  static constexpr int kMaxHashLog = 16;
+  /// Positions are stored as `uint16_t`, so one block cannot span more than this.
+  static constexpr int kMaxBlockSize = 64 * 1024;
+
+  /// \param window_log   log2 of the match window in bytes (e.g. 12 => 4 KiB)
+  /// \param hash_log     log2 of the number of hash table entries (working set = 2 << hash_log)
+  explicit LzCodec(int window_log = 12, int hash_log = 12);
+
+  /// \return true if the constructor accepts these parameters (it aborts otherwise)
+  static constexpr bool IsValidParams(int window_log, int hash_log) {
+    return kMinWindowLog <= window_log && window_log <= kMaxWindowLog && kMinHashLog <= hash_log &&
+           hash_log <= kMaxHashLog;
+  }
+
+  /// Upper bound of the compressed size of a block of `src_size` bytes.
+  static constexpr int CompressBound(int src_size) { return src_size + src_size / 255 + 16; }
+
+  /// Compresses one block.
+  ///
+  /// \param src_size       at most `kMaxBlockSize`
+  /// \param dst_capacity   compression is abandoned as soon as the output would exceed this
+  /// \return compressed size in bytes;
+  ///         -1 if the output does not fit in `dst_capacity`
+  int Compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity);
+
+  /// Decompresses one block produced by `Compress`. Never reads or writes out of bounds, even on
+  /// corrupted input.
+  ///
+  /// \return decompressed size in bytes;
+  ///         -1 if the input is malformed or does not fit in `dst_capacity`
+  static int Decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity);
+
+  int window_log() const { return window_log_; }
+  int hash_log() const { return hash_log_; }
+
+  /// \return bytes of working memory owned by this codec
+  int working_set_size() const { return int{sizeof(uint16_t)} << hash_log_; }
+
+ private:
+  int window_log_;
+  int hash_log_;
+  std::unique_ptr<uint16_t[]> table_;
+};
+
+}  // namespace io
@@ -0,0 +1,159 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/preallocated_file.hpp"
+
+#include "esp_log.h"
+#include "scope_guard/scope_guard.hpp"
+
+#include "io/dma_buffer.hpp"
+#include "io/fs_utils.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "prealloc";
+
+}  // namespace
+
+PreallocatedFile::PreallocatedFile(const std::string& path, Option option)
+    : fatfs_path_(ToFatfsPath(path)), option_(option) {}
+
+PreallocatedFile::~PreallocatedFile() { (void)Close(); }
+
+esp_err_t PreallocatedFile::Setup() {
+  if (fatfs_path_.empty()) {
+    ESP_LOGE(TAG, "not on the SD card");
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (const FRESULT result = f_open(&fil_, fatfs_path_.c_str(), FA_WRITE | FA_CREATE_ALWAYS);
+      result != FR_OK) {
+    ESP_LOGE(TAG, "f_open(%s) => %d", fatfs_path_.c_str(), result);
+    return ESP_FAIL;
+  }
+  open_ = true;
+  if (option_.reserve_size == 0) {
+    return ESP_OK;
+  }
+
+  // opt = 1: allocate now, as one contiguous run of clusters (the file must still be empty)
+  const FRESULT result = f_expand(&fil_, option_.reserve_size, 1);
+  if (result == FR_OK) {
+    reserved_size_ = option_.reserve_size;
+    return ESP_OK;
+  }
+  ESP_LOGW(
+      TAG,
+      "f_expand(%s, %llu) => %d",
+      fatfs_path_.c_str(),
+      static_cast<unsigned long long>(option_.reserve_size),
+      result);
+  if (result == FR_DENIED && !option_.require_contiguous) {
+    return ESP_OK;  // no contiguous space; carry on without
+  }
+  (void)f_close(&fil_);
+  open_ = false;
+  (void)f_unlink(fatfs_path_.c_str());
+  return result == FR_DENIED ? ESP_ERR_NO_MEM : ESP_FAIL;
+}
+
+esp_err_t PreallocatedFile::Write(const void* data, size_t size) {
+  if (!open_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  UINT written = 0;
+  FRESULT result;
+  {
+    ScopedIoTimer timer(IoOp::kWrite);
+    result = f_write(&fil_, data, size, &written);
+  }
+  DmaStats::Get().RecordTransfer(data, written, size_);
+  size_ += written;
+  if (result != FR_OK || written != size) {
+    // a short write without an error means the volume is full
+    ESP_LOGE(TAG, "f_write(%u) => %d, %u written", unsigned(size), result, unsigned(written));
+    return result == FR_OK ? ESP_ERR_NO_MEM : ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t PreallocatedFile::Sync() {
+  if (!open_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  ScopedIoTimer timer(IoOp::kSync);
+  if (const FRESULT result = f_sync(&fil_); result != FR_OK) {
+    ESP_LOGE(TAG, "f_sync => %d", result);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t PreallocatedFile::Close() {
+  if (!open_) {
+    return ESP_OK;
+  }
+  open_ = false;
+  // the file pointer is at the end of the written data; give back the rest of the extent
+  FRESULT result = f_truncate(&fil_);
+  if (result != FR_OK) {
+    ESP_LOGE(TAG, "f_truncate(%s) => %d", fatfs_path_.c_str(), result);
+  }
+  if (const FRESULT close_result = f_close(&fil_); close_result != FR_OK) {
+    ESP_LOGE(TAG, "f_close(%s) => %d", fatfs_path_.c_str(), close_result);
+    result = close_result;
+  }
+  return result == FR_OK ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t ReserveContiguousFile(
+    const std::string& path, uint64_t size, uint32_t* out_first_sector, uint32_t* out_num_sectors) {
+  CHECK(out_first_sector != nullptr && out_num_sectors != nullptr);
+  const std::string fatfs_path = ToFatfsPath(path);
+  if (fatfs_path.empty() || size < kSdSectorSize) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  FIL fil;
+  if (const FRESULT result = f_open(&fil, fatfs_path.c_str(), FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+      result != FR_OK) {
+    ESP_LOGE(TAG, "f_open(%s) => %d", fatfs_path.c_str(), result);
+    return ESP_FAIL;
+  }
+  SCOPE_EXIT { (void)f_close(&fil); };
+
+  if (f_size(&fil) == 0) {
+    if (const FRESULT result = f_expand(&fil, size, 1); result != FR_OK) {
+      ESP_LOGE(
+          TAG,
+          "f_expand(%s, %llu) => %d",
+          fatfs_path.c_str(),
+          static_cast<unsigned long long>(size),
+          result);
+      return result == FR_DENIED ? ESP_ERR_NO_MEM : ESP_FAIL;
+    }
+  } else if (f_size(&fil) != size) {
+    ESP_LOGE(TAG, "%s exists with a different size", fatfs_path.c_str());
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // an existing file may not be contiguous: follow the cluster chain (FAT sectors are cached, so
+  // this is cheap compared to the data it covers)
+  const FATFS* const fs = fil.obj.fs;
+  const DWORD first_cluster = fil.obj.sclust;
+  const uint64_t cluster_size = uint64_t{fs->csize} * kSdSectorSize;
+  for (uint64_t k = 1; k * cluster_size < size; k++) {
+    if (f_lseek(&fil, k * cluster_size + 1) != FR_OK || fil.clust != first_cluster + k) {
+      ESP_LOGE(TAG, "%s is fragmented", fatfs_path.c_str());
+      return ESP_ERR_INVALID_STATE;
+    }
+  }
+
+  // cluster numbers start at 2 (see FATFS `clst2sect`)
+  *out_first_sector = fs->database + (first_cluster - 2) * fs->csize;
+  *out_num_sectors = static_cast<uint32_t>(size / kSdSectorSize);
+  return ESP_OK;
+}
+
+}  // namespace io
@@ -0,0 +1,98 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "esp_err.h"
+#include "ff.h"
+
+#include "common/macros.hpp"
+
+namespace io {
+
+/// Write-only file on FATFS whose clusters are allocated up front as one contiguous extent
+/// (`f_expand`), for logs of known or estimated size.
+///
+/// Growing a file through `fwrite` makes FATFS allocate one cluster at a time: every new cluster
+/// means a FAT read-modify-write and a directory update interleaved with the data, which shows up
+/// as latency spikes and leaves the file fragmented. Here all of that happens once in `Create`;
+/// appends within the extent only write data (whole sectors at sector-aligned offsets go straight
+/// from the caller's buffer to the card). `Close` truncates the file to the bytes actually written.
+///
+/// Appends past the extent still work; FATFS then falls back to allocating cluster by cluster.
+///
+/// NOTE: Until `Close`, the size recorded on the card is the whole extent (this includes after
+/// `Sync`, and after a power loss), so the tail beyond the written data is stale. Readers of a
+/// file that was never closed need to find the end of the data from its content.
+///
+/// NOTE: Bypasses VFS (talks to FATFS directly), so it does not count against `max_files`.
+///
+/// \example
+/// \code{.cpp}
+/// io::PreallocatedFile::Option option{.reserve_size = 64 << 20};
+/// auto file = io::PreallocatedFile::Create("/s/log/imu.bin", option);
+/// file->Write(block, sizeof(block));
+/// file->Close();
+/// \endcode
+class PreallocatedFile {
+ public:
+  struct Option {
+    /// bytes to allocate up front (rounded up to whole clusters); 0 => no preallocation
+    uint64_t reserve_size = 0;
+    /// fail `Create` if no contiguous extent of `reserve_size` is free, instead of going on
+    /// without preallocation
+    bool require_contiguous = false;
+  };
+
+  DEFINE_CREATE(PreallocatedFile)
+  ~PreallocatedFile();
+
+  /// Appends `size` bytes.
+  esp_err_t Write(const void* data, size_t size);
+
+  /// Commits the data written so far (`f_sync`); see the note on file size above.
+  esp_err_t Sync();
+
+  /// Truncates the file to the bytes written and closes it.
+  esp_err_t Close();
+
+  /// \return bytes written so far
+  uint64_t size() const { return size_; }
+  /// \return size of the preallocated extent; 0 if none
+  uint64_t reserved_size() const { return reserved_size_; }
+  /// \return bytes written past the preallocated extent (allocated cluster by cluster)
+  uint64_t overflow_size() const { return size_ > reserved_size_ ? size_ - reserved_size_ : 0; }
+
+  NOT_COPYABLE_NOR_MOVABLE(PreallocatedFile)
+
+ private:
+  std::string fatfs_path_;
+  Option option_;
+  FIL fil_;
+  bool open_ = false;
+  uint64_t reserved_size_ = 0;
+  uint64_t size_ = 0;
+
+  /// \param path  VFS path, e.g. "/s/log.bin"; the file is created or truncated
+  PreallocatedFile(const std::string& path, Option option);
+  esp_err_t Setup();
+};
+
+/// Makes sure `path` is a file of exactly `size` bytes stored in one contiguous run of sectors
+/// (creating it with `f_expand` if it does not exist or is empty), and finds where that run is on
+/// the card. The file is left closed, so its sectors can then be used directly, e.g. through
+/// `SdmmcBlockDevice`, while FATFS keeps them allocated.
+///
+/// \param out_first_sector  absolute sector on the card where the file starts
+/// \param out_num_sectors   `size / kSdSectorSize`
+/// \return `ESP_ERR_INVALID_SIZE` if the file exists with a different size;
+///         `ESP_ERR_INVALID_STATE` if it exists but is fragmented
+esp_err_t ReserveContiguousFile(
+    const std::string& path, uint64_t size, uint32_t* out_first_sector, uint32_t* out_num_sectors);
+
+}  // namespace io
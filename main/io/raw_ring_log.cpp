@@ -0,0 +1,250 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/raw_ring_log.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_random.h"
+#else
+#include <random>
+#endif  // ESP_PLATFORM
+
+#include "common/crc32.hpp"
+#include "common/times.hpp"
+#include "common/utils.hpp"
+#include "io/io_stats.hpp"
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "raw_log";
+
+uint32_t NewLogId() {
+#ifdef ESP_PLATFORM
+  return esp_random();
+#else
+  return std::random_device{}();
+#endif  // ESP_PLATFORM
+}
+
+constexpr int kHeaderCrcOffset = kRawLogHeaderSize - 4;
+
+}  // namespace
+
+void EncodeRawLogHeader(const RawLogSegmentHeader& header, uint8_t* out) {
+  const uint8_t bytes[kHeaderCrcOffset] = {
+      kRawLogMagic[0],
+      kRawLogMagic[1],
+      kRawLogMagic[2],
+      kRawLogMagic[3],
+      kRawLogVersion,
+      kRawLogHeaderSize,
+      UINT16_LE_BYTES(header.segment_sectors),
+      UINT32_LE_BYTES(header.log_id),
+      UINT32_LE_BYTES(header.payload_size),
+      UINT64_LE_BYTES(header.seq),
+      UINT32_LE_BYTES(header.payload_crc),
+  };
+  const uint32_t header_crc = Crc32(0, bytes, sizeof(bytes));
+  const uint8_t crc_bytes[4] = {UINT32_LE_BYTES(header_crc)};
+  memcpy(out, bytes, sizeof(bytes));
+  memcpy(out + kHeaderCrcOffset, crc_bytes, sizeof(crc_bytes));
+}
+
+bool DecodeRawLogHeader(const uint8_t* in, RawLogSegmentHeader* out) {
+  if (memcmp(in, kRawLogMagic, sizeof(kRawLogMagic)) != 0 || in[4] != kRawLogVersion ||
+      in[5] != kRawLogHeaderSize || Crc32(0, in, kHeaderCrcOffset) != Uint32LeAt(&in[28])) {
+    return false;
+  }
+  *out = {
+      .segment_sectors = Uint16LeAt(&in[6]),
+      .log_id = Uint32LeAt(&in[8]),
+      .payload_size = Uint32LeAt(&in[12]),
+      .seq = Uint64LeAt(&in[16]),
+      .payload_crc = Uint32LeAt(&in[24]),
+  };
+  return out->segment_sectors >= 2 &&
+         out->payload_size <= uint32_t{out->segment_sectors} * kSdSectorSize - kRawLogHeaderSize;
+}
+
+esp_err_t ScanRawRingLog(BlockDevice* device, RawLogScan* out) {
+  CHECK(device != nullptr && out != nullptr);
+  *out = {};
+  const DmaBuffer sector = DmaBuffer::Allocate(kSdSectorSize);
+  if (!sector) {
+    return ESP_ERR_NO_MEM;
+  }
+  RawLogSegmentHeader header;
+  if (device->num_sectors() == 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  TRY(device->ReadSectors(sector.data(), 0, 1));
+  if (!DecodeRawLogHeader(sector.data(), &header)) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  out->segment_sectors = header.segment_sectors;
+  out->log_id = header.log_id;
+  out->num_segments = device->num_sectors() / header.segment_sectors;
+  if (out->num_segments == 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  // one sector per segment; the ring is small enough in segments that a linear scan is fine, and
+  // it tolerates any pattern of stale or torn segments
+  for (uint32_t i = 0; i < out->num_segments; i++) {
+    TRY(device->ReadSectors(sector.data(), i * header.segment_sectors, 1));
+    RawLogSegmentHeader h;
+    if (!DecodeRawLogHeader(sector.data(), &h) || h.log_id != out->log_id ||
+        h.segment_sectors != out->segment_sectors || h.seq % out->num_segments != i) {
+      continue;
+    }
+    if (out->num_valid == 0 || h.seq < out->first_seq) {
+      out->first_seq = h.seq;
+    }
+    if (out->num_valid == 0 || h.seq > out->last_seq) {
+      out->last_seq = h.seq;
+    }
+    ++out->num_valid;
+  }
+  return ESP_OK;
+}
+
+esp_err_t ExportRawRingLog(BlockDevice* device, FILE* out, RawLogExportStats* stats) {
+  CHECK(device != nullptr && out != nullptr && stats != nullptr);
+  *stats = {};
+  RawLogScan scan;
+  TRY(ScanRawRingLog(device, &scan));
+  const int segment_size = scan.segment_sectors * kSdSectorSize;
+  const DmaBuffer buf = DmaBuffer::Allocate(segment_size);
+  if (!buf) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (uint64_t seq = scan.first_seq; scan.num_valid && seq <= scan.last_seq; seq++) {
+    const uint32_t index = seq % scan.num_segments;
+    TRY(device->ReadSectors(buf.data(), index * scan.segment_sectors, scan.segment_sectors));
+    RawLogSegmentHeader h;
+    if (!DecodeRawLogHeader(buf.data(), &h) || h.log_id != scan.log_id || h.seq != seq) {
+      ++stats->missing;
+      continue;
+    }
+    const uint8_t* const payload = buf.data() + kRawLogHeaderSize;
+    if (Crc32(0, payload, h.payload_size) != h.payload_crc) {
+      ESP_LOGW(TAG, "segment %llu: payload CRC mismatch", static_cast<unsigned long long>(seq));
+      ++stats->corrupt;
+      continue;
+    }
+    if (fwrite(payload, 1, h.payload_size, out) != h.payload_size) {
+      return ESP_FAIL;
+    }
+    ++stats->segments;
+    stats->bytes += h.payload_size;
+  }
+  return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+RawRingLog::RawRingLog(BlockDevice* device, Option option)
+    : device_(device), option_(option), segment_size_(option.segment_sectors * kSdSectorSize) {}
+
+RawRingLog::~RawRingLog() { (void)Flush(); }
+
+esp_err_t RawRingLog::Setup() {
+  if (device_ == nullptr || option_.segment_sectors < 2 || option_.segment_sectors > UINT16_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  num_segments_ = device_->num_sectors() / option_.segment_sectors;
+  if (num_segments_ < 2) {
+    ESP_LOGE(TAG, "device too small: %u sectors", unsigned(device_->num_sectors()));
+    return ESP_ERR_INVALID_SIZE;
+  }
+  buf_ = DmaBuffer::Allocate(segment_size_);
+  if (!buf_) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  RawLogScan scan;
+  const esp_err_t err = ScanRawRingLog(device_, &scan);
+  if (err == ESP_OK && scan.num_valid && scan.segment_sectors == option_.segment_sectors) {
+    log_id_ = scan.log_id;
+    seq_ = scan.last_seq + 1;
+    ESP_LOGI(
+        TAG,
+        "continuing log %08x at segment %llu",
+        unsigned(log_id_),
+        static_cast<unsigned long long>(seq_));
+  } else if (err == ESP_OK || err == ESP_ERR_NOT_FOUND) {
+    log_id_ = NewLogId();
+    seq_ = 0;
+    ESP_LOGI(TAG, "new log %08x, %u segments", unsigned(log_id_), unsigned(num_segments_));
+  } else {
+    return err;
+  }
+  return ESP_OK;
+}
+
+esp_err_t RawRingLog::Append(const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    const size_t n = std::min<size_t>(size, segment_size_ - fill_);
+    memcpy(buf_.data() + fill_, p, n);
+    fill_ += n;
+    p += n;
+    size -= n;
+    dirty_ = true;
+    stats_.bytes_appended += n;
+    if (fill_ == segment_size_) {
+      TRY(WriteSegment());
+      ++stats_.segments_written;
+      ++seq_;
+      fill_ = kRawLogHeaderSize;
+      dirty_ = false;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t RawRingLog::Flush() {
+  if (!dirty_) {
+    return ESP_OK;
+  }
+  TRY(WriteSegment());
+  ++stats_.flushes;
+  dirty_ = false;
+  return ESP_OK;
+}
+
+esp_err_t RawRingLog::WriteSegment() {
+  const uint32_t payload_size = fill_ - kRawLogHeaderSize;
+  EncodeRawLogHeader(
+      {
+          .segment_sectors = static_cast<uint16_t>(option_.segment_sectors),
+          .log_id = log_id_,
+          .payload_size = payload_size,
+          .seq = seq_,
+          .payload_crc = Crc32(0, buf_.data() + kRawLogHeaderSize, payload_size),
+      },
+      buf_.data());
+  const uint32_t num_sectors = (fill_ + kSdSectorSize - 1) / kSdSectorSize;
+  const int64_t t0 = NowMonotonicUs();
+  const esp_err_t err = device_->WriteSectors(
+      buf_.data(), (seq_ % num_segments_) * option_.segment_sectors, num_sectors);
+  const uint32_t latency_us = NowMonotonicUs() - t0;
+  write_latency_hist_.Record(latency_us);
+  IoStats::Get().Record(IoOp::kWrite, latency_us);
+  if (err != ESP_OK) {
+    ESP_LOGE(
+        TAG,
+        "segment %llu write => %s",
+        static_cast<unsigned long long>(seq_),
+        esp_err_to_name(err));
+  }
+  return err;
+}
+
+}  // namespace io
@@ -0,0 +1,152 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include "common/histogram.hpp"
+#include "common/macros.hpp"
+#include "io/block_device.hpp"
+#include "io/dma_buffer.hpp"
+
+namespace io {
+
+// Raw ring log layout: the block device is split into fixed-size segments of `segment_sectors`
+// sectors, used round-robin. Segment `seq` (counting from 0 since the log was created) lives at
+// segment index `seq % num_segments`. Every segment starts with a header (all integers
+// little-endian), followed by the payload:
+//
+// | field           | size | notes                                             |
+// |-----------------|------|---------------------------------------------------|
+// | magic           | 4    | `kRawLogMagic`                                    |
+// | version         | 1    | `kRawLogVersion`                                  |
+// | header_size     | 1    | `kRawLogHeaderSize`                               |
+// | segment_sectors | 2    | segment size in sectors, so a reader needs no FAT |
+// | log_id          | 4    | random per log; tells stale segments apart        |
+// | payload_size    | 4    | valid payload bytes that follow the header        |
+// | seq             | 8    |                                                   |
+// | payload_crc     | 4    | CRC-32 of the payload                             |
+// | header_crc      | 4    | CRC-32 of the 28 bytes above                      |
+//
+// A segment may be written several times as it fills up (`RawRingLog::Flush`), always with the
+// same `seq` and a growing `payload_size`. Segment 0 always belongs to the newest log, so its
+// header is enough to find the geometry and `log_id` of the whole log.
+
+constexpr uint8_t kRawLogMagic[4] = {'R', 'L', 'O', 'G'};
+constexpr uint8_t kRawLogVersion = 1;
+constexpr int kRawLogHeaderSize = 32;
+
+struct RawLogSegmentHeader {
+  uint16_t segment_sectors;
+  uint32_t log_id;
+  uint32_t payload_size;
+  uint64_t seq;
+  uint32_t payload_crc;
+};
+
+/// Serializes a segment header into `out` (`kRawLogHeaderSize` bytes).
+void EncodeRawLogHeader(const RawLogSegmentHeader& header, uint8_t* out);
+
+/// \return false unless `in` holds a well-formed header (magic, version, header CRC)
+bool DecodeRawLogHeader(const uint8_t* in, RawLogSegmentHeader* out);
+
+/// What `ScanRawRingLog` found on a device.
+struct RawLogScan {
+  uint16_t segment_sectors = 0;
+  uint32_t log_id = 0;
+  uint32_t num_segments = 0;   // segments on the device
+  uint32_t num_valid = 0;      // segments with a valid header of this log
+  uint64_t first_seq = 0;      // oldest segment still on the device
+  uint64_t last_seq = 0;       // newest segment
+};
+
+/// Finds the log on `device` by reading the first sector of every segment.
+///
+/// \return `ESP_ERR_NOT_FOUND` if segment 0 has no valid header
+esp_err_t ScanRawRingLog(BlockDevice* device, RawLogScan* out);
+
+struct RawLogExportStats {
+  uint32_t segments = 0;  // exported
+  uint32_t missing = 0;   // in the sequence range, but overwritten or never written
+  uint32_t corrupt = 0;   // payload CRC mismatch, e.g. a write torn by power loss
+  uint64_t bytes = 0;
+};
+
+/// Writes the payload of every intact segment of the log on `device` to `out`, oldest first.
+esp_err_t ExportRawRingLog(BlockDevice* device, FILE* out, RawLogExportStats* stats);
+
+/// Append-only log straight onto a `BlockDevice` (e.g. a preallocated extent on the SD card, see
+/// `ReserveContiguousFile`), for data rates where FATFS overhead matters.
+///
+/// Bytes are gathered in a DMA-capable buffer of one segment; each full segment goes out as one
+/// multi-sector write, header included. There is no file system metadata to update, ever. Once the
+/// device is full, the oldest segments are overwritten.
+///
+/// On creation, an existing log with the same segment size is found (`ScanRawRingLog`) and
+/// continued after its newest segment; otherwise a new log is started.
+///
+/// \example
+/// \code{.cpp}
+/// auto device = io::FileBlockDevice::Create("ring.img", /*writable*/ true, 8192);
+/// auto log = io::RawRingLog::Create(device.get(), io::RawRingLog::Option{});
+/// log->Append(sample, sizeof(sample));
+/// log->Flush();
+/// \endcode
+class RawRingLog {
+ public:
+  struct Option {
+    /// sectors per segment, i.e. per write; at least 2
+    int segment_sectors = 64;
+  };
+
+  struct Stats {
+    uint64_t bytes_appended = 0;
+    uint32_t segments_written = 0;  ///< full segments
+    uint32_t flushes = 0;           ///< partial segments written by `Flush`
+  };
+
+  DEFINE_CREATE(RawRingLog)
+  ~RawRingLog();
+
+  /// Appends `size` bytes, writing out every segment that fills up.
+  esp_err_t Append(const void* data, size_t size);
+
+  /// Writes out the partially filled segment (only the sectors in use). Later appends continue in
+  /// the same segment, which is then written again.
+  esp_err_t Flush();
+
+  uint32_t log_id() const { return log_id_; }
+  /// \return sequence number of the segment being filled
+  uint64_t seq() const { return seq_; }
+  uint32_t num_segments() const { return num_segments_; }
+  Stats stats() const { return stats_; }
+  /// Time per segment write, full or partial (us).
+  const LatencyHistogram& write_latency_hist() const { return write_latency_hist_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(RawRingLog)
+
+ private:
+  BlockDevice* device_;
+  Option option_;
+  int segment_size_;
+  uint32_t num_segments_ = 0;
+  DmaBuffer buf_;
+  int fill_ = kRawLogHeaderSize;  // end of the payload in `buf_`
+  bool dirty_ = false;            // `buf_` has payload not written yet
+  uint32_t log_id_ = 0;
+  uint64_t seq_ = 0;
+  Stats stats_;
+  LatencyHistogram write_latency_hist_;
+
+  RawRingLog(BlockDevice* device, Option option);
+  esp_err_t Setup();
+
+  /// Writes the sectors of the current segment that hold data.
+  esp_err_t WriteSegment();
+};
+
+}  // namespace io
@@ -3,13 +3,20 @@
 
 #include "io/sd_card_daemon.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <optional>
 
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
+#include "sdmmc_cmd.h"
 
+#include "common/boot_profiler.hpp"
 #include "common/isr_yielder.hpp"
 #include "common/macros.hpp"
+#include "common/scoped_timer.hpp"
+#include "common/times.hpp"
+#include "io/fs_utils.hpp"
 #include "scope_guard/scope_guard.hpp"
 
 namespace io {
@@ -22,7 +29,10 @@ constexpr int kSdStackDepth = 4096;
 
 }  // namespace
 
-SdCardDaemon::SdCardDaemon(Option option) : option_(option) {}
+SdCardDaemon::SdCardDaemon(Option option)
+    : option_(option), ready_event_(xEventGroupCreateStatic(&ready_event_buf_)) {
+  set_instrumented(true);
+}
 
 esp_err_t SdCardDaemon::Setup() {
   // All pins below are fixed. All pins require 10k pull up except for CLK.
@@ -60,16 +70,22 @@ esp_err_t SdCardDaemon::Setup() {
   }
 
   TRY(gpio_isr_handler_add(option_.card_detect_pin, (void (*)(void*))HandleCardDetectEvent, this));
+  BootProfiler::Get().Mark("sd: card detect isr");
   return ESP_OK;
 }
 
 void SdCardDaemon::Teardown() {
   Stop();
   UnmountInternal();
+  vEventGroupDelete(ready_event_);
 }
 
 esp_err_t SdCardDaemon::Start(MountStateChangeCallback callback) {
   callback_ = callback;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    down_since_us_ = NowMonotonicUs();
+  }
   TRY(Task::SpawnSame(TAG, kSdStackDepth, option_.priority));
   gpio_intr_enable(option_.card_detect_pin);
   return ESP_OK;
@@ -83,27 +99,94 @@ void SdCardDaemon::Stop() {
 
 void SdCardDaemon::Ping() {
   if (const TaskHandle_t handle = Task::handle()) {
-    xTaskNotify(handle, 1, eSetBits);
+    xTaskNotify(handle, kPingEvent, eSetBits);
   }
 }
 
 void SdCardDaemon::PingFromIsr() {
   if (const TaskHandle_t handle = Task::handle()) {
     IsrYielder yielder;
-    xTaskNotifyFromISR(handle, 1, eSetBits, yielder);
+    xTaskNotifyFromISR(handle, kPingEvent, eSetBits, yielder);
   }
 }
 
-void SdCardDaemon::HandleCardDetectEvent(SdCardDaemon* self) { self->PingFromIsr(); }
+bool SdCardDaemon::WaitUntilReady(int timeout_ms) {
+  const TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+  xEventGroupWaitBits(ready_event_, kReadyBit, /*clear*/ pdFALSE, /*all*/ pdTRUE, ticks);
+  return CheckIsCardWorking();
+}
+
+void SdCardDaemon::SetHealthy(bool healthy) {
+  if (const bool was_healthy = healthy_.exchange(healthy); was_healthy != healthy) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    const int64_t now_us = NowMonotonicUs();
+    if (healthy) {
+      stats_.downtime_us += now_us - down_since_us_;
+    } else {
+      down_since_us_ = now_us;
+    }
+  }
+  if (healthy) {
+    xEventGroupSetBits(ready_event_, kReadyBit);
+  } else {
+    xEventGroupClearBits(ready_event_, kReadyBit);
+  }
+}
+
+SdCardDaemon::Stats SdCardDaemon::stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  Stats stats = stats_;
+  if (!healthy_.load()) {
+    stats.downtime_us += NowMonotonicUs() - down_since_us_;
+  }
+  return stats;
+}
+
+void SdCardDaemon::HandleCardDetectEvent(SdCardDaemon* self) {
+  // only a ping: debouncing is timed in the task
+  if (const TaskHandle_t handle = self->handle()) {
+    IsrYielder yielder;
+    xTaskNotifyFromISR(handle, kCardDetectEvent, eSetBits, yielder);
+  }
+}
 
 void SdCardDaemon::Run() {
+  int retry_ms = option_.mount_retry_time_ms;
   while (true) {
-    const bool card_inserted = GetCardDetected();
-    if (DoTheRightThing(card_inserted)) {
-      xTaskNotifyWait(0, 0, nullptr, portMAX_DELAY);
+    MarkLoop();
+    if (DoTheRightThing(GetCardDetected())) {
+      retry_ms = option_.mount_retry_time_ms;
+      WaitForEvents(portMAX_DELAY);
     } else {
-      const int retry_ms = option_.mount_retry_time_ms;
-      vTaskDelay(pdMS_TO_TICKS(retry_ms + esp_random() % (retry_ms / 2)));
+      const int delay_ms = retry_ms + esp_random() % (retry_ms / 2 + 1);
+      retry_ms = std::min(retry_ms * 2, option_.max_mount_retry_time_ms);
+      // a card detect edge means a different situation: start over from the shortest delay
+      if (WaitForEvents(pdMS_TO_TICKS(delay_ms)) & kCardDetectEvent) {
+        retry_ms = option_.mount_retry_time_ms;
+      }
+    }
+  }
+}
+
+uint32_t SdCardDaemon::WaitForEvents(TickType_t timeout) {
+  uint32_t events = 0;
+  if (xTaskNotifyWait(0, ~uint32_t{0}, &events, timeout) != pdTRUE) {
+    return 0;
+  }
+  if (events & kCardDetectEvent) {
+    DebounceCardDetect();
+  }
+  return events;
+}
+
+void SdCardDaemon::DebounceCardDetect() {
+  // every further edge (or ping) restarts the quiet period
+  const TickType_t quiet_ticks = pdMS_TO_TICKS(option_.card_detect_debounce_ms);
+  uint32_t events;
+  while (xTaskNotifyWait(0, ~uint32_t{0}, &events, quiet_ticks) == pdTRUE) {
+    if (events & kCardDetectEvent) {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.num_bounces;
     }
   }
 }
@@ -116,10 +199,15 @@ bool SdCardDaemon::DoTheRightThing(bool card_inserted) {
   }
 
   if (sd_card_) {
-    if (CheckIsCardWorking()) {
+    if (ProbeCard()) {
       ESP_LOGV(TAG, "card=in, mounted=yes, valid=yes --- nop");
+    } else if (const esp_err_t err = ReinitCard(); err == ESP_OK) {
+      ESP_LOGI(TAG, "card=in, mounted=yes, valid=no --- recovered in place");
     } else {
-      ESP_LOGV(TAG, "card=in, mounted=yes, valid=no --- unmount then retry with delay");
+      ESP_LOGW(
+          TAG,
+          "card=in, mounted=yes, valid=no --- reinit => %s; unmount then retry with delay",
+          esp_err_to_name(err));
       UnmountInternal();
       return false;
     }
@@ -127,6 +215,8 @@ bool SdCardDaemon::DoTheRightThing(bool card_inserted) {
     ESP_LOGV(TAG, "card=in, mounted=no --- mount");
     if (const esp_err_t err = MountInternal(); err != ESP_OK) {
       ESP_LOGV(TAG, "failed to mount --- retry with delay");
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.num_mount_failures;
       return false;
     }
   }
@@ -134,17 +224,43 @@ bool SdCardDaemon::DoTheRightThing(bool card_inserted) {
   return true;
 }
 
+sdmmc_slot_config_t SdCardDaemon::MakeSlotConfig(gpio_num_t card_detect_pin) {
+  sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+  slot_config.width = 4;
+  slot_config.gpio_cd = card_detect_pin;
+  return slot_config;
+}
+
 esp_err_t SdCardDaemon::MountInternal() {
   CHECK(sd_card_ == nullptr);
+  TRACE_SCOPE(kSdMount, 0);
+  SCOPED_TIMER("sd.mount");
+  const int64_t t0_us = NowMonotonicUs();
   sdmmc_host_t host = SDMMC_HOST_DEFAULT();
   host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+  const sdmmc_slot_config_t slot_config = MakeSlotConfig(option_.card_detect_pin);
 
-  sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
-  slot_config.width = 4;
-  slot_config.gpio_cd = option_.card_detect_pin;
-
+  // NOTE: host init, card init (CMD0..) and FAT mount all happen in here
   TRY(esp_vfs_fat_sdmmc_mount(
       CONFIG_MOUNT_ROOT, &host, &slot_config, &option_.mount_config, &sd_card_));
+  BootProfiler::Get().Mark("sd: sdmmc init + fat mount");
+
+  // Establish the free cluster count now, in the daemon task: with a stale FSINFO this scans the
+  // whole FAT, which we'd rather not do on a console command. FATFS keeps it up to date afterwards.
+  DWORD clust;
+  FATFS* fatfs;
+  if (const FRESULT result = f_getfree(kFatFsRoot, &clust, &fatfs); result == FR_OK) {
+    fatfs_ = fatfs;
+  } else {
+    ESP_LOGE(TAG, "f_getfree => %d", result);
+  }
+  BootProfiler::Get().Mark("sd: free cluster count");
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.num_mounts;
+    stats_.last_mount_us = NowMonotonicUs() - t0_us;
+  }
+  SetHealthy(true);
 
   if (callback_) {
     callback_(true);
@@ -154,11 +270,17 @@ esp_err_t SdCardDaemon::MountInternal() {
 
 bool SdCardDaemon::UnmountInternal() {
   if (sd_card_) {
+    SetHealthy(false);
+    fatfs_ = nullptr;
     // NOTE(summivox): Unfortunately this call is not thread-safe, and might fail when another
     // thread is halfway through a VFS operation. I haven't found a way to avoid this, partially
     // because there's no library function to "close everything" before/upon unmount.
     esp_vfs_fat_sdcard_unmount(CONFIG_MOUNT_ROOT, sd_card_);
     sd_card_ = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.num_unmounts;
+    }
     if (callback_) {
       callback_(false);
     }
@@ -167,36 +289,94 @@ bool SdCardDaemon::UnmountInternal() {
   return false;
 }
 
-bool SdCardDaemon::CheckIsCardWorking() { return GetFreeSpaceSectors() >= 0; }
+esp_err_t SdCardDaemon::ReinitCard() {
+  CHECK(sd_card_ != nullptr);
+  TRACE_SCOPE(kSdReinit, 0);
+  // `sdmmc_card_init` overwrites the card in place, so FATFS keeps using the same object
+  const sdmmc_host_t host = sd_card_->host;
+  const sdmmc_cid_t cid = sd_card_->cid;
+  const sdmmc_slot_config_t slot_config = MakeSlotConfig(option_.card_detect_pin);
+  // Deinit deletes the driver state (incl. its request mutex) from under anyone mid-transfer, so
+  // hold off all I/O first: FATFS through its volume lock, raw `SdmmcBlockDevice`s take it too.
+  // Without the lock (FATFS state unknown, or stuck) fall back to a full unmount.
+  FatVolumeLock lock(fatfs_);
+  if (!lock.locked()) {
+    return ESP_ERR_TIMEOUT;
+  }
+  TRY(host.deinit());
+  TRY(host.init());
+  TRY(sdmmc_host_init_slot(host.slot, &slot_config));
+  TRY(sdmmc_card_init(&host, sd_card_));
+  if (memcmp(&cid, &sd_card_->cid, sizeof(cid)) != 0) {
+    return ESP_ERR_INVALID_STATE;  // a different card
+  }
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.num_fast_recoveries;
+  }
+  SetHealthy(true);
+  return ESP_OK;
+}
 
-int32_t SdCardDaemon::GetFreeSpaceSectors() {
+bool SdCardDaemon::ProbeCard() {
+  if (!sd_card_) {
+    return false;
+  }
+  if (const esp_err_t err = sdmmc_get_status(sd_card_); err != ESP_OK) {
+    ESP_LOGE(TAG, "sdmmc_get_status => %s", esp_err_to_name(err));
+    SetHealthy(false);
+    return false;
+  }
+  SetHealthy(true);
+  return true;
+}
+
+void SdCardDaemon::ReportIoError() {
+  SetHealthy(false);
+  Ping();
+}
+
+int64_t SdCardDaemon::GetFreeClusters(int* out_cluster_sectors) {
   if (!sd_card_) {
     return -1;
   }
+  if (const FATFS* const fatfs = fatfs_) {
+    // maintained by FATFS on every cluster allocation/release; an aligned word, so safe to peek
+    const DWORD free_clst = *static_cast<const volatile DWORD*>(&fatfs->free_clst);
+    if (free_clst <= fatfs->n_fatent - 2) {
+      *out_cluster_sectors = fatfs->csize;
+      return free_clst;
+    }
+  }
+  // not known (yet): count the slow way
   DWORD clust;
   FATFS* fatfs;
-  FRESULT result = f_getfree(kFatFsRoot, &clust, &fatfs);
-  if (result != FR_OK) {
+  if (const FRESULT result = f_getfree(kFatFsRoot, &clust, &fatfs); result != FR_OK) {
     ESP_LOGE(TAG, "f_getfree => %d", result);
     return -1;
   }
-  // free space sectors <= card capacity sectors, which is stored as int32_t
-  return static_cast<int32_t>(clust) * fatfs->csize;
+  fatfs_ = fatfs;
+  *out_cluster_sectors = fatfs->csize;
+  return clust;
 }
 
-int64_t SdCardDaemon::GetFreeSpaceBytes() {
-  // NOTE(summivox): reason this is not implemented thru GetFreeSpaceSectors: we need `fatfs` too.
-  if (!sd_card_) {
+int32_t SdCardDaemon::GetFreeSpaceSectors() {
+  int cluster_sectors;
+  const int64_t clust = GetFreeClusters(&cluster_sectors);
+  if (clust < 0) {
     return -1;
   }
-  DWORD clust;
-  FATFS* fatfs;
-  FRESULT result = f_getfree(kFatFsRoot, &clust, &fatfs);
-  if (result != FR_OK) {
-    ESP_LOGE(TAG, "f_getfree => %d", result);
+  // free space sectors <= card capacity sectors, which is stored as int32_t
+  return static_cast<int32_t>(clust * cluster_sectors);
+}
+
+int64_t SdCardDaemon::GetFreeSpaceBytes() {
+  int cluster_sectors;
+  const int64_t clust = GetFreeClusters(&cluster_sectors);
+  if (clust < 0) {
     return -1;
   }
-  return int64_t{clust} * fatfs->csize * kSdSectorSize;
+  return clust * cluster_sectors * kSdSectorSize;
 }
 
 int32_t SdCardDaemon::GetCapacitySectors() {
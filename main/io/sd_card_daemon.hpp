@@ -6,11 +6,14 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 
 #include "driver/gpio.h"
 #include "driver/sdmmc_host.h"
 #include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 
 #include "common/task.hpp"
 
@@ -30,12 +33,33 @@ class SdCardDaemon : public Task {
     esp_vfs_fat_sdmmc_mount_config_t mount_config;
 
     gpio_num_t card_detect_pin = GPIO_NUM_NC;
-    int mount_retry_time_ms = 1000;
+    /// The detect pin must stay quiet this long after an edge before the card state is acted on.
+    int card_detect_debounce_ms = 50;
+
+    /// Delay before the first retry of a failed mount/probe; doubled on every further failure up
+    /// to `max_mount_retry_time_ms`, and reset by success or a card detect edge. Up to 50% jitter
+    /// is added on top.
+    int mount_retry_time_ms = 100;
+    int max_mount_retry_time_ms = 5000;
 
     int priority = 0;
   };
   using MountStateChangeCallback = std::function<void(bool mounted)>;
 
+  struct Stats {
+    uint32_t num_mounts = 0;
+    uint32_t num_mount_failures = 0;
+    uint32_t num_unmounts = 0;
+    /// probe failures cleared by re-initializing the same card in place, without a remount
+    uint32_t num_fast_recoveries = 0;
+    /// card detect edges absorbed by debouncing
+    uint32_t num_bounces = 0;
+    /// duration of the last full mount (sdmmc init + FAT mount + free cluster count)
+    int64_t last_mount_us = 0;
+    /// total time the card has not been working since `Start`, including the current outage
+    int64_t downtime_us = 0;
+  };
+
   static std::unique_ptr<SdCardDaemon> Create(Option option) {
     std::unique_ptr<SdCardDaemon> self{new SdCardDaemon(option)};
     if (self->Setup() != ESP_OK) {
@@ -56,11 +80,31 @@ class SdCardDaemon : public Task {
   /// action. Should be called from ISR context.
   void IRAM_ATTR PingFromIsr();
 
-  /// Validate if the SD card is actually operational
-  bool CheckIsCardWorking();
+  /// Cheap (no I/O) check that the card is mounted and has passed its last probe with no I/O error
+  /// reported since. Safe to call in a loop.
+  bool CheckIsCardWorking() const { return sd_card_ && healthy_.load(); }
+
+  /// Blocks until the card is mounted and working, or until `timeout_ms` has passed (-1: forever).
+  /// The daemon signals readiness as soon as a mount (or a probe after an I/O error) succeeds, so
+  /// this wakes up right away and costs nothing while waiting, unlike polling `CheckIsCardWorking`.
+  ///
+  /// \return true if the card is working
+  bool WaitUntilReady(int timeout_ms = -1);
+
+  /// Asks the card for its status (CMD13, ~100us) and updates the health flag accordingly.
+  ///
+  /// \return true if the card responded and is ready
+  bool ProbeCard();
+
+  /// Marks the card as not working, e.g. after a failed read/write, and prompts the daemon to probe
+  /// it (and remount if necessary).
+  void ReportIoError();
 
   /// Reads how many sectors (= 512 Bytes for SDHC/SDXC) are free on the card.
   ///
+  /// NOTE: The free cluster count is established once at mount (which may scan the FAT), and from
+  /// then on maintained in memory by FATFS as clusters are allocated and freed, so this is cheap.
+  ///
   /// \return -1 if no card or error
   ///         number of sectors (>= 0) free otherwise
   int32_t GetFreeSpaceSectors();
@@ -91,23 +135,62 @@ class SdCardDaemon : public Task {
 
   sdmmc_card_t* sd_card() const { return sd_card_; }
 
+  /// \return the FATFS volume on the card, or nullptr if not (yet) known
+  FATFS* fatfs() const { return fatfs_; }
+
+  Stats stats() const;
+
  protected:
   void Run() override;
 
  private:
   Option option_;
   sdmmc_card_t* sd_card_ = nullptr;
+  FATFS* fatfs_ = nullptr;  // set once the free cluster count is known
+  std::atomic<bool> healthy_{false};
   MountStateChangeCallback callback_;
 
+  static constexpr EventBits_t kReadyBit = BIT0;  // mirrors `CheckIsCardWorking()`
+  StaticEventGroup_t ready_event_buf_;
+  EventGroupHandle_t ready_event_;
+
+  // task notification bits
+  static constexpr uint32_t kPingEvent = 1 << 0;
+  static constexpr uint32_t kCardDetectEvent = 1 << 1;
+
+  mutable std::mutex stats_mutex_;
+  Stats stats_;
+  int64_t down_since_us_ = 0;  // valid while not healthy
+
   explicit SdCardDaemon(Option option);
 
   esp_err_t Setup();
   void Teardown();
 
+  /// Updates the health flag, and wakes up `WaitUntilReady` callers if the card is now working.
+  void SetHealthy(bool healthy);
+
+  /// Waits for task notifications.
+  ///
+  /// \return events received (bitwise or); 0 on timeout
+  uint32_t WaitForEvents(TickType_t timeout);
+
+  /// Waits until no card detect edge has been seen for `card_detect_debounce_ms`.
+  void DebounceCardDetect();
+
   /// Mounts the SD card VFS.
   /// Assumes the card is currently unmounted (will check).
   esp_err_t MountInternal();
 
+  /// Recovers a mounted card that failed its probe (e.g. after a CRC error) without unmounting:
+  /// re-initializes the SDMMC host and the card, then checks it is still the same card (CID), so
+  /// that the FATFS state (open files, cached FAT/directory sectors) is still valid. All I/O is
+  /// held off meanwhile (see `FatVolumeLock`).
+  ///
+  /// \return error if I/O cannot be held off, re-initialization fails or a different card is
+  ///         present; unmount then
+  esp_err_t ReinitCard();
+
   /// Unmounts the SD card VFS if not already unmounted.
   ///
   /// \return true if the card was mounted => now unmounted
@@ -122,6 +205,11 @@ class SdCardDaemon : public Task {
   ///         false if exception happened and we need to retry
   bool DoTheRightThing(bool card_inserted);
 
+  /// \return number of free clusters; -1 if unknown
+  int64_t GetFreeClusters(int* out_cluster_sectors);
+
+  static sdmmc_slot_config_t MakeSlotConfig(gpio_num_t card_detect_pin);
+
   static void IRAM_ATTR HandleCardDetectEvent(SdCardDaemon* self);
 };
 
@@ -0,0 +1,123 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/sector_reader.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace io {
+
+namespace {
+
+constexpr char TAG[] = "sector_reader";
+
+}  // namespace
+
+SectorReader::SectorReader(std::string path, Option option)
+    : path_(std::move(path)),
+      chunk_size_(
+          std::max(1, (option.chunk_size + kSdSectorSize - 1) / kSdSectorSize) * kSdSectorSize) {}
+
+SectorReader::~SectorReader() {
+  if (fd_ >= 0) {
+    (void)close(fd_);
+  }
+}
+
+esp_err_t SectorReader::Setup() {
+  fd_ = open(path_.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    ESP_LOGE(TAG, "open(%s) => %s", path_.c_str(), strerror(errno));
+    return ESP_ERR_NOT_FOUND;
+  }
+  buf_ = DmaBuffer::Allocate(chunk_size_);
+  if (!buf_) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+std::string_view SectorReader::NextChunk() {
+  if (error_ != ESP_OK) {
+    return {};
+  }
+  const bool in_buffer = buf_offset_ <= position_ && position_ < buf_offset_ + buf_size_;
+  if (!in_buffer) {
+    if (const esp_err_t err = LoadChunk(); err != ESP_OK) {
+      error_ = err;
+      return {};
+    }
+    if (position_ >= buf_offset_ + buf_size_) {
+      return {};  // end of file
+    }
+  }
+  const int begin = position_ - buf_offset_;
+  position_ = buf_offset_ + buf_size_;
+  return {buf_.chars() + begin, static_cast<size_t>(buf_size_ - begin)};
+}
+
+esp_err_t SectorReader::Seek(uint64_t offset) {
+  position_ = offset;
+  return ESP_OK;
+}
+
+size_t SectorReader::Read(void* data, size_t size) {
+  char* const p = static_cast<char*>(data);
+  size_t total = 0;
+  while (total < size) {
+    const std::string_view chunk = NextChunk();
+    if (chunk.empty()) {
+      break;
+    }
+    const size_t n = std::min(size - total, chunk.size());
+    memcpy(p + total, chunk.data(), n);
+    total += n;
+    // only consume what the caller took
+    position_ -= chunk.size() - n;
+  }
+  return total;
+}
+
+esp_err_t SectorReader::LoadChunk() {
+  const uint64_t aligned = position_ / chunk_size_ * chunk_size_;
+  const uint64_t buf_end = buf_offset_ + buf_size_;
+  // the end of the file was in this chunk (e.g. `tail -f`): only read what has been appended since
+  const bool append = aligned == buf_offset_ && position_ == buf_end && fd_offset_ == buf_end;
+  if (!append) {
+    if (aligned != fd_offset_) {
+      if (lseek(fd_, aligned, SEEK_SET) < 0) {
+        ESP_LOGE(TAG, "lseek(%s) => %s", path_.c_str(), strerror(errno));
+        fd_offset_ = kUnknownOffset;
+        return ESP_FAIL;
+      }
+      fd_offset_ = aligned;
+    }
+    buf_offset_ = aligned;
+    buf_size_ = 0;
+  }
+  // `read` may return short before the end of the file; only 0 means EOF
+  while (buf_size_ < chunk_size_) {
+    const ssize_t n = read(fd_, buf_.data() + buf_size_, chunk_size_ - buf_size_);
+    if (n < 0) {
+      ESP_LOGE(TAG, "read(%s) => %s", path_.c_str(), strerror(errno));
+      fd_offset_ = kUnknownOffset;
+      return ESP_FAIL;
+    }
+    if (n == 0) {
+      break;
+    }
+    DmaStats::Get().RecordTransfer(buf_.data() + buf_size_, n, fd_offset_);
+    buf_size_ += n;
+    fd_offset_ += n;
+  }
+  return ESP_OK;
+}
+
+}  // namespace io
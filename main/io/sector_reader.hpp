@@ -0,0 +1,98 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "common/macros.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+
+namespace io {
+
+/// Sequential reader that hands out views into its own buffer instead of copying, and bypasses
+/// newlib stdio (its buffer and the extra `memcpy` that comes with it) by reading the file
+/// descriptor directly.
+///
+/// Every read is `Option::chunk_size` bytes at a file offset that is a multiple of `chunk_size`,
+/// into a DMA-capable buffer. With `chunk_size` a multiple of the FAT cluster size, FATFS then
+/// transfers whole clusters straight into the buffer (multi-sector reads, no sector window copy),
+/// and the SDMMC driver DMAs into it without bouncing through its own buffer. The last chunk of a
+/// file that has grown since it was read is topped up with only the appended bytes.
+///
+/// \example
+/// \code{.cpp}
+/// auto reader = io::SectorReader::Create("/s/log.txt");
+/// for (std::string_view chunk; !(chunk = reader->NextChunk()).empty();) {
+///   fwrite(chunk.data(), 1, chunk.size(), stdout);
+/// }
+/// \endcode
+class SectorReader {
+ public:
+  struct Option {
+    /// Rounded up to a multiple of `kSdSectorSize`. Should be a multiple of the cluster size.
+    int chunk_size = 32 * 1024;
+  };
+
+  DEFINE_CREATE(SectorReader)
+  ~SectorReader();
+
+  /// Reads the next chunk of the file.
+  ///
+  /// \return view into the internal buffer, valid until the next call to `NextChunk`/`Read`/`Seek`;
+  ///         empty at the end of the file or on error (see `error()`)
+  std::string_view NextChunk();
+
+  /// Moves to the given file offset. The next chunk read starts from there, but is still read
+  /// from disk at an aligned offset.
+  esp_err_t Seek(uint64_t offset);
+
+  /// \return file offset of the byte following the last chunk returned
+  uint64_t Tell() const { return position_; }
+
+  /// Copying interface on top of `NextChunk`, for consumers that need their own buffer.
+  ///
+  /// \return number of bytes read; less than `size` only at the end of the file or on error
+  size_t Read(void* data, size_t size);
+
+  /// Adapts `Read` to the byte source expected by e.g. `FileLineReaderImpl`.
+  auto AsByteSource() {
+    return [this](char* data, size_t size) { return Read(data, size); };
+  }
+
+  /// \return `ESP_OK` unless a read has failed
+  esp_err_t error() const { return error_; }
+
+  int chunk_size() const { return chunk_size_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(SectorReader)
+
+ private:
+  static constexpr uint64_t kUnknownOffset = std::numeric_limits<uint64_t>::max();
+
+  std::string path_;
+  int fd_ = -1;
+  int chunk_size_;
+  DmaBuffer buf_;
+
+  uint64_t fd_offset_ = 0;   // current offset of `fd_`, or `kUnknownOffset`
+  uint64_t buf_offset_ = 0;  // file offset of `buf_[0]`
+  int buf_size_ = 0;         // valid bytes in `buf_`
+  uint64_t position_ = 0;    // file offset of the next byte handed out
+  esp_err_t error_ = ESP_OK;
+
+  SectorReader(std::string path, Option option);
+  explicit SectorReader(std::string path) : SectorReader(std::move(path), Option{}) {}
+  esp_err_t Setup();
+
+  /// Loads the aligned chunk containing `position_` into `buf_`, or tops up the partial one there.
+  esp_err_t LoadChunk();
+};
+
+}  // namespace io
@@ -0,0 +1,240 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#include "io/seekable_compressed_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/crc32.hpp"
+#include "common/utils.hpp"
+#include "io/lz_codec.hpp"
+
+namespace io {
+
+namespace {
+constexpr char TAG[] = "lzb";
+}  // namespace
+
+SeekableCompressedFile::SeekableCompressedFile(OwnedFile file) : file_(std::move(file)) {}
+
+esp_err_t SeekableCompressedFile::Setup() {
+  if (!file_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  FILE* const f = file_.get();
+
+  uint8_t header[kCompressedFileHeaderSize];
+  if (fread(header, sizeof(header), 1, f) != 1) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (memcmp(header, kCompressedFileMagic, sizeof(kCompressedFileMagic)) != 0) {
+    ESP_LOGE(TAG, "bad magic");
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  if (header[4] != kCompressedFileVersion || !(header[6] & kCompressedFileFlagIndexed)) {
+    ESP_LOGE(TAG, "stream has no index");
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  block_size_ = static_cast<int>(Uint32LeAt(&header[8]));
+  if (block_size_ <= 0 || block_size_ > LzCodec::kMaxBlockSize) {
+    ESP_LOGE(TAG, "invalid block size: %d", block_size_);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  uint8_t footer[kIndexFooterSize];
+  if (fseek(f, -kIndexFooterSize, SEEK_END) != 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const long footer_offset = ftell(f);
+  if (footer_offset < 0 || fread(footer, sizeof(footer), 1, f) != 1) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (memcmp(&footer[20], kIndexFooterMagic, sizeof(kIndexFooterMagic)) != 0) {
+    // most likely the writer was never closed
+    ESP_LOGE(TAG, "index footer missing");
+    return ESP_ERR_NOT_FOUND;
+  }
+  index_offset_ = Uint64LeAt(&footer[0]);
+  raw_size_ = Uint64LeAt(&footer[8]);
+  num_entries_ = Uint32LeAt(&footer[16]);
+  if (index_offset_ + uint64_t{num_entries_} * kIndexEntrySize !=
+      static_cast<uint64_t>(footer_offset)) {
+    ESP_LOGE(TAG, "index footer inconsistent with file size");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  // the entries must tile [0, raw_size_); only the ends are checked here (the rest would take a
+  // read per entry), gaps and overlaps in between are caught by `Read`
+  IndexEntry first{};
+  IndexEntry last{};
+  if (num_entries_ > 0) {
+    TRY(ReadIndexEntry(0, &first));
+    TRY(ReadIndexEntry(num_entries_ - 1, &last));
+  }
+  if (first.raw_offset != 0 || last.raw_offset + last.raw_size != raw_size_) {
+    ESP_LOGE(TAG, "index does not cover the stream");
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+
+  in_ = DmaBuffer::Allocate(block_size_);
+  out_ = DmaBuffer::Allocate(block_size_);
+  if (!in_ || !out_) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t SeekableCompressedFile::ReadIndexEntry(uint32_t i, IndexEntry* out_entry) {
+  CHECK(out_entry != nullptr);
+  if (i >= num_entries_) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint8_t entry[kIndexEntrySize];
+  if (fseek(file_.get(), index_offset_ + uint64_t{i} * kIndexEntrySize, SEEK_SET) != 0 ||
+      fread(entry, sizeof(entry), 1, file_.get()) != 1) {
+    return ESP_FAIL;
+  }
+  *out_entry = {
+      .raw_offset = Uint64LeAt(&entry[0]),
+      .file_offset = Uint64LeAt(&entry[8]),
+      .timestamp_us = Sint64LeAt(&entry[16]),
+      .raw_size = Uint32LeAt(&entry[24]),
+      .crc32 = Uint32LeAt(&entry[28]),
+  };
+  return ESP_OK;
+}
+
+esp_err_t SeekableCompressedFile::FindBlock(uint64_t raw_offset, uint32_t* out_block) {
+  // last entry with `entry.raw_offset <= raw_offset`
+  uint32_t lo = 0;
+  uint32_t hi = num_entries_;
+  while (hi - lo > 1) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    IndexEntry entry;
+    TRY(ReadIndexEntry(mid, &entry));
+    if (entry.raw_offset <= raw_offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  *out_block = lo;
+  return ESP_OK;
+}
+
+esp_err_t SeekableCompressedFile::FindTime(int64_t t_unix_us, uint64_t* out_raw_offset) {
+  CHECK(out_raw_offset != nullptr);
+  // first entry with `entry.timestamp_us >= t_unix_us`
+  uint32_t lo = 0;
+  uint32_t hi = num_entries_;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    IndexEntry entry;
+    TRY(ReadIndexEntry(mid, &entry));
+    if (entry.timestamp_us < t_unix_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == num_entries_) {
+    *out_raw_offset = raw_size_;
+    return ESP_OK;
+  }
+  IndexEntry entry;
+  TRY(ReadIndexEntry(lo, &entry));
+  *out_raw_offset = entry.raw_offset;
+  return ESP_OK;
+}
+
+esp_err_t SeekableCompressedFile::LoadBlock(uint32_t i) {
+  if (block_ == i) {
+    return ESP_OK;
+  }
+  block_ = -1;
+  IndexEntry entry;
+  TRY(ReadIndexEntry(i, &entry));
+  if (entry.raw_size > static_cast<uint32_t>(block_size_)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  FILE* const f = file_.get();
+  uint8_t header[kBlockHeaderSize];
+  if (fseek(f, entry.file_offset, SEEK_SET) != 0 || fread(header, sizeof(header), 1, f) != 1) {
+    return ESP_FAIL;
+  }
+  const uint32_t stored_tag = Uint32LeAt(&header[4]);
+  const uint32_t stored_size = stored_tag & ~kStoredRawFlag;
+  if (Uint32LeAt(&header[0]) != entry.raw_size || stored_size > entry.raw_size) {
+    ESP_LOGE(TAG, "block %u: header does not match index", static_cast<unsigned>(i));
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  const bool stored_raw = stored_tag & kStoredRawFlag;
+  uint8_t* const payload = stored_raw ? out_.data() : in_.data();
+  if (fread(payload, 1, stored_size, f) != stored_size) {
+    return ESP_FAIL;
+  }
+  if (Crc32(0, payload, stored_size) != entry.crc32) {
+    ESP_LOGE(TAG, "block %u: CRC mismatch", static_cast<unsigned>(i));
+    return ESP_ERR_INVALID_CRC;
+  }
+  if (!stored_raw) {
+    const int raw_size = static_cast<int>(entry.raw_size);
+    if (LzCodec::Decompress(in_.data(), stored_size, out_.data(), raw_size) != raw_size) {
+      ESP_LOGE(TAG, "block %u: corrupted payload", static_cast<unsigned>(i));
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  block_ = i;
+  block_raw_offset_ = entry.raw_offset;
+  block_raw_size_ = entry.raw_size;
+  return ESP_OK;
+}
+
+esp_err_t SeekableCompressedFile::Seek(uint64_t raw_offset) {
+  position_ = std::min(raw_offset, raw_size_);
+  return ESP_OK;
+}
+
+size_t SeekableCompressedFile::Read(void* data, size_t size) {
+  uint8_t* const p = static_cast<uint8_t*>(data);
+  size_t total = 0;
+  while (total < size && position_ < raw_size_ && error_ == ESP_OK) {
+    const bool in_block =
+        block_ >= 0 && block_raw_offset_ <= position_ &&
+        position_ < block_raw_offset_ + block_raw_size_;
+    if (!in_block) {
+      uint32_t next;
+      if (block_ >= 0 && position_ == block_raw_offset_ + block_raw_size_) {
+        next = block_ + 1;  // sequential read --- no need to search
+      } else if (const esp_err_t err = FindBlock(position_, &next); err != ESP_OK) {
+        error_ = err;
+        break;
+      }
+      if (const esp_err_t err = LoadBlock(next); err != ESP_OK) {
+        error_ = err;
+        break;
+      }
+      if (position_ < block_raw_offset_ || position_ >= block_raw_offset_ + block_raw_size_) {
+        // entries overlapping or leaving gaps: the index cannot be trusted (and looping on would
+        // never get anywhere)
+        ESP_LOGE(
+            TAG,
+            "block %u does not cover offset %llu",
+            static_cast<unsigned>(next),
+            static_cast<unsigned long long>(position_));
+        error_ = ESP_ERR_INVALID_RESPONSE;
+        break;
+      }
+      continue;
+    }
+    const size_t begin = position_ - block_raw_offset_;
+    const size_t n = std::min(size - total, block_raw_size_ - begin);
+    memcpy(p + total, &out_[begin], n);
+    total += n;
+    position_ += n;
+  }
+  return total;
+}
+
+}  // namespace io
@@ -0,0 +1,101 @@
+// Copyright 2022 summivox. All rights reserved.
+// Authors: summivox@gmail.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "common/macros.hpp"
+#include "io/compressed_file.hpp"
+#include "io/dma_buffer.hpp"
+#include "io/file.hpp"
+
+namespace io {
+
+/// Random-access reader for indexed streams produced by `CompressedFileWriter` (i.e. with
+/// `Option::index_spool_path` set). Looking up an offset or a timestamp is a binary search over the
+/// on-disk index (only the footer is kept in memory), after which exactly one block is decoded.
+///
+/// NOTE: Offsets into the compressed file go through `fseek`, which takes a `long`; on ESP32 this
+/// limits compressed files to 2 GiB.
+///
+/// \example
+/// \code{.cpp}
+/// auto file = io::SeekableCompressedFile::Create(io::OpenFile("/s/log.lzb", "rb"));
+/// uint64_t offset;
+/// file->FindTime(NowUnixUs() - 3600'000'000, &offset);
+/// file->Seek(offset);
+/// for (std::string_view line : io::FileLineReader(file->AsByteSource(), 256)) { /* ... */ }
+/// \endcode
+class SeekableCompressedFile {
+ public:
+  struct IndexEntry {
+    uint64_t raw_offset;
+    uint64_t file_offset;
+    int64_t timestamp_us;
+    uint32_t raw_size;
+    uint32_t crc32;
+  };
+
+  DEFINE_CREATE(SeekableCompressedFile)
+
+  /// \return total uncompressed size of the stream
+  uint64_t raw_size() const { return raw_size_; }
+  uint32_t num_blocks() const { return num_entries_; }
+
+  /// Moves the read position to the given uncompressed offset (clamped to `raw_size()`).
+  esp_err_t Seek(uint64_t raw_offset);
+  uint64_t Tell() const { return position_; }
+
+  /// Reads up to `size` uncompressed bytes from the current position.
+  ///
+  /// \return number of bytes read; less than `size` only at the end of the stream or on error
+  size_t Read(void* data, size_t size);
+
+  /// Adapts `Read` to the byte source expected by e.g. `FileLineReaderImpl`.
+  auto AsByteSource() {
+    return [this](char* data, size_t size) { return Read(data, size); };
+  }
+
+  /// Finds the first block written at or after `t_unix_us` (assuming block timestamps are
+  /// non-decreasing).
+  ///
+  /// \param out_raw_offset   start of that block, or `raw_size()` if every block is older
+  esp_err_t FindTime(int64_t t_unix_us, uint64_t* out_raw_offset);
+
+  /// Reads one index entry from the file.
+  esp_err_t ReadIndexEntry(uint32_t i, IndexEntry* out_entry);
+
+  /// \return `ESP_OK` unless a read/decode error has happened (e.g. CRC mismatch)
+  esp_err_t error() const { return error_; }
+
+  NOT_COPYABLE_NOR_MOVABLE(SeekableCompressedFile)
+
+ private:
+  OwnedFile file_;
+  int block_size_ = 0;
+  uint64_t index_offset_ = 0;
+  uint64_t raw_size_ = 0;
+  uint32_t num_entries_ = 0;
+
+  DmaBuffer in_;                    // compressed payload of the current block
+  DmaBuffer out_;                   // decompressed current block
+  int64_t block_ = -1;              // index of the block in `out_`; -1 if none
+  uint64_t block_raw_offset_ = 0;
+  uint32_t block_raw_size_ = 0;
+
+  uint64_t position_ = 0;
+  esp_err_t error_ = ESP_OK;
+
+  explicit SeekableCompressedFile(OwnedFile file);
+  esp_err_t Setup();
+
+  /// \return index of the block containing `raw_offset`
+  esp_err_t FindBlock(uint64_t raw_offset, uint32_t* out_block);
+  /// Decodes block `i` into `out_` unless it is already there.
+  esp_err_t LoadBlock(uint32_t i);
+};
+
+}  // namespace io